@@ -0,0 +1,244 @@
+/* 
+ * Copyright (C) 2025 Zoltán Rácz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dir.h"
+#include "agg.h"
+
+#define AGG_INITIAL_SIZE 64
+
+static unsigned int agg_hash(struct dir_entry *anchor, int kind, const char *name, long id);
+static struct agg_item *agg_find_slot(struct agg_table *table, struct dir_entry *anchor, int kind, const char *name, long id, unsigned int hash);
+static int agg_grow(struct agg_table *table);
+
+struct agg_table *agg_new_table()
+{
+	struct agg_table *table = (struct agg_table *)malloc(sizeof(struct agg_table));
+
+	if (!table) {
+		printf("Error allocating memory for aggregation table!\n");
+		return NULL;
+	}
+
+	table->items = calloc(AGG_INITIAL_SIZE, sizeof(struct agg_item));
+
+	if (!table->items) {
+		printf("Error allocating memory for aggregation table items!\n");
+		free(table);
+		return NULL;
+	}
+
+	table->size = AGG_INITIAL_SIZE;
+	table->len = 0;
+
+	return table;
+}
+
+int agg_add(struct agg_table *table, struct dir_entry *anchor, int kind, const char *name, long id, const struct dir_totals *totals)
+{
+	unsigned int hash = agg_hash(anchor, kind, name, id);
+	struct agg_item *item = agg_find_slot(table, anchor, kind, name, id, hash);
+
+	if (!item->kind) {
+		/**
+		** new key. We keep the load factor under 1/2, 
+		** so the linear probing stays short
+		**/
+		if ((table->len + 1) * 2 > table->size) {
+			if (agg_grow(table) != 0)
+				return -1;
+
+			item = agg_find_slot(table, anchor, kind, name, id, hash);
+		}
+
+		if (name) {
+			item->name = strdup(name);
+
+			if (!item->name) {
+				printf("Error allocating memory for aggregation key!\n");
+				return -1;
+			}
+		}
+
+		item->anchor = anchor;
+		item->kind = kind;
+		item->id = id;
+		item->hash = hash;
+		table->len++;
+	}
+
+	dir_totals_add(&item->totals, totals);
+
+	return 0;
+}
+
+int agg_merge(struct agg_table *dst, struct agg_table *src)
+{
+	for (size_t i=0;i<src->size;i++) {
+		struct agg_item *item = &src->items[i];
+
+		if (!item->kind)
+			continue;
+
+		if (agg_add(dst, item->anchor, item->kind, item->name, item->id, &item->totals) != 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/**
+** every item bound to a directory is added to the breakdown table of that
+** directory and of all its parents, and to the summary table (if not NULL)
+**/
+int agg_rollup(struct agg_table *table, struct agg_table *summary)
+{
+	for (size_t i=0;i<table->size;i++) {
+		struct agg_item *item = &table->items[i];
+
+		if (!item->kind)
+			continue;
+
+		if (summary && agg_add(summary, NULL, item->kind, item->name, item->id, &item->totals) != 0)
+			return -1;
+
+		for (struct dir_entry *d = item->anchor; d; d = d->parent) {
+			if (!d->breakdown) {
+				d->breakdown = agg_new_table();
+
+				if (!d->breakdown)
+					return -1;
+			}
+
+			if (agg_add(d->breakdown, NULL, item->kind, item->name, item->id, &item->totals) != 0)
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+** returns a newly allocated array with the items of the given kind. 
+** The items are not copied, the array is only valid while the table is not modified
+**/
+struct agg_item **agg_get_items(struct agg_table *table, int kind, int *items_len)
+{
+	struct agg_item **items = calloc(table->len + 1, sizeof(struct agg_item *));
+	int len = 0;
+
+	if (!items) {
+		printf("Error allocating memory for aggregation items!\n");
+		*items_len = 0;
+		return NULL;
+	}
+
+	for (size_t i=0;i<table->size;i++) {
+		if (table->items[i].kind == kind)
+			items[len++] = &table->items[i];
+	}
+
+	*items_len = len;
+
+	return items;
+}
+
+void agg_free_table(struct agg_table *table)
+{
+	if (!table)
+		return;
+
+	for (size_t i=0;i<table->size;i++) {
+		if (table->items[i].name)
+			free(table->items[i].name);
+	}
+
+	free(table->items);
+	free(table);
+}
+
+static unsigned int agg_hash(struct dir_entry *anchor, int kind, const char *name, long id)
+{
+	// FNV-1a
+	unsigned int hash = 2166136261u;
+	unsigned long mix = (unsigned long)anchor ^ ((unsigned long)id << 8) ^ (unsigned long)kind;
+
+	for (size_t i=0;i<sizeof(mix);i++) {
+		hash ^= (mix >> (i * 8)) & 0xff;
+		hash *= 16777619u;
+	}
+
+	if (name) {
+		for (const char *c = name; *c; c++) {
+			hash ^= (unsigned char)*c;
+			hash *= 16777619u;
+		}
+	}
+
+	return hash;
+}
+
+static struct agg_item *agg_find_slot(struct agg_table *table, struct dir_entry *anchor, int kind, const char *name, long id, unsigned int hash)
+{
+	size_t mask = table->size - 1;
+	size_t pos = hash & mask;
+
+	while (1) {
+		struct agg_item *item = &table->items[pos];
+
+		if (!item->kind)
+			return item;
+
+		if (item->hash == hash && item->kind == kind && item->anchor == anchor && item->id == id) {
+			if ((!name && !item->name) || (name && item->name && strcmp(name, item->name) == 0))
+				return item;
+		}
+
+		pos = (pos + 1) & mask;
+	}
+}
+
+static int agg_grow(struct agg_table *table)
+{
+	struct agg_item *old_items = table->items;
+	size_t old_size = table->size;
+
+	table->items = calloc(old_size * 2, sizeof(struct agg_item));
+
+	if (!table->items) {
+		printf("Error allocating memory for aggregation table items!\n");
+		table->items = old_items;
+		return -1;
+	}
+
+	table->size = old_size * 2;
+
+	for (size_t i=0;i<old_size;i++) {
+		struct agg_item *item = &old_items[i];
+
+		if (!item->kind)
+			continue;
+
+		*agg_find_slot(table, item->anchor, item->kind, item->name, item->id, item->hash) = *item;
+	}
+
+	free(old_items);
+
+	return 0;
+}
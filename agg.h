@@ -0,0 +1,58 @@
+/* 
+ * Copyright (C) 2025 Zoltán Rácz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  
+ */
+
+#include "dir.h"
+
+#ifndef AGG_H
+#define AGG_H
+
+// what an aggregation item is keyed by
+#define AGG_KIND_TYPE 1 // file extension or file type, keyed by name
+#define AGG_KIND_UID 2 // owner user, keyed by id
+#define AGG_KIND_GID 3 // owner group, keyed by id
+
+/**
+** one row of a breakdown table: the totals of all files with the same key
+** (ex. extension) found below the anchor directory. Anchor is NULL in the
+** tables that are not bound to a directory (global summary, per-dentry tables)
+**/
+struct agg_item {
+	struct dir_entry *anchor;
+	int kind;
+	char *name;
+	long id;
+	unsigned int hash;
+	struct dir_totals totals;
+};
+
+/**
+** open addressing hash table. Workers own one each, so adding
+** to it doesn`t need any locking
+**/
+struct agg_table {
+	struct agg_item *items;
+	size_t size;
+	size_t len;
+};
+
+struct agg_table *agg_new_table();
+int agg_add(struct agg_table *table, struct dir_entry *anchor, int kind, const char *name, long id, const struct dir_totals *totals);
+int agg_merge(struct agg_table *dst, struct agg_table *src);
+int agg_rollup(struct agg_table *table, struct agg_table *summary);
+struct agg_item **agg_get_items(struct agg_table *table, int kind, int *items_len);
+void agg_free_table(struct agg_table *table);
+
+#endif //AGG_H
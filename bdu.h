@@ -14,12 +14,135 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.  
  */
 
+/**
+** libbdu - the scanner of bdu as a library.
+**
+** All the state of a scan lives in a struct bdu_scan, so any number of scans 
+** can run at the same time in one process:
+**
+**	struct bdu_scan_options opts = {.num_threads = 8};
+**	struct bdu_scan *scan = bdu_scan_new(&opts);
+**
+**	bdu_scan_add_root(scan, "/home");
+**	bdu_scan_run(scan);
+**	... use bdu_scan_get_roots(scan, &roots_len) ...
+**	bdu_scan_free(scan);
+**
+** If bdu_scan_run fails (returns -1), the scan can only be freed
+**/
+
+#include <pthread.h>
+#include <signal.h>
+#include <sys/stat.h>
+
+#include "dir.h"
+#include "agg.h"
+#include "spill.h"
+#include "numa.h"
+#include "errlog.h"
+
 #ifndef BDU_H
 #define BDU_H
 
+struct bdu_scan;
+
+// bdu_scan_run was stopped by bdu_scan_options.interrupt, after writing a checkpoint
+#define BDU_SCAN_INTERRUPTED 1
+
+// --io-class of the workers
+#define IO_CLASS_NONE 0 // inherited from the caller
+#define IO_CLASS_BEST_EFFORT 2
+#define IO_CLASS_IDLE 3
+
 struct thread_data {
 	int thread_id;
-	struct queue_list *list;
+	struct queue_list *list; // the queue of the worker`s NUMA node
+	int cpu; // the CPU the worker is pinned to, -1 if not pinned
+	int node;
+	struct agg_table *breakdown; // --by-type and --by-owner totals collected by this thread
+	size_t entries; // directories and files scanned by this thread
+	size_t reused; // directories not modified since the previous scan, see bdu_scan_reuse
+	unsigned long busy_ns; // the time spent scanning them
+	struct err_ring *errors; // failed filesystem operations, reported after the scan
+	struct bdu_scan *scan;
+};
+
+/**
+** callbacks are called from the worker threads, so they should be thread safe.
+** The entries passed to them belong to the scan and must not be freed
+**/
+struct bdu_callbacks {
+	// the directory and everything below it has been scanned, its totals are final
+	void (*dir_complete)(struct dir_entry *dentry, void *user_data);
+	// a non directory entry was found in parent. st is NULL for entries that are not lstat-ed
+	void (*file)(struct dir_entry *parent, const char *path, const struct stat *st, void *user_data);
+	void *user_data;
 };
 
-#endif //BDU_H
\ No newline at end of file
+/**
+** lets the caller run the workers on its own thread pool instead of threads
+** created by bdu_scan_run. submit should run fn(arg) on one of the pool threads
+** and return 0, or -1 if the task couldn`t be queued
+**/
+struct bdu_executor {
+	int (*submit)(void (*fn)(void *), void *arg, void *pool);
+	void *pool;
+};
+
+struct bdu_scan_options {
+	int num_threads; // number of workers, 1 if <= 0
+	int auto_threads; // --threads=auto, only as many of the num_threads workers scan as give the best throughput
+	int sort_flags; // the order spilled children are written in (SORT_* flags)
+	size_t memory_limit; // completed subtrees are spilled to disk above this, 0 = no limit
+	time_t deadline; // seconds after bdu_scan_run, when queued directories are skipped. 0 = no deadline
+	const int *cpus; // workers are pinned to these CPUs round robin, NULL = not pinned. Copied by bdu_scan_new
+	int cpus_len;
+	int numa; // NUMA_* memory policy, also gives each node its own queue
+	int io_class; // IO_CLASS_* set on every worker with ioprio_set
+	int io_level; // 0 (highest) - 7, for IO_CLASS_BEST_EFFORT
+	long max_ops; // opendir + lstat calls per second of all the workers, 0 = no limit
+	int dedupe_dirs; // directories reachable on several paths are scanned once, always on with dir.dereference
+	size_t threshold; // completed subdirectories smaller than this are folded into an "(other)" entry, 0 = keep all
+	int threshold_apparent; // threshold is compared to the apparent size instead of the disk usage
+	size_t min_inodes; // the same with the number of inodes
+	const char *checkpoint_path; // the state of the scan is saved here periodically, NULL = never. Removed when the scan completes
+	time_t checkpoint_interval; // seconds between two checkpoints
+	volatile sig_atomic_t *interrupt; // set by a signal handler: a last checkpoint is written and the scan stops
+	int prefetch_depth; // directories per worker opened ahead by helper threads (with their first readdir), 0 = off
+	int prefetch_threads; // the helper threads opening them, 0 = one per directory opened ahead, at most 16
+	struct dir_scan_options dir;
+	struct bdu_callbacks callbacks;
+	struct bdu_executor executor; // optional, submit is NULL if not used
+};
+
+/**
+** counters of a finished scan, for --stats
+**/
+struct bdu_scan_stats {
+	size_t entries; // directories and files scanned
+	double elapsed; // seconds spent in bdu_scan_run
+	double entry_us; // the time a worker spent on one entry (mostly lstat), on average
+	int workers; // the workers allowed to scan at the end, chosen by auto_threads
+	int max_workers;
+	int adjustments; // how many times auto_threads changed the number of workers
+	size_t reused; // directories that reused the totals of the previous scan
+	size_t prefetched; // directories found already open (prefetch_depth)
+};
+
+struct bdu_scan *bdu_scan_new(const struct bdu_scan_options *opts);
+int bdu_scan_add_root(struct bdu_scan *scan, const char *path);
+int bdu_scan_resume(struct bdu_scan *scan, const char *checkpoint_path);
+int bdu_scan_reuse(struct bdu_scan *scan, struct bdu_scan *prev);
+int bdu_scan_run(struct bdu_scan *scan);
+
+struct dir_entry **bdu_scan_get_roots(struct bdu_scan *scan, int *roots_len);
+struct agg_table *bdu_scan_get_breakdown(struct bdu_scan *scan);
+struct spill_file *bdu_scan_get_spill(struct bdu_scan *scan);
+int bdu_scan_get_active_workers(struct bdu_scan *scan);
+size_t bdu_scan_get_unscanned(struct bdu_scan *scan);
+void bdu_scan_get_stats(struct bdu_scan *scan, struct bdu_scan_stats *stats);
+struct err_group *bdu_scan_get_errors(struct bdu_scan *scan, int *groups_len, size_t *total);
+
+void bdu_scan_free(struct bdu_scan *scan);
+
+#endif //BDU_H
@@ -0,0 +1,373 @@
+/* 
+ * Copyright (C) 2025 Zoltán Rácz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  
+ */
+
+/**
+** A checkpoint starts with a header, followed by the trees of the roots in
+** depth first order: a record for every dentry, then the chunks of the
+** dentry still waiting in the queue, then the records of its children. 
+** The children of a completed dentry are left out below the displayed 
+** depth, only its totals are needed then. A dentry that is still in the 
+** queue is marked as queued, the others have been scanned already.
+**
+** The file is written next to the previous one and renamed over it, so an
+** interrupted write leaves the last complete checkpoint in place.
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <linux/limits.h>
+
+#include "dir.h"
+#include "checkpoint.h"
+
+struct checkpoint_header {
+	char magic[8];
+	int roots_len;
+	int max_depth;
+	int num_age_limits;
+	time_t now;
+};
+
+struct checkpoint_record {
+	struct dir_totals totals;
+	time_t last_mtime;
+	int children_len; // the children saved after this record
+	int chunks_len;
+	int queued;
+	int path_len;
+	int has_mdate;
+};
+
+struct checkpoint_chunk {
+	size_t names_len;
+	int len;
+};
+
+static int write_dentry(FILE *fp, struct dir_entry *dentry, struct checkpoint_state *state);
+static struct dir_entry *read_dentry(FILE *fp, struct dir_entry *parent, struct checkpoint_state *state);
+static int read_chunk(FILE *fp, struct dir_entry *dentry, struct checkpoint_state *state);
+static int append_ptr(void ***array, int *len, void *ptr);
+static int cmp_ptr(const void *a, const void *b);
+static int cmp_chunk(const void *a, const void *b);
+
+/**
+** writes the state to path atomically. The queued and chunks arrays
+** are sorted in place, so the records can look themselves up in them
+**/
+int checkpoint_write(const char *path, struct checkpoint_state *state)
+{
+	struct checkpoint_header header;
+	char tmp_path[PATH_MAX+4];
+	FILE *fp;
+	int ret = 0;
+
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+	fp = fopen(tmp_path, "w");
+
+	if (!fp) {
+		printf("Error creating checkpoint file \"%s\" (%s)\n", tmp_path, strerror(errno));
+		return -1;
+	}
+
+	qsort(state->queued, state->queued_len, sizeof(struct dir_entry *), cmp_ptr);
+	qsort(state->chunks, state->chunks_len, sizeof(struct dir_chunk *), cmp_chunk);
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+	header.roots_len = state->roots_len;
+	header.max_depth = state->max_depth;
+	header.num_age_limits = state->num_age_limits;
+	header.now = state->now;
+
+	if (fwrite(&header, sizeof(header), 1, fp) != 1)
+		ret = -1;
+
+	for (int i=0;i<state->roots_len && ret == 0;i++)
+		ret = write_dentry(fp, state->roots[i], state);
+
+	// the rename must not be seen before the data is on the disk
+	if (ret != 0 || fflush(fp) != 0 || fsync(fileno(fp)) != 0)
+		ret = -1;
+
+	if (fclose(fp) != 0)
+		ret = -1;
+
+	if (ret == 0 && rename(tmp_path, path) != 0)
+		ret = -1;
+
+	if (ret != 0) {
+		printf("Error writing checkpoint file \"%s\" (%s)\n", path, strerror(errno));
+		unlink(tmp_path);
+	}
+
+	return ret;
+}
+
+/**
+** reads a checkpoint written by checkpoint_write. The pending counts of
+** the dentries are rebuilt from what is left to do below them, so the 
+** queued dentries and the chunks can be scanned as if they had never 
+** been interrupted
+**/
+int checkpoint_read(const char *path, struct checkpoint_state *state)
+{
+	struct checkpoint_header header;
+	FILE *fp = fopen(path, "r");
+
+	memset(state, 0, sizeof(struct checkpoint_state));
+
+	if (!fp) {
+		printf("Error opening checkpoint file \"%s\" (%s)\n", path, strerror(errno));
+		return -1;
+	}
+
+	if (fread(&header, sizeof(header), 1, fp) != 1 || 
+			memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) != 0 || header.roots_len <= 0) {
+		printf("Error reading checkpoint file \"%s\", it is not a bdu checkpoint!\n", path);
+		fclose(fp);
+		return -1;
+	}
+
+	state->max_depth = header.max_depth;
+	state->num_age_limits = header.num_age_limits;
+	state->now = header.now;
+	state->roots = calloc(header.roots_len, sizeof(struct dir_entry *));
+
+	if (!state->roots) {
+		printf("Error allocating memory for root entries array!\n");
+		fclose(fp);
+		return -1;
+	}
+
+	for (int i=0;i<header.roots_len;i++) {
+		struct dir_entry *root = read_dentry(fp, NULL, state);
+
+		if (!root) {
+			printf("Error reading checkpoint file \"%s\"!\n", path);
+			fclose(fp);
+
+			for (int j=0;j<state->chunks_len;j++)
+				dir_free_chunk(state->chunks[j]);
+
+			for (int j=0;j<state->roots_len;j++)
+				dir_free_entry(state->roots[j]);
+
+			checkpoint_free_state(state);
+			return -1;
+		}
+
+		state->roots[state->roots_len++] = root;
+	}
+
+	fclose(fp);
+
+	return 0;
+}
+
+/**
+** frees the arrays of the state, not the dentries and chunks in them
+**/
+void checkpoint_free_state(struct checkpoint_state *state)
+{
+	free(state->roots);
+	free(state->queued);
+	free(state->chunks);
+
+	memset(state, 0, sizeof(struct checkpoint_state));
+}
+
+static int write_dentry(FILE *fp, struct dir_entry *dentry, struct checkpoint_state *state)
+{
+	struct checkpoint_record rec;
+	struct dir_chunk key = {.dentry = dentry};
+	struct dir_chunk *key_ptr = &key;
+	struct dir_chunk **chunk;
+	int complete = dentry->pending == 0;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.totals = dentry->totals;
+	rec.last_mtime = dentry->last_mtime;
+	rec.queued = bsearch(&dentry, state->queued, state->queued_len, sizeof(struct dir_entry *), cmp_ptr) != NULL;
+	rec.path_len = dentry->path_len;
+	rec.has_mdate = dentry->last_mdate != NULL;
+
+	if (!complete || state->max_depth < 0 || dentry->depth < state->max_depth)
+		rec.children_len = dentry->children_len;
+
+	// bsearch finds any of the chunks of the dentry, the first one is looked for from there
+	chunk = bsearch(&key_ptr, state->chunks, state->chunks_len, sizeof(struct dir_chunk *), cmp_chunk);
+
+	while (chunk && chunk > state->chunks && chunk[-1]->dentry == dentry)
+		chunk--;
+
+	while (chunk && chunk + rec.chunks_len < state->chunks + state->chunks_len && chunk[rec.chunks_len]->dentry == dentry)
+		rec.chunks_len++;
+
+	if (fwrite(&rec, sizeof(rec), 1, fp) != 1 || 
+			fwrite(dentry->path, 1, dentry->path_len, fp) != (size_t)dentry->path_len)
+		return -1;
+
+	for (int i=0;i<rec.chunks_len;i++) {
+		struct checkpoint_chunk crec = {.names_len = chunk[i]->names_len, .len = chunk[i]->len};
+
+		if (fwrite(&crec, sizeof(crec), 1, fp) != 1 || 
+				fwrite(chunk[i]->names, 1, crec.names_len, fp) != crec.names_len)
+			return -1;
+	}
+
+	for (int i=0;i<rec.children_len;i++) {
+		if (write_dentry(fp, dentry->children[i], state) != 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static struct dir_entry *read_dentry(FILE *fp, struct dir_entry *parent, struct checkpoint_state *state)
+{
+	struct checkpoint_record rec;
+	char path[PATH_MAX];
+	struct dir_entry *dentry;
+
+	if (fread(&rec, sizeof(rec), 1, fp) != 1 || rec.path_len <= 0 || rec.path_len >= PATH_MAX || 
+			rec.children_len < 0 || rec.chunks_len < 0)
+		return NULL;
+
+	if (fread(path, 1, rec.path_len, fp) != (size_t)rec.path_len)
+		return NULL;
+
+	path[rec.path_len] = '\0';
+
+	dentry = dir_create_dentry(path);
+
+	if (!dentry)
+		return NULL;
+
+	dentry->totals = rec.totals;
+	dentry->last_mtime = rec.last_mtime;
+	dentry->parent = parent;
+	dentry->depth = parent ? parent->depth + 1 : 0;
+	dentry->pending = rec.queued;
+
+	if (rec.has_mdate)
+		dentry->last_mdate = dir_get_dentry_mdate(rec.last_mtime);
+
+	if (rec.queued && append_ptr((void ***)&state->queued, &state->queued_len, dentry) != 0)
+		goto err;
+
+	for (int i=0;i<rec.chunks_len;i++) {
+		if (read_chunk(fp, dentry, state) != 0)
+			goto err;
+
+		dentry->pending++;
+	}
+
+	if (rec.children_len) {
+		dentry->children = calloc(rec.children_len, sizeof(struct dir_entry *));
+
+		if (!dentry->children)
+			goto err;
+
+		dentry->children_len = rec.children_len;
+	}
+
+	// a child that is not complete yet holds a reference of its parent
+	for (int i=0;i<rec.children_len;i++) {
+		dentry->children[i] = read_dentry(fp, dentry, state);
+
+		if (!dentry->children[i])
+			goto err;
+
+		if (dentry->children[i]->pending)
+			dentry->pending++;
+	}
+
+	return dentry;
+
+err:
+	// the arrays of the state still point to the freed dentries, checkpoint_read drops them
+	dir_free_entry(dentry);
+	return NULL;
+}
+
+static int read_chunk(FILE *fp, struct dir_entry *dentry, struct checkpoint_state *state)
+{
+	struct checkpoint_chunk crec;
+	struct dir_chunk *chunk;
+
+	if (fread(&crec, sizeof(crec), 1, fp) != 1 || crec.len <= 0)
+		return -1;
+
+	chunk = dir_new_chunk(dentry);
+
+	if (!chunk)
+		return -1;
+
+	chunk->names = malloc(crec.names_len);
+
+	if (!chunk->names || fread(chunk->names, 1, crec.names_len, fp) != crec.names_len || 
+			append_ptr((void ***)&state->chunks, &state->chunks_len, chunk) != 0) {
+		dir_free_chunk(chunk);
+		return -1;
+	}
+
+	chunk->names_len = crec.names_len;
+	chunk->names_size = crec.names_len;
+	chunk->len = crec.len;
+
+	return 0;
+}
+
+/**
+** the arrays grow to the next power of 2 when their length reaches one
+**/
+static int append_ptr(void ***array, int *len, void *ptr)
+{
+	if ((*len & (*len - 1)) == 0) {
+		void **grown = realloc(*array, (*len ? *len * 2 : 1) * sizeof(void *));
+
+		if (!grown) {
+			printf("Error allocating memory for checkpoint entries!\n");
+			return -1;
+		}
+
+		*array = grown;
+	}
+
+	(*array)[(*len)++] = ptr;
+
+	return 0;
+}
+
+static int cmp_ptr(const void *a, const void *b)
+{
+	const void *pa = *(const void **)a;
+	const void *pb = *(const void **)b;
+
+	return pa < pb ? -1 : pa > pb;
+}
+
+static int cmp_chunk(const void *a, const void *b)
+{
+	const struct dir_chunk *ca = *(const struct dir_chunk **)a;
+	const struct dir_chunk *cb = *(const struct dir_chunk **)b;
+
+	return ca->dentry < cb->dentry ? -1 : ca->dentry > cb->dentry;
+}
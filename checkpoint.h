@@ -0,0 +1,48 @@
+/* 
+ * Copyright (C) 2025 Zoltán Rácz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  
+ */
+
+#include <time.h>
+
+#include "dir.h"
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#define CHECKPOINT_MAGIC "BDUCKPT1"
+
+/**
+** the state of a paused scan: the tree built so far, the directories still 
+** in the queue and the chunks of large directories not lstat-ed yet. 
+** now and num_age_limits have to match when it is resumed, or the
+** age buckets of the two runs would be mixed up
+**/
+struct checkpoint_state {
+	struct dir_entry **roots;
+	int roots_len;
+	struct dir_entry **queued;
+	int queued_len;
+	struct dir_chunk **chunks;
+	int chunks_len;
+	int max_depth;
+	int num_age_limits;
+	time_t now;
+};
+
+int checkpoint_write(const char *path, struct checkpoint_state *state);
+int checkpoint_read(const char *path, struct checkpoint_state *state);
+void checkpoint_free_state(struct checkpoint_state *state);
+
+#endif //CHECKPOINT_H
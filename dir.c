@@ -14,8 +14,11 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.  
  */
 
+#define _GNU_SOURCE // qsort_r
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <time.h>
 #include <errno.h>
@@ -24,16 +27,65 @@
 #include <unistd.h>
 #include <sys/stat.h>
 
+#include "bdu.h"
 #include "dir.h"
-
-static unsigned int sort_flags;
-static ino_t *hardlinked_inodes;
-static int num_hardlinked_inodes = 0;
-
-static pthread_mutex_t inodes_check_mutex = PTHREAD_MUTEX_INITIALIZER;
-
-static int sort_entries_cb(const void* a, const void* b);
-static int isreg_hardlinked_ino(ino_t inode_num);
+#include "agg.h"
+#include "fs.h"
+#include "estimate.h"
+#include "inoset.h"
+#include "errlog.h"
+
+/**
+** what dir_scan and the kernels share while scanning one directory 
+** (or a chunk of it). The counters are collected here locally and added 
+** to the dentry (and its parents) only once, at the end of the scan, so 
+** the hot loop doesn`t touch any shared data
+**/
+struct scan_state {
+	struct dir_entry *dentry;
+	const struct dir_scan_options *opts;
+	struct thread_data *tdata;
+	const struct fs_backend *fs;
+	void (*dentry_scan_fn)(struct dir_entry*, struct thread_data*);
+	void *dir;
+	struct dir_totals totals;
+	struct dir_entry *anchor;
+	struct dir_entry *type_anchor;
+	int owner_kind;
+	int is_root; // the very root "/", its proc and run are not listed
+	int sample;
+	char **subdirs; // --estimate, the subdirectories the sample is picked from
+	int subdirs_len;
+	struct dir_chunk *chunk; // the files not handed off yet
+	long regular_files;
+	int prefix_len;
+	char full_path[PATH_MAX]; // the path of the directory, the names of the entries are copied after it
+};
+
+struct scan_kernel {
+	int (*entries)(struct scan_state *state);
+	void (*chunk)(struct scan_state *state, struct dir_chunk *chunk);
+};
+
+static const struct scan_kernel scan_kernels[DIR_KERNEL_COUNT];
+
+static int sort_entries_cb(const void* a, const void* b, void *arg);
+static void init_scan_state(struct scan_state *state, struct dir_entry *dentry, const struct dir_scan_options *opts, struct thread_data *tdata);
+static inline int set_full_path(struct scan_state *state, const char *name);
+static inline __attribute__((always_inline)) int scan_entries(struct scan_state *state, const int kernel);
+static inline __attribute__((always_inline)) void scan_file(struct scan_state *state, struct fs_dirent *entry, const char *full_path, const int kernel);
+static inline __attribute__((always_inline)) void stat_chunk_files(struct scan_state *state, struct dir_chunk *chunk, const int kernel);
+static const char *get_type_key(struct fs_dirent *entry);
+static int get_age_bucket(const struct dir_scan_options *opts, const struct stat *st);
+static struct dir_entry *add_subdir(struct dir_entry *dentry, char *path, struct dir_entry *prev, void (dentry_scan_fn)(struct dir_entry*, struct thread_data*), const struct dir_scan_options *opts, struct thread_data *tdata);
+static void get_anchors(struct dir_entry *dentry, const struct dir_scan_options *opts, struct dir_entry **anchor, struct dir_entry **type_anchor);
+static void add_totals_atomic(struct dir_totals *dst, const struct dir_totals *src);
+static void add_sampled_subdirs(struct dir_entry *dentry, char **paths, int paths_len, void (dentry_scan_fn)(struct dir_entry*, struct thread_data*), const struct dir_scan_options *opts, struct thread_data *tdata);
+static void resolve_symlink(struct fs_dirent *entry, const char *full_path, const struct fs_backend *fs);
+static void add_own_totals(struct dir_entry *dentry, const struct dir_totals *totals, const struct dir_scan_options *opts, struct thread_data *tdata);
+static void reuse_prev_dentry(struct dir_entry *dentry, void (dentry_scan_fn)(struct dir_entry*, struct thread_data*), const struct dir_scan_options *opts, struct thread_data *tdata);
+static struct dir_entry *find_prev_child(struct dir_entry *prev, const char *path);
+static int cmp_dentry_path(const void *a, const void *b);
 
 struct dir_entry *dir_create_dentry(char *path)
 {
@@ -61,48 +113,91 @@ struct dir_entry *dir_create_dentry(char *path)
 	snprintf(entry->path, entry->path_len+1, "%s", path);
 
 	entry->last_mdate = NULL;
-	entry->bytes = 0;
+	entry->last_mtime = 0;
+	memset(&entry->totals, 0, sizeof(struct dir_totals));
 	entry->children = NULL;
 	entry->parent = NULL;
 	entry->children_len = 0;
-	
-	pthread_mutex_init(&entry->lock, NULL);
+	entry->depth = 0;
+	entry->pending = 1;
+	entry->breakdown = NULL;
+	entry->spill_off = -1;
+	entry->prev = NULL;
+	memset(&entry->estimate, 0, sizeof(struct dir_estimate));
 
 	return entry;
 }
 
-struct dir_entry *dir_scan(struct dir_entry *dentry, void (dentry_scan_fn)(struct dir_entry*), int proc_mtime)
+struct dir_entry *dir_scan(struct dir_entry *dentry, void (dentry_scan_fn)(struct dir_entry*, struct thread_data*), const struct dir_scan_options *opts, struct thread_data *tdata)
 {
-	struct dir_entry *dchild;
-	char full_path[PATH_MAX];
+	struct scan_state state;
 	struct stat st;
+	struct dir_totals ftotals = {.inodes = 1};
+	const struct fs_backend *fs = opts->fs ? opts->fs : &fs_posix_backend;
+	int kernel = opts->kernel ? opts->kernel - 1 : dir_select_kernel(opts);
+	int ret;
 
 	// we don`t list contents of /proc and /run
 	if (strcmp(dentry->path, "/proc") == 0 || strcmp(dentry->path, "/run") == 0) 
 		return NULL;
 
-	/*
-	if (lstat(dentry->path, &st) == -1) {
-		printf("Error while lstat parent path %s (%s)\n", dentry->path, strerror(errno));
-		return NULL;
-	}
+	init_scan_state(&state, dentry, opts, tdata);
 
-	if (!S_ISDIR(st.st_mode)) // it might be a symlink or a regular file by mistake
-		return NULL;
-*/
+	state.dentry_scan_fn = dentry_scan_fn;
 
-	DIR *dir = opendir(dentry->path);
+	/**
+	** with --estimate the subdirectories below the displayed ones are 
+	** only collected here, and a sample of them is scanned after readdir
+	**/
+	state.sample = opts->sample_rate > 0 && (opts->max_depth < 0 || dentry->depth >= opts->max_depth);
+
+	// the directory itself
+	state.totals.inodes++;
+
+	if (opts->by_type)
+		agg_add(tdata->breakdown, state.type_anchor, AGG_KIND_TYPE, "(directory)", 0, &ftotals);
+
+	void *dir = fs->opendir(fs->data, dentry->path);
 
 	if (!dir) {
-		printf("Error opening path: %s (%s)\n", dentry->path, strerror(errno));
+		errlog_add(tdata->errors, ERRLOG_OPENDIR, errno, dentry->path);
+		add_own_totals(dentry, &state.totals, opts, tdata);
 		return NULL;
 	}
 
+	/**
+	** the modification time of the directory itself. fstat on the already 
+	** opened directory is cheaper than an lstat on the path
+	**/
+	int have_stat = fs->fstatdir(dir, &st) == 0;
+
+	if (!have_stat) {
+		errlog_add(tdata->errors, ERRLOG_STAT, errno, dentry->path);
+		st.st_mtime = 0;
+	}
+	else if (opts->visited && ino_set_insert(opts->visited, st.st_dev, st.st_ino) == 0) {
+		/**
+		** a symlink loop, a bind mount or a second path to a directory 
+		** scanned already. It is counted as an inode, but its contents 
+		** only once, where it was found first
+		**/
+		fs->closedir(dir);
+		add_own_totals(dentry, &state.totals, opts, tdata);
+		return dentry;
+	}
+
+	// the owner of the directory, once the visited check let it through
+	if (have_stat && opts->by_owner)
+		agg_add(tdata->breakdown, state.anchor, state.owner_kind, NULL, 
+			state.owner_kind == AGG_KIND_GID ? (long)st.st_gid : (long)st.st_uid, &ftotals);
+
+	state.totals.newest_mtime = st.st_mtime;
+
 	/**
 	** if proc_mtime = 1 we extract the date of the last modification to the entry, 
 	** and store it in dchild->last_mdate
 	**/
-	if (proc_mtime) 
+	if (opts->proc_mtime) 
 		dentry->last_mdate = dir_get_dentry_mdate(st.st_mtime);
 
 	/**
@@ -111,79 +206,452 @@ struct dir_entry *dir_scan(struct dir_entry *dentry, void (dentry_scan_fn)(struc
 	**/
 	dentry->last_mtime = st.st_mtime;
 
-	struct dirent *entry;
-	while ((entry = readdir(dir)) != NULL) {
-		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+	/**
+	** not modified since before the previous scan started: the same entries
+	** are in it, only their subdirectories have to be looked at again
+	**/
+	if (dentry->prev && st.st_mtime == dentry->prev->last_mtime && st.st_mtime < opts->reuse_before) {
+		fs->closedir(dir);
+		reuse_prev_dentry(dentry, dentry_scan_fn, opts, tdata);
+		return dentry;
+	}
+
+	// the subdirectories are looked up by path in the previous scan
+	if (dentry->prev && dentry->prev->children_len > 1)
+		qsort(dentry->prev->children, dentry->prev->children_len, sizeof(struct dir_entry *), cmp_dentry_path);
+
+	state.dir = dir;
+
+	ret = scan_kernels[kernel].entries(&state);
+
+	if (ret < 0)
+		errlog_add(tdata->errors, ERRLOG_READDIR, errno, dentry->path);
+
+	fs->closedir(dir);
+
+	// the last, partial chunk is not worth handing off
+	if (state.chunk) {
+		scan_kernels[kernel].chunk(&state, state.chunk);
+		dir_free_chunk(state.chunk);
+	}
+
+	if (state.subdirs)
+		add_sampled_subdirs(dentry, state.subdirs, state.subdirs_len, dentry_scan_fn, opts, tdata);
+
+	add_own_totals(dentry, &state.totals, opts, tdata);
+	return dentry;
+}
+
+/**
+** the kernel for the options, the DIR_KERNEL_* flags. Picked once per 
+** scan (kernel of the options), the flags of the options that are off
+** leave their branches out of the per entry loop
+**/
+int dir_select_kernel(const struct dir_scan_options *opts)
+{
+	int kernel = 0;
+
+	if (opts->by_type || opts->by_owner || opts->num_age_limits || opts->file_fn)
+		kernel |= DIR_KERNEL_DETAIL;
+	if (opts->dereference)
+		kernel |= DIR_KERNEL_DEREF;
+	if (opts->chunk_fn)
+		kernel |= DIR_KERNEL_CHUNKS;
+	if (opts->sample_rate > 0)
+		kernel |= DIR_KERNEL_SAMPLE;
+
+	return kernel;
+}
+
+/**
+** the state shared by dir_scan and the kernel. full_path starts with the 
+** path of the directory and a "/", the names are only copied after it
+**/
+static void init_scan_state(struct scan_state *state, struct dir_entry *dentry, const struct dir_scan_options *opts, struct thread_data *tdata)
+{
+	memset(state, 0, offsetof(struct scan_state, full_path));
+
+	state->dentry = dentry;
+	state->opts = opts;
+	state->tdata = tdata;
+	state->fs = opts->fs ? opts->fs : &fs_posix_backend;
+	state->owner_kind = opts->by_owner == BY_OWNER_GID ? AGG_KIND_GID : AGG_KIND_UID;
+
+	get_anchors(dentry, opts, &state->anchor, &state->type_anchor);
+
+	/**
+	** Having a trailing "/" at the end of the dentry->path (parent directory) 
+	** is only allowed if "/" is the only character the path contains, 
+	** aka the scanned directory is the very root. Otherwise the parent entry 
+	** path shouldn`t contain the "/" character. We make sure of this in the 
+	** dir_create_dentry function.
+	**/ 
+	if (dentry->path_len == 1 && dentry->path[0] == '/') {
+		state->full_path[0] = '/';
+		state->prefix_len = 1;
+		state->is_root = 1;
+	}
+	else 
+		state->prefix_len = snprintf(state->full_path, PATH_MAX, "%s/", dentry->path);
+}
+
+/**
+** appends the name to the directory path in full_path. 
+** Returns -1 if the path doesn`t fit
+**/
+static inline int set_full_path(struct scan_state *state, const char *name)
+{
+	size_t name_len = strlen(name);
+
+	if (state->prefix_len + name_len >= PATH_MAX) {
+		errlog_add(state->tdata->errors, ERRLOG_STAT, ENAMETOOLONG, state->dentry->path);
+		return -1;
+	}
+
+	memcpy(state->full_path + state->prefix_len, name, name_len + 1);
+
+	return 0;
+}
+
+/**
+** the readdir loop of dir_scan. kernel is a constant in every instance 
+** (see DIR_KERNEL), so the checks of the options compile away. Returns 
+** the last result of readdir, or 0 if it stopped because of an allocation error
+**/
+static inline __attribute__((always_inline)) int scan_entries(struct scan_state *state, const int kernel)
+{
+	struct dir_entry *dentry = state->dentry;
+	const struct dir_scan_options *opts = state->opts;
+	const struct fs_backend *fs = state->fs;
+	struct fs_dirent ent;
+	struct fs_dirent *entry = &ent;
+	int ret;
+
+	while ((ret = fs->readdir(state->dir, entry)) > 0) {
+		const char *name = entry->name;
+
+		if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
 			continue;
 
 		// we don`t list contents of /proc and /run
-		if (strcmp(entry->d_name, "proc") == 0 || strcmp(entry->d_name, "run") == 0) 
+		if (state->is_root && (strcmp(name, "proc") == 0 || strcmp(name, "run") == 0)) 
 			continue;
 
-		memset(full_path, 0, PATH_MAX-1);
+		if (set_full_path(state, name) != 0)
+			continue;
 
-		/**
-		** Having a trailing "/" at the end of the dentry->path (parent directory) 
-		** is only allowed if "/" is the only character the path contains, 
-		** aka the scanned directory is the very root. Otherwise the parent entry 
-		** path shouldn`t contain the "/" character. We make sure of this in the 
-		** dir_create_dentry function.
-		**/ 
-		if (dentry->path_len == 1 && dentry->path[0] == '/')
-			sprintf(full_path, "/%s", entry->d_name);
-		else 
-			sprintf(full_path, "%s/%s", dentry->path, entry->d_name);
+		if ((kernel & DIR_KERNEL_DEREF) && (entry->type == DT_LNK || entry->type == DT_UNKNOWN))
+			resolve_symlink(entry, state->full_path, fs);
 	
-		if (entry->d_type != DT_DIR) {
-			if (entry->d_type == DT_REG) {
-				
-				if (lstat(full_path, &st) == -1) {
-					printf("Error while lstat path %s (%s)\n", full_path, strerror(errno));
+		if (entry->type != DT_DIR) {
+			/**
+			** in large directories the regular files above chunk_size are 
+			** handed to the other workers to lstat, in chunks of chunk_size
+			**/
+			if ((kernel & DIR_KERNEL_CHUNKS) && entry->type == DT_REG && ++state->regular_files > opts->chunk_size) {
+				if (!state->chunk)
+					state->chunk = dir_new_chunk(dentry);
+
+				if (state->chunk && dir_chunk_add(state->chunk, name) == 0) {
+					if (state->chunk->len == opts->chunk_size) {
+						__atomic_add_fetch(&dentry->pending, 1, __ATOMIC_RELAXED);
+						opts->chunk_fn(state->chunk, state->tdata);
+						state->chunk = NULL;
+					}
+
 					continue;
 				}
-
-				dir_sum_dentry_bytes(dentry, st.st_blocks * 512);
 			}
 
+			scan_file(state, entry, state->full_path, kernel);
 			continue;
 		}
 
-		/*
-		if (!S_ISDIR(st.st_mode)) {
-			if (S_ISREG(st.st_mode)) { // we only count regular files
-				if (st.st_nlink > 0) { // if hardlink, we check if we already summed it
-					if (isreg_hardlinked_ino(st.st_ino)) 
-						continue;
-				}
-				dir_sum_dentry_bytes(dentry, st.st_blocks * 512);
+		if ((kernel & DIR_KERNEL_SAMPLE) && state->sample) {
+			char **paths = realloc(state->subdirs, (state->subdirs_len+1) * sizeof(char *));
+
+			if (!paths || !(paths[state->subdirs_len] = strdup(state->full_path))) {
+				printf("Error allocating memory for subdirectory list!\n");
+				state->subdirs = paths ? paths : state->subdirs;
+				return 0;
 			}
+
+			state->subdirs = paths;
+			state->subdirs_len++;
 			continue;
 		}
-		*/
 
-		dchild = dir_create_dentry(full_path);
+		if (!add_subdir(dentry, state->full_path, find_prev_child(dentry->prev, state->full_path), state->dentry_scan_fn, opts, state->tdata))
+			return 0;
+	}
+
+	return ret;
+}
+
+/**
+** with --by-type=tree and --by-owner the files are accounted to the deepest 
+** displayed directory above them, and summed up to the parents after the scan
+**/
+static void get_anchors(struct dir_entry *dentry, const struct dir_scan_options *opts, struct dir_entry **anchor, struct dir_entry **type_anchor)
+{
+	*anchor = NULL;
+	*type_anchor = NULL;
+
+	if (opts->by_type == BY_TYPE_TREE || opts->by_owner) {
+		*anchor = dentry;
+		while (opts->max_depth >= 0 && (*anchor)->depth > opts->max_depth)
+			*anchor = (*anchor)->parent;
+	}
+
+	if (opts->by_type == BY_TYPE_TREE)
+		*type_anchor = *anchor;
+}
 
-		if (!dchild) {
-			goto end;
+/**
+** counts a non directory entry of the dentry in totals. Only regular 
+** files are lstat-ed, symlinks, sockets etc. are only counted as inodes.
+** With -L the files are stat-ed, so symlinks resolved to regular files
+** are counted with the size of their targets
+**/
+static inline __attribute__((always_inline)) void scan_file(struct scan_state *state, struct fs_dirent *entry, const char *full_path, const int kernel)
+{
+	const struct dir_scan_options *opts = state->opts;
+	const struct fs_backend *fs = state->fs;
+	struct dir_totals *totals = &state->totals;
+	struct dir_totals ftotals = {.inodes = 1};
+	struct stat st;
+
+	totals->inodes++;
+
+	if (entry->type == DT_REG) {
+		
+		if (((kernel & DIR_KERNEL_DEREF) ? fs->stat : fs->lstat)(fs->data, full_path, &st) == -1) {
+			errlog_add(state->tdata->errors, ERRLOG_STAT, errno, full_path);
+			return;
 		}
 
-		dchild->parent = dentry;
+		totals->bytes += st.st_blocks * 512;
+		totals->apparent_bytes += st.st_size;
+
+		if (st.st_mtime > totals->newest_mtime)
+			totals->newest_mtime = st.st_mtime;
+
+		if (!(kernel & DIR_KERNEL_DETAIL))
+			return;
 
-		if (dentry->children_len == 0)
-			dentry->children = calloc(1, sizeof(struct dir_entry *));
-		else 
-			dentry->children = realloc(dentry->children, (dentry->children_len+1) * sizeof(struct dir_entry *));
+		if (opts->num_age_limits)
+			totals->age_bytes[get_age_bucket(opts, &st)] += st.st_blocks * 512;
 
-		dentry->children[dentry->children_len] = dchild;
-		dentry->children_len++;
+		ftotals.bytes = st.st_blocks * 512;
+		ftotals.apparent_bytes = st.st_size;
 
-		if (dentry_scan_fn)
-			dentry_scan_fn(dchild);
+		/**
+		** non regular files are not lstat-ed, so their owner is unknown.
+		** They are left out from the --by-owner totals
+		**/
+		if (opts->by_owner)
+			agg_add(state->tdata->breakdown, state->anchor, state->owner_kind, NULL, 
+				state->owner_kind == AGG_KIND_GID ? (long)st.st_gid : (long)st.st_uid, &ftotals);
 	}
 
-end:
-	closedir(dir);
-	return dentry;
+	if (!(kernel & DIR_KERNEL_DETAIL))
+		return;
+
+	if (opts->by_type)
+		agg_add(state->tdata->breakdown, state->type_anchor, AGG_KIND_TYPE, get_type_key(entry), 0, &ftotals);
+
+	if (opts->file_fn)
+		opts->file_fn(state->dentry, full_path, entry->type == DT_REG ? &st : NULL, opts->file_fn_data);
+}
+
+/**
+** lstat-s the files of a chunk, called by the worker that took it from
+** the queue. The partial totals are added to the directory like the ones 
+** of its own scan. The caller releases the dentry
+**/
+void dir_stat_chunk(struct dir_chunk *chunk, const struct dir_scan_options *opts, struct thread_data *tdata)
+{
+	struct scan_state state;
+	int kernel = opts->kernel ? opts->kernel - 1 : dir_select_kernel(opts);
+
+	init_scan_state(&state, chunk->dentry, opts, tdata);
+
+	scan_kernels[kernel].chunk(&state, chunk);
+	add_own_totals(chunk->dentry, &state.totals, opts, tdata);
+}
+
+static inline __attribute__((always_inline)) void stat_chunk_files(struct scan_state *state, struct dir_chunk *chunk, const int kernel)
+{
+	struct fs_dirent entry = {.type = DT_REG};
+	const char *name = chunk->names;
+
+	for (int i = 0; i < chunk->len; i++) {
+		entry.name = name;
+		name += strlen(name) + 1;
+
+		if (set_full_path(state, entry.name) == 0)
+			scan_file(state, &entry, state->full_path, kernel);
+	}
+}
+
+/**
+** one kernel for every combination of the DIR_KERNEL_* flags, 
+** all of them generated from scan_entries and stat_chunk_files
+**/
+#define DIR_KERNEL(flags) \
+	static int scan_entries_##flags(struct scan_state *state) { return scan_entries(state, flags); } \
+	static void stat_chunk_files_##flags(struct scan_state *state, struct dir_chunk *chunk) { stat_chunk_files(state, chunk, flags); }
+
+DIR_KERNEL(0) DIR_KERNEL(1) DIR_KERNEL(2) DIR_KERNEL(3) DIR_KERNEL(4) DIR_KERNEL(5) DIR_KERNEL(6) DIR_KERNEL(7)
+DIR_KERNEL(8) DIR_KERNEL(9) DIR_KERNEL(10) DIR_KERNEL(11) DIR_KERNEL(12) DIR_KERNEL(13) DIR_KERNEL(14) DIR_KERNEL(15)
+
+#define DIR_KERNEL_ENTRY(flags) {scan_entries_##flags, stat_chunk_files_##flags}
+
+static const struct scan_kernel scan_kernels[DIR_KERNEL_COUNT] = {
+	DIR_KERNEL_ENTRY(0), DIR_KERNEL_ENTRY(1), DIR_KERNEL_ENTRY(2), DIR_KERNEL_ENTRY(3),
+	DIR_KERNEL_ENTRY(4), DIR_KERNEL_ENTRY(5), DIR_KERNEL_ENTRY(6), DIR_KERNEL_ENTRY(7),
+	DIR_KERNEL_ENTRY(8), DIR_KERNEL_ENTRY(9), DIR_KERNEL_ENTRY(10), DIR_KERNEL_ENTRY(11),
+	DIR_KERNEL_ENTRY(12), DIR_KERNEL_ENTRY(13), DIR_KERNEL_ENTRY(14), DIR_KERNEL_ENTRY(15),
+};
+
+struct dir_chunk *dir_new_chunk(struct dir_entry *dentry)
+{
+	struct dir_chunk *chunk = (struct dir_chunk *)calloc(1, sizeof(struct dir_chunk));
+
+	if (!chunk) {
+		printf("Error allocating memory for chunk!\n");
+		return NULL;
+	}
+
+	chunk->dentry = dentry;
+
+	return chunk;
+}
+
+/**
+** the names are stored one after the other, NULL terminated, in one buffer
+**/
+int dir_chunk_add(struct dir_chunk *chunk, const char *name)
+{
+	size_t name_len = strlen(name) + 1;
+
+	if (chunk->names_len + name_len > chunk->names_size) {
+		size_t size = chunk->names_size ? chunk->names_size * 2 : 4096;
+		char *names;
+
+		while (size < chunk->names_len + name_len)
+			size *= 2;
+
+		names = realloc(chunk->names, size);
+
+		if (!names) {
+			printf("Error allocating memory for chunk!\n");
+			return -1;
+		}
+
+		chunk->names = names;
+		chunk->names_size = size;
+	}
+
+	memcpy(chunk->names + chunk->names_len, name, name_len);
+	chunk->names_len += name_len;
+	chunk->len++;
+
+	return 0;
+}
+
+void dir_free_chunk(struct dir_chunk *chunk)
+{
+	if (!chunk)
+		return;
+
+	free(chunk->names);
+	free(chunk);
+}
+
+static struct dir_entry *add_subdir(struct dir_entry *dentry, char *path, struct dir_entry *prev, void (dentry_scan_fn)(struct dir_entry*, struct thread_data*), const struct dir_scan_options *opts, struct thread_data *tdata)
+{
+	struct dir_entry *dchild = dir_create_dentry(path);
+
+	if (!dchild)
+		return NULL;
+
+	dchild->parent = dentry;
+	dchild->depth = dentry->depth + 1;
+	dchild->prev = prev;
+
+	// released by the worker when the child`s own scan is done
+	__atomic_add_fetch(&dentry->pending, 1, __ATOMIC_RELAXED);
+
+	if (dentry->children_len == 0)
+		dentry->children = calloc(1, sizeof(struct dir_entry *));
+	else 
+		dentry->children = realloc(dentry->children, (dentry->children_len+1) * sizeof(struct dir_entry *));
+
+	dentry->children[dentry->children_len] = dchild;
+	dentry->children_len++;
+
+	if (opts->mem_used)
+		__atomic_add_fetch(opts->mem_used, dir_get_dentry_mem_size(dchild), __ATOMIC_RELAXED);
+
+	if (dentry_scan_fn)
+		dentry_scan_fn(dchild, tdata);
+
+	return dchild;
+}
+
+/**
+** --estimate: queues a random sample of the collected subdirectories, the
+** totals of the rest are extrapolated by estimate_complete_dentry
+**/
+static void add_sampled_subdirs(struct dir_entry *dentry, char **paths, int paths_len, void (dentry_scan_fn)(struct dir_entry*, struct thread_data*), const struct dir_scan_options *opts, struct thread_data *tdata)
+{
+	int sample_len = estimate_get_sample_size(opts->sample_rate, paths_len);
+
+	dentry->estimate.subdirs = paths_len;
+
+	estimate_pick_sample(paths, paths_len, sample_len, dentry->path, opts->seed);
+
+	for (int i = 0; i < sample_len; i++) {
+		if (!add_subdir(dentry, paths[i], NULL, dentry_scan_fn, opts, tdata))
+			break;
+	}
+
+	for (int i = 0; i < paths_len; i++)
+		free(paths[i]);
+
+	free(paths);
+}
+
+/**
+** adds the entries found directly in the dentry. Normally they are summed up 
+** to all the parents right away. With --estimate the parents are computed 
+** from the sampled children only when they complete (estimate_complete_dentry)
+**/
+void dir_add_scanned_totals(struct dir_entry *dentry, const struct dir_totals *totals, const struct dir_scan_options *opts)
+{
+	// chunks of large directories may add to the same dentry at once
+	if (opts->sample_rate > 0)
+		add_totals_atomic(&dentry->totals, totals);
+	else 
+		dir_sum_dentry_totals(dentry, totals);
+}
+
+/**
+** drops one reference of the dentry - either the one of its own scan, or the 
+** one of a subdirectory. When the last one is gone the dentry and everything 
+** below it has been scanned, so complete_fn is called and the parent is released too
+**/
+void dir_release_dentry(struct dir_entry *dentry, void (complete_fn)(struct dir_entry*, void*), void *data)
+{
+	while (dentry && __atomic_sub_fetch(&dentry->pending, 1, __ATOMIC_ACQ_REL) == 0) {
+		struct dir_entry *parent = dentry->parent;
+
+		if (complete_fn)
+			complete_fn(dentry, data);
+
+		dentry = parent;
+	}
 }
 
 void dir_sort_entries(struct dir_entry **entries, int entries_len, int max_depth, int depth, int flags)
@@ -191,9 +659,7 @@ void dir_sort_entries(struct dir_entry **entries, int entries_len, int max_depth
 	if (!entries || !entries_len)
 		return;
 
-	sort_flags = flags;
-
-	qsort(entries, entries_len, sizeof(struct dir_entry *), sort_entries_cb);
+	qsort_r(entries, entries_len, sizeof(struct dir_entry *), sort_entries_cb, &flags);
 
 	/**
 	** we only sort the displayed children.
@@ -210,16 +676,25 @@ void dir_sort_entries(struct dir_entry **entries, int entries_len, int max_depth
 	}
 }
 
-static int sort_entries_cb(const void* a, const void* b) 
+static int sort_entries_cb(const void* a, const void* b, void *arg) 
 {
+	int sort_flags = *(int *)arg;
 	int ret = 0;
 	struct dir_entry *dentry_a = *(struct dir_entry **)a;
 	struct dir_entry *dentry_b = *(struct dir_entry **)b;
 
 	if (sort_flags & SORT_BY_SIZE) 
-		ret = dentry_a->bytes < dentry_b->bytes 
+		ret = dentry_a->totals.bytes < dentry_b->totals.bytes 
+				? -1 
+				: (dentry_a->totals.bytes == dentry_b->totals.bytes ? 0 : 1);
+	else if (sort_flags & SORT_BY_APPARENT) 
+		ret = dentry_a->totals.apparent_bytes < dentry_b->totals.apparent_bytes 
 				? -1 
-				: (dentry_a->bytes == dentry_b->bytes ? 0 : 1);
+				: (dentry_a->totals.apparent_bytes == dentry_b->totals.apparent_bytes ? 0 : 1);
+	else if (sort_flags & SORT_BY_INODES) 
+		ret = dentry_a->totals.inodes < dentry_b->totals.inodes 
+				? -1 
+				: (dentry_a->totals.inodes == dentry_b->totals.inodes ? 0 : 1);
 	else if (sort_flags & SORT_BY_NAME) 
 		ret = strcasecmp(dentry_a->path, dentry_b->path);
 	else if (sort_flags & SORT_BY_DATE) 
@@ -227,18 +702,139 @@ static int sort_entries_cb(const void* a, const void* b)
 				? -1 
 				: (dentry_a->last_mtime == dentry_b->last_mtime ? 0 : 1);
 
+	/**
+	** entries with the same size (or date) are ordered by path, so the 
+	** output doesn`t depend on the order the workers finished in
+	**/
+	if (ret == 0)
+		ret = strcmp(dentry_a->path, dentry_b->path);
+
 	return (sort_flags & SORT_ASC) ? ret : -ret;
 }
 
 
-void dir_sum_dentry_bytes(struct dir_entry *dentry, long int bytes)
+/**
+** adds the totals of a scanned directory to the dentry and all of its parents.
+** Called once per directory, using atomic adds instead of locks, 
+** since many workers finish subdirectories of the same parents at once
+**/
+void dir_sum_dentry_totals(struct dir_entry *dentry, const struct dir_totals *totals)
+{
+	while (dentry) {
+		add_totals_atomic(&dentry->totals, totals);
+		dentry = dentry->parent;
+	}
+}
+
+static void add_totals_atomic(struct dir_totals *dst, const struct dir_totals *src)
 {
-	pthread_mutex_lock(&dentry->lock);
-	dentry->bytes += bytes;
-	pthread_mutex_unlock(&dentry->lock);
+	__atomic_fetch_add(&dst->bytes, src->bytes, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&dst->apparent_bytes, src->apparent_bytes, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&dst->inodes, src->inodes, __ATOMIC_RELAXED);
+
+	for (int i=0;i<DIR_AGE_BUCKETS_MAX;i++) {
+		if (src->age_bytes[i])
+			__atomic_fetch_add(&dst->age_bytes[i], src->age_bytes[i], __ATOMIC_RELAXED);
+	}
 
-	if (dentry->parent)
-		dir_sum_dentry_bytes(dentry->parent, bytes);
+	if (src->unscanned_dirs)
+		__atomic_fetch_add(&dst->unscanned_dirs, src->unscanned_dirs, __ATOMIC_RELAXED);
+
+	time_t newest = __atomic_load_n(&dst->newest_mtime, __ATOMIC_RELAXED);
+	while (src->newest_mtime > newest) {
+		if (__atomic_compare_exchange_n(&dst->newest_mtime, &newest, src->newest_mtime, 
+				0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			break;
+	}
+}
+
+/**
+** non atomic version of the above, for counters owned by a single thread
+**/
+void dir_totals_add(struct dir_totals *dst, const struct dir_totals *src)
+{
+	dst->bytes += src->bytes;
+	dst->apparent_bytes += src->apparent_bytes;
+	dst->inodes += src->inodes;
+
+	for (int i=0;i<DIR_AGE_BUCKETS_MAX;i++)
+		dst->age_bytes[i] += src->age_bytes[i];
+
+	dst->unscanned_dirs += src->unscanned_dirs;
+
+	if (src->newest_mtime > dst->newest_mtime)
+		dst->newest_mtime = src->newest_mtime;
+}
+
+/**
+** --threshold and --min-inodes: the children of a completed dentry below 
+** the limits are summed up into one "(other)" child and freed, together 
+** with everything below them. Returns the memory released
+**/
+size_t dir_fold_children(struct dir_entry *dentry, size_t min_size, int apparent, size_t min_inodes)
+{
+	struct dir_entry *other = NULL;
+	char path[PATH_MAX];
+	size_t freed = 0;
+	int has_mdate = 0;
+	int kept = 0;
+
+	for (int i=0;i<dentry->children_len;i++) {
+		struct dir_entry *child = dentry->children[i];
+		size_t size = apparent ? child->totals.apparent_bytes : child->totals.bytes;
+
+		if ((!min_size || size >= min_size) && (!min_inodes || child->totals.inodes >= min_inodes)) {
+			dentry->children[kept++] = child;
+			continue;
+		}
+
+		if (!other) {
+			if (dentry->path_len == 1 && dentry->path[0] == '/')
+				snprintf(path, PATH_MAX, "/%s", DIR_OTHER_NAME);
+			else 
+				snprintf(path, PATH_MAX, "%s/%s", dentry->path, DIR_OTHER_NAME);
+
+			other = dir_create_dentry(path);
+
+			// the child is kept as it is, nothing is lost
+			if (!other) {
+				dentry->children[kept++] = child;
+				continue;
+			}
+
+			other->parent = dentry;
+			other->depth = dentry->depth + 1;
+			other->pending = 0;
+		}
+
+		dir_totals_add(&other->totals, &child->totals);
+
+		for (int j=0;j<3;j++)
+			other->estimate.var[j] += child->estimate.var[j];
+
+		if (child->last_mtime > other->last_mtime)
+			other->last_mtime = child->last_mtime;
+
+		has_mdate |= child->last_mdate != NULL;
+
+		freed += dir_get_dentry_mem_size(child) + dir_get_children_mem_size(child);
+		dir_free_entry(child);
+	}
+
+	if (!other)
+		return freed;
+
+	if (has_mdate)
+		other->last_mdate = dir_get_dentry_mdate(other->last_mtime);
+
+	dentry->children[kept++] = other;
+	dentry->children_len = kept;
+
+	// the path of "(other)" may be longer than the ones of the folded children
+	if (freed > dir_get_dentry_mem_size(other))
+		return freed - dir_get_dentry_mem_size(other);
+
+	return 0;
 }
 
 char *dir_get_dentry_mdate(time_t mtime) 
@@ -256,6 +852,31 @@ char *dir_get_dentry_mdate(time_t mtime)
 	return date_str;
 }
 
+/**
+** approximate memory used by a dentry: the struct, its path and 
+** its slot in the children array of the parent
+**/
+size_t dir_get_dentry_mem_size(struct dir_entry *dentry)
+{
+	return sizeof(struct dir_entry) + dentry->path_len + 1 + sizeof(struct dir_entry *);
+}
+
+// memory used by the children of the dentry still in memory, recursively
+size_t dir_get_children_mem_size(struct dir_entry *dentry)
+{
+	size_t size = 0;
+
+	if (!dentry->children)
+		return 0;
+
+	for (int i=0;i<dentry->children_len;i++) {
+		size += dir_get_dentry_mem_size(dentry->children[i]);
+		size += dir_get_children_mem_size(dentry->children[i]);
+	}
+
+	return size;
+}
+
 int dir_free_entries(struct dir_entry **entries, int entries_len)
 {
 	if (!entries || entries_len <= 0) 
@@ -280,54 +901,164 @@ int dir_free_entry(struct dir_entry *head)
 
 	free(head->path);
 
+	if (head->breakdown)
+		agg_free_table(head->breakdown);
+
 	if (head->last_mdate) {
 		free(head->last_mdate);
 	}
 
-	pthread_mutex_destroy(&head->lock);
-
 	free(head);
 
 	return 0;
 }
 
-int dir_cleanup()
+/**
+** the key a non-directory entry is accounted under with --by-type: the 
+** extension for regular files, the file type for everything else
+**/
+static const char *get_type_key(struct fs_dirent *entry)
 {
-	if (hardlinked_inodes) {
-		free(hardlinked_inodes);
-		hardlinked_inodes = NULL;
+	const char *ext;
+
+	switch (entry->type) {
+		case DT_REG:
+			ext = strrchr(entry->name, '.');
+
+			// no extension, or dotfiles like .bashrc
+			if (!ext || ext == entry->name || ext[1] == '\0')
+				return "(none)";
+
+			return ext;
+		case DT_LNK:
+			return "(symlink)";
+		case DT_FIFO:
+			return "(fifo)";
+		case DT_SOCK:
+			return "(socket)";
+		case DT_CHR:
+			return "(char device)";
+		case DT_BLK:
+			return "(block device)";
+		default:
+			return "(unknown)";
 	}
-	
-	pthread_mutex_destroy(&inodes_check_mutex);
+}
 
-	return 0;
+/**
+** index of the --age-buckets bucket the file falls in. Files older than 
+** the last limit go to the last bucket
+**/
+static int get_age_bucket(const struct dir_scan_options *opts, const struct stat *st)
+{
+	time_t age = opts->now - (opts->age_by_atime ? st->st_atime : st->st_mtime);
+	int i;
+
+	for (i=0;i<opts->num_age_limits;i++) {
+		if (age < opts->age_limits[i])
+			break;
+	}
+
+	return i;
 }
 
-static int isreg_hardlinked_ino(ino_t inode_num)
+/**
+** -L: replaces the type of a symlink (or of an entry the filesystem
+** doesn`t report the type of) with the type of its target, so symlinked
+** directories are scanned and symlinked files counted as regular ones. 
+** Dangling symlinks stay symlinks
+**/
+static void resolve_symlink(struct fs_dirent *entry, const char *full_path, const struct fs_backend *fs)
 {
-	int found = 0;
+	struct stat st;
 
-	pthread_mutex_lock(&inodes_check_mutex);
+	if (fs->stat(fs->data, full_path, &st) == -1)
+		return;
 
-	if (num_hardlinked_inodes > 0) {
-		for (int i=0;i<num_hardlinked_inodes;i++) {
-			if (hardlinked_inodes[i] == inode_num) {
-				found = 1;
-				goto end;
-			}
-		}
+	if (S_ISDIR(st.st_mode))
+		entry->type = DT_DIR;
+	else if (S_ISREG(st.st_mode))
+		entry->type = DT_REG;
+	else if (entry->type == DT_UNKNOWN)
+		entry->type = IFTODT(st.st_mode);
+}
+
+/**
+** adds the totals of a directory scan or a chunk, and counts the entries 
+** for the worker (the throughput --threads=auto and --stats are based on)
+**/
+static void add_own_totals(struct dir_entry *dentry, const struct dir_totals *totals, const struct dir_scan_options *opts, struct thread_data *tdata)
+{
+	dir_add_scanned_totals(dentry, totals, opts);
+	__atomic_add_fetch(&tdata->entries, totals->inodes, __ATOMIC_RELAXED);
+}
+
+/**
+** --serve-metrics: the files of an unchanged directory are counted with 
+** their totals in the previous scan (its totals without the ones of the 
+** subdirectories), and the subdirectories are queued as they were. Files 
+** changed in place don`t touch the directory, they are only seen by the 
+** next full scan. The newest mtime below it is not kept separately, if it 
+** came from a subdirectory, the own one falls back to the directory`s mtime
+**/
+static void reuse_prev_dentry(struct dir_entry *dentry, void (dentry_scan_fn)(struct dir_entry*, struct thread_data*), const struct dir_scan_options *opts, struct thread_data *tdata)
+{
+	struct dir_entry *prev = dentry->prev;
+	struct dir_totals totals = prev->totals;
+	time_t newest_child = 0;
+
+	for (int i=0;i<prev->children_len;i++) {
+		const struct dir_totals *child = &prev->children[i]->totals;
+
+		totals.bytes -= child->bytes;
+		totals.apparent_bytes -= child->apparent_bytes;
+		totals.inodes -= child->inodes;
+		totals.unscanned_dirs -= child->unscanned_dirs;
+
+		for (int j=0;j<DIR_AGE_BUCKETS_MAX;j++)
+			totals.age_bytes[j] -= child->age_bytes[j];
+
+		if (child->newest_mtime > newest_child)
+			newest_child = child->newest_mtime;
 	}
 
-	if (num_hardlinked_inodes == 0)
-		hardlinked_inodes = calloc(1, sizeof(ino_t));
-	else 
-		hardlinked_inodes = realloc(hardlinked_inodes, (num_hardlinked_inodes+1)*sizeof(ino_t));
+	if (totals.newest_mtime <= newest_child)
+		totals.newest_mtime = dentry->last_mtime;
+
+	for (int i=0;i<prev->children_len;i++) {
+		if (!add_subdir(dentry, prev->children[i]->path, prev->children[i], dentry_scan_fn, opts, tdata))
+			break;
+	}
 
-	hardlinked_inodes[num_hardlinked_inodes] = inode_num;
-	num_hardlinked_inodes++;
+	dir_add_scanned_totals(dentry, &totals, opts);
 
-end:
-	pthread_mutex_unlock(&inodes_check_mutex);
-	return found;
+	// only the directory itself was looked at
+	__atomic_add_fetch(&tdata->entries, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&tdata->reused, 1, __ATOMIC_RELAXED);
 }
 
+/**
+** the subdirectory of prev with the path, its children are sorted 
+** by path in dir_scan. NULL if it is new (or there is no prev)
+**/
+static struct dir_entry *find_prev_child(struct dir_entry *prev, const char *path)
+{
+	struct dir_entry key = {.path = (char *)path};
+	struct dir_entry *key_ptr = &key;
+	struct dir_entry **found;
+
+	if (!prev || !prev->children_len)
+		return NULL;
+
+	found = bsearch(&key_ptr, prev->children, prev->children_len, sizeof(struct dir_entry *), cmp_dentry_path);
+
+	return found ? *found : NULL;
+}
+
+static int cmp_dentry_path(const void *a, const void *b)
+{
+	const struct dir_entry *da = *(const struct dir_entry **)a;
+	const struct dir_entry *db = *(const struct dir_entry **)b;
+
+	return strcmp(da->path, db->path);
+}
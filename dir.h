@@ -15,6 +15,8 @@
  */
 
 #include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
 
 #ifndef DIR_H
 #define DIR_H
@@ -26,30 +28,139 @@
 #define SORT_BY_SIZE 0x0004
 #define SORT_BY_NAME 0x0008
 #define SORT_BY_DATE 0x0010
-#define SORT_BY_FULL_MASK (SORT_BY_SIZE | SORT_BY_NAME | SORT_BY_DATE)
+#define SORT_BY_INODES 0x0020
+#define SORT_BY_APPARENT 0x0040
+#define SORT_BY_FULL_MASK (SORT_BY_SIZE | SORT_BY_NAME | SORT_BY_DATE | SORT_BY_INODES | SORT_BY_APPARENT)
+
+// --threshold and --min-inodes, the child the small subdirectories are folded into
+#define DIR_OTHER_NAME "(other)"
+
+// --age-buckets accepts at most DIR_AGE_BUCKETS_MAX-1 limits
+#define DIR_AGE_BUCKETS_MAX 8
+
+/**
+** counters collected for a directory, including everything below it.
+** All of them are filled from the same lstat call in dir_scan
+**/
+struct dir_totals {
+	size_t bytes; // disk usage (st_blocks * 512)
+	size_t apparent_bytes; // st_size
+	size_t inodes; // files, directories, symlinks etc.
+	size_t age_bytes[DIR_AGE_BUCKETS_MAX]; // disk usage by file age (--age-buckets)
+	time_t newest_mtime;
+	size_t unscanned_dirs; // directories left in the queue when --deadline ran out
+};
+
+/**
+** --estimate: the number of subdirectories found, including the ones not 
+** sampled, and the variance of the estimated bytes, apparent bytes and inodes
+**/
+struct dir_estimate {
+	int subdirs;
+	double var[3];
+};
+
+struct thread_data;
+struct agg_table;
+struct dir_entry;
+struct fs_backend;
+struct ino_set;
+
+/**
+** regular files of a large directory, lstat-ed by a different worker 
+** than the one reading the directory
+**/
+struct dir_chunk {
+	struct dir_entry *dentry;
+	char *names; // NULL terminated names, one after the other
+	size_t names_len;
+	size_t names_size;
+	int len;
+};
+
+// --by-type modes
+#define BY_TYPE_NONE 0
+#define BY_TYPE_TOTAL 1 // one table for the whole scan
+#define BY_TYPE_TREE 2 // a table for each displayed directory too
+
+// --by-owner modes
+#define BY_OWNER_NONE 0
+#define BY_OWNER_UID 1
+#define BY_OWNER_GID 2
+
+/**
+** the specialized versions of the per entry loop of dir_scan, one for every
+** combination of these flags (see dir_select_kernel)
+**/
+#define DIR_KERNEL_DETAIL 0x01 // --by-type, --by-owner, --age-buckets or a file callback
+#define DIR_KERNEL_DEREF 0x02 // -L
+#define DIR_KERNEL_CHUNKS 0x04 // --large-dir splitting
+#define DIR_KERNEL_SAMPLE 0x08 // --estimate
+#define DIR_KERNEL_COUNT 16
+
+/**
+** options shared by all the workers calling dir_scan
+**/
+struct dir_scan_options {
+	int proc_mtime;
+	int by_type;
+	int by_owner;
+	int max_depth;
+	int num_age_limits; // --age-buckets, 0 if not set
+	time_t age_limits[DIR_AGE_BUCKETS_MAX-1]; // in seconds, ascending
+	int age_by_atime;
+	time_t now; // ages are relative to the start of the scan
+	void (*file_fn)(struct dir_entry *parent, const char *path, const struct stat *st, void *data);
+	void *file_fn_data;
+	const struct fs_backend *fs; // the real filesystem if NULL
+	size_t *mem_used; // if not NULL, the memory used by new dentries is added to it
+	double sample_rate; // --estimate, the fraction of subdirectories scanned below the displayed ones. 0 = all
+	unsigned long seed; // --seed of the --estimate sampling
+	int chunk_size; // --large-dir, files lstat-ed by the reader of a directory before the rest is split into chunks
+	void (*chunk_fn)(struct dir_chunk *chunk, struct thread_data *tdata); // queues a chunk, NULL = no splitting
+	int dereference; // -L, symlinks are followed and counted as their targets
+	struct ino_set *visited; // directories already scanned, NULL if every directory is scanned
+	int kernel; // dir_select_kernel() + 1, set once before the scan. 0 = picked in every dir_scan call
+	time_t reuse_before; // directories with a prev, not modified since it and before this time reuse its totals. 0 = never
+};
 
 struct dir_entry {
 	char *path;
 	int path_len;
-	size_t bytes;
+	int depth;
+	int pending; // own scan + subdirectories not completed yet, see dir_release_dentry
+	struct dir_totals totals;
 	time_t last_mtime;
 	char *last_mdate;
 	struct dir_entry *parent;
 	struct dir_entry **children;
 	int children_len;
-	pthread_mutex_t lock;
+	struct agg_table *breakdown; // per type and per owner totals, filled after the scan
+	long spill_off; // offset of the children in the spill file, -1 if they are in memory
+	struct dir_estimate estimate;
+	struct dir_entry *prev; // the same directory in the previous scan (--serve-metrics), NULL if there is none
 };
 
 struct dir_entry *dir_create_dentry(char *path);
-struct dir_entry *dir_scan(struct dir_entry *dentry, void (dentry_scan_fn)(struct dir_entry*), int proc_mtime);
+struct dir_entry *dir_scan(struct dir_entry *dentry, void (dentry_scan_fn)(struct dir_entry*, struct thread_data*), const struct dir_scan_options *opts, struct thread_data *tdata);
+void dir_release_dentry(struct dir_entry *dentry, void (complete_fn)(struct dir_entry*, void*), void *data);
+void dir_stat_chunk(struct dir_chunk *chunk, const struct dir_scan_options *opts, struct thread_data *tdata);
+int dir_select_kernel(const struct dir_scan_options *opts);
+struct dir_chunk *dir_new_chunk(struct dir_entry *dentry);
+int dir_chunk_add(struct dir_chunk *chunk, const char *name);
+void dir_free_chunk(struct dir_chunk *chunk);
 void dir_sort_entries(struct dir_entry **entries, int entries_len, int max_depth, int depth, int flags);
 
+size_t dir_get_dentry_mem_size(struct dir_entry *dentry);
+size_t dir_get_children_mem_size(struct dir_entry *dentry);
+
 int dir_free_entry(struct dir_entry *head);
 int dir_free_entries(struct dir_entry **entries, int entries_len);
 
-void dir_sum_dentry_bytes(struct dir_entry *dentry, long int bytes);
+void dir_sum_dentry_totals(struct dir_entry *dentry, const struct dir_totals *totals);
+void dir_add_scanned_totals(struct dir_entry *dentry, const struct dir_totals *totals, const struct dir_scan_options *opts);
+void dir_totals_add(struct dir_totals *dst, const struct dir_totals *src);
+size_t dir_fold_children(struct dir_entry *dentry, size_t min_size, int apparent, size_t min_inodes);
 char *dir_get_dentry_mdate(time_t mtime);
 
-int dir_cleanup();
-
 #endif //DIR_H
\ No newline at end of file
@@ -0,0 +1,216 @@
+/* 
+ * Copyright (C) 2025 Zoltán Rácz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "errlog.h"
+
+static int sort_records_cb(const void *a, const void *b);
+static int sort_groups_cb(const void *a, const void *b);
+static size_t get_dir_len(const char *path);
+
+struct err_ring *errlog_new_ring()
+{
+	struct err_ring *ring = (struct err_ring *)calloc(1, sizeof(struct err_ring));
+
+	if (!ring)
+		printf("Error allocating memory for error log!\n");
+
+	return ring;
+}
+
+/**
+** records the error in the next slot, overwriting the oldest one when 
+** the ring is full. If the path can`t be copied, the error is still counted
+**/
+void errlog_add(struct err_ring *ring, int op, int err, const char *path)
+{
+	struct err_record *rec = &ring->records[ring->total % ERRLOG_RING_SIZE];
+
+	free(rec->path);
+
+	rec->op = op;
+	rec->err = err;
+	rec->path = strdup(path);
+
+	ring->total++;
+}
+
+void errlog_free_ring(struct err_ring *ring)
+{
+	if (!ring)
+		return;
+
+	for (int i = 0; i < ERRLOG_RING_SIZE; i++)
+		free(ring->records[i].path);
+
+	free(ring);
+}
+
+/**
+** groups the recorded errors of all the rings by operation, errno and 
+** directory, the largest groups first. Returns NULL if there are none
+**/
+struct err_group *errlog_get_groups(struct err_ring **rings, int rings_len, int *groups_len)
+{
+	struct err_record **records = NULL;
+	struct err_group *groups = NULL;
+	int records_len = 0;
+
+	*groups_len = 0;
+
+	for (int i = 0; i < rings_len; i++) {
+		if (rings[i])
+			records_len += rings[i]->total < ERRLOG_RING_SIZE ? (int)rings[i]->total : ERRLOG_RING_SIZE;
+	}
+
+	if (records_len == 0)
+		return NULL;
+
+	records = malloc(records_len * sizeof(struct err_record *));
+	groups = calloc(records_len, sizeof(struct err_group));
+
+	if (!records || !groups) {
+		printf("Error allocating memory for error groups!\n");
+		free(records);
+		free(groups);
+		return NULL;
+	}
+
+	records_len = 0;
+
+	for (int i = 0; i < rings_len; i++) {
+		for (int j = 0; rings[i] && j < ERRLOG_RING_SIZE && (size_t)j < rings[i]->total; j++) {
+			if (rings[i]->records[j].path)
+				records[records_len++] = &rings[i]->records[j];
+		}
+	}
+
+	qsort(records, records_len, sizeof(struct err_record *), sort_records_cb);
+
+	for (int i = 0; i < records_len; i++) {
+		struct err_record *rec = records[i];
+		struct err_group *group = *groups_len ? &groups[*groups_len-1] : NULL;
+		size_t dir_len = get_dir_len(rec->path);
+
+		if (group && group->op == rec->op && group->err == rec->err && 
+				strlen(group->dir) == dir_len && strncmp(group->dir, rec->path, dir_len) == 0) {
+			group->count++;
+			continue;
+		}
+
+		group = &groups[(*groups_len)++];
+		group->op = rec->op;
+		group->err = rec->err;
+		group->dir = strndup(rec->path, dir_len);
+		group->path = strdup(rec->path);
+		group->count = 1;
+
+		if (!group->dir || !group->path) {
+			printf("Error allocating memory for error groups!\n");
+			free(group->dir);
+			free(group->path);
+			(*groups_len)--;
+			break;
+		}
+	}
+
+	free(records);
+
+	qsort(groups, *groups_len, sizeof(struct err_group), sort_groups_cb);
+
+	return groups;
+}
+
+void errlog_free_groups(struct err_group *groups, int groups_len)
+{
+	for (int i = 0; i < groups_len; i++) {
+		free(groups[i].dir);
+		free(groups[i].path);
+	}
+
+	free(groups);
+}
+
+const char *errlog_get_op_name(int op)
+{
+	switch (op) {
+		case ERRLOG_OPENDIR:
+			return "opendir";
+		case ERRLOG_READDIR:
+			return "readdir";
+		default:
+			return "stat";
+	}
+}
+
+/**
+** by operation, errno, directory and path. The directories are compared 
+** on their own, so the entries of a directory stay together even if a 
+** subdirectory name sorts between them
+**/
+static int sort_records_cb(const void *a, const void *b)
+{
+	const struct err_record *ra = *(const struct err_record **)a;
+	const struct err_record *rb = *(const struct err_record **)b;
+	size_t la = get_dir_len(ra->path);
+	size_t lb = get_dir_len(rb->path);
+	int cmp;
+
+	if (ra->op != rb->op)
+		return ra->op - rb->op;
+
+	if (ra->err != rb->err)
+		return ra->err - rb->err;
+
+	cmp = strncmp(ra->path, rb->path, la < lb ? la : lb);
+
+	if (cmp != 0)
+		return cmp;
+
+	if (la != lb)
+		return la < lb ? -1 : 1;
+
+	return strcmp(ra->path, rb->path);
+}
+
+// the largest groups first, then by directory
+static int sort_groups_cb(const void *a, const void *b)
+{
+	const struct err_group *ga = (const struct err_group *)a;
+	const struct err_group *gb = (const struct err_group *)b;
+
+	if (ga->count != gb->count)
+		return ga->count < gb->count ? 1 : -1;
+
+	return strcmp(ga->dir, gb->dir);
+}
+
+/**
+** the length of the directory part of the path, the root 
+** directory is kept as "/"
+**/
+static size_t get_dir_len(const char *path)
+{
+	const char *slash = strrchr(path, '/');
+
+	if (!slash)
+		return 0;
+
+	return slash == path ? 1 : (size_t)(slash - path);
+}
@@ -0,0 +1,66 @@
+/* 
+ * Copyright (C) 2025 Zoltán Rácz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  
+ */
+
+#include <stddef.h>
+
+#ifndef ERRLOG_H
+#define ERRLOG_H
+
+// the operation that failed
+#define ERRLOG_OPENDIR 1
+#define ERRLOG_READDIR 2
+#define ERRLOG_STAT 3 // lstat, stat or fstat
+
+// errors kept per thread, the older ones are only counted
+#define ERRLOG_RING_SIZE 256
+
+struct err_record {
+	int op;
+	int err; // errno
+	char *path;
+};
+
+/**
+** the errors of one worker. Only the owner thread adds to it, so it 
+** needs no locking, and the workers don`t serialize on stdio while 
+** scanning. Read after the scan with errlog_get_groups
+**/
+struct err_ring {
+	struct err_record records[ERRLOG_RING_SIZE];
+	size_t total; // errors added, the last ERRLOG_RING_SIZE are in records
+};
+
+/**
+** the recorded errors with the same operation and errno 
+** in the same directory, reported together
+**/
+struct err_group {
+	int op;
+	int err;
+	char *dir;
+	char *path; // the first of them
+	size_t count;
+};
+
+struct err_ring *errlog_new_ring();
+void errlog_add(struct err_ring *ring, int op, int err, const char *path);
+void errlog_free_ring(struct err_ring *ring);
+
+struct err_group *errlog_get_groups(struct err_ring **rings, int rings_len, int *groups_len);
+void errlog_free_groups(struct err_group *groups, int groups_len);
+const char *errlog_get_op_name(int op);
+
+#endif //ERRLOG_H
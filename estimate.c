@@ -0,0 +1,202 @@
+/* 
+ * Copyright (C) 2025 Zoltán Rácz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "dir.h"
+#include "estimate.h"
+
+// the counters error bounds are kept for, in the order of var[] in struct dir_estimate
+#define ESTIMATE_METRICS 3
+
+static double get_counter(const struct dir_totals *totals, int metric);
+static void scale_totals(struct dir_totals *totals, double factor);
+static unsigned long long next_random(unsigned long long *state);
+static int sort_paths_cb(const void *a, const void *b);
+
+/**
+** at least 2 subdirectories are sampled (if there are that many), 
+** the variance can`t be estimated from a single one
+**/
+int estimate_get_sample_size(double sample_rate, int subdirs_len)
+{
+	int sample_len = (int)ceil(sample_rate * subdirs_len);
+
+	if (sample_len < 2)
+		sample_len = 2;
+
+	return sample_len < subdirs_len ? sample_len : subdirs_len;
+}
+
+/**
+** moves a random sample of sample_len paths to the front of the array.
+** The random state depends only on the seed and the parent path, so the 
+** same tree gives the same sample regardless of the order the workers run in
+**/
+void estimate_pick_sample(char **paths, int paths_len, int sample_len, const char *parent_path, unsigned long seed)
+{
+	unsigned long long state = 1469598103934665603ULL ^ seed;
+
+	for (const char *p = parent_path; *p; p++)
+		state = (state ^ (unsigned char)*p) * 1099511628211ULL;
+
+	// readdir order is not stable between filesystems
+	qsort(paths, paths_len, sizeof(char *), sort_paths_cb);
+
+	// partial Fisher-Yates shuffle
+	for (int i = 0; i < sample_len; i++) {
+		int j = i + next_random(&state) % (paths_len - i);
+		char *tmp = paths[i];
+
+		paths[i] = paths[j];
+		paths[j] = tmp;
+	}
+}
+
+/**
+** called when the dentry and everything below it has been scanned. Until then
+** dentry->totals holds only the entries found directly in the directory, the 
+** (already final) totals of the children are added here, scaled up by 
+** subdirs / sampled subdirs
+**/
+void estimate_complete_dentry(struct dir_entry *dentry)
+{
+	struct dir_totals sum;
+	double mean[ESTIMATE_METRICS] = {0};
+	double sq_dev[ESTIMATE_METRICS] = {0};
+	double child_var[ESTIMATE_METRICS] = {0};
+	int k = dentry->children_len;
+	int n = dentry->estimate.subdirs > k ? dentry->estimate.subdirs : k;
+
+	if (k == 0)
+		return;
+
+	memset(&sum, 0, sizeof(struct dir_totals));
+
+	for (int i = 0; i < k; i++) {
+		struct dir_entry *child = dentry->children[i];
+
+		dir_totals_add(&sum, &child->totals);
+
+		for (int m = 0; m < ESTIMATE_METRICS; m++) {
+			mean[m] += get_counter(&child->totals, m) / k;
+			child_var[m] += child->estimate.var[m];
+		}
+	}
+
+	for (int i = 0; i < k && k < n; i++) {
+		for (int m = 0; m < ESTIMATE_METRICS; m++) {
+			double dev = get_counter(&dentry->children[i]->totals, m) - mean[m];
+			sq_dev[m] += dev * dev;
+		}
+	}
+
+	/**
+	** variance of the total: the sampling error of this level, plus the 
+	** errors of the sampled children, scaled up the same way as their totals
+	**/
+	for (int m = 0; m < ESTIMATE_METRICS; m++) {
+		double var = (double)n / k * child_var[m];
+
+		if (k < n)
+			var += (double)n * n * (1.0 - (double)k / n) * (sq_dev[m] / (k - 1)) / k;
+
+		dentry->estimate.var[m] = var;
+	}
+
+	if (k < n)
+		scale_totals(&sum, (double)n / k);
+
+	dir_totals_add(&dentry->totals, &sum);
+}
+
+/**
+** half width of the confidence interval of the displayed counter
+**/
+double estimate_get_error(const struct dir_entry *dentry, unsigned int metric, double z)
+{
+	if (metric >= ESTIMATE_METRICS)
+		return 0;
+
+	return z * sqrt(dentry->estimate.var[metric]);
+}
+
+/**
+** the z score of a two sided confidence level (ex. 0.95 -> 1.96), 
+** by bisection on the normal CDF
+**/
+double estimate_get_z(double confidence)
+{
+	double lo = 0, hi = 10;
+
+	if (confidence <= 0 || confidence >= 1)
+		return -1;
+
+	for (int i = 0; i < 60; i++) {
+		double mid = (lo + hi) / 2;
+
+		if (erf(mid / M_SQRT2) < confidence)
+			lo = mid;
+		else 
+			hi = mid;
+	}
+
+	return (lo + hi) / 2;
+}
+
+/**
+** metric numbers follow OUTPUT_METRIC_BYTES, _APPARENT and _INODES
+**/
+static double get_counter(const struct dir_totals *totals, int metric)
+{
+	switch (metric) {
+		case 1:
+			return totals->apparent_bytes;
+		case 2:
+			return totals->inodes;
+		default:
+			return totals->bytes;
+	}
+}
+
+static void scale_totals(struct dir_totals *totals, double factor)
+{
+	totals->bytes = llround(totals->bytes * factor);
+	totals->apparent_bytes = llround(totals->apparent_bytes * factor);
+	totals->inodes = llround(totals->inodes * factor);
+
+	for (int i = 0; i < DIR_AGE_BUCKETS_MAX; i++)
+		totals->age_bytes[i] = llround(totals->age_bytes[i] * factor);
+}
+
+// splitmix64
+static unsigned long long next_random(unsigned long long *state)
+{
+	unsigned long long z = (*state += 0x9E3779B97F4A7C15ULL);
+
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+
+	return z ^ (z >> 31);
+}
+
+static int sort_paths_cb(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
@@ -0,0 +1,37 @@
+/* 
+ * Copyright (C) 2025 Zoltán Rácz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  
+ */
+
+#include "dir.h"
+
+#ifndef ESTIMATE_H
+#define ESTIMATE_H
+
+#define ESTIMATE_SAMPLE_RATE_DEFAULT 0.1
+
+/**
+** --estimate: below the displayed directories only a random sample of the 
+** subdirectories is scanned. When a directory completes, its totals are 
+** extrapolated from the sampled children (two stage sampling, Horvitz-Thompson
+** estimator), and the variance of the estimate is stored next to them
+**/
+
+int estimate_get_sample_size(double sample_rate, int subdirs_len);
+void estimate_pick_sample(char **paths, int paths_len, int sample_len, const char *parent_path, unsigned long seed);
+void estimate_complete_dentry(struct dir_entry *dentry);
+double estimate_get_error(const struct dir_entry *dentry, unsigned int metric, double z);
+double estimate_get_z(double confidence);
+
+#endif //ESTIMATE_H
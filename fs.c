@@ -0,0 +1,83 @@
+/* 
+ * Copyright (C) 2025 Zoltán Rácz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "fs.h"
+
+static void *posix_opendir(void *data, const char *path);
+static int posix_readdir(void *dir, struct fs_dirent *entry);
+static int posix_fstatdir(void *dir, struct stat *st);
+static int posix_closedir(void *dir);
+static int posix_lstat(void *data, const char *path, struct stat *st);
+static int posix_stat(void *data, const char *path, struct stat *st);
+
+const struct fs_backend fs_posix_backend = {
+	.opendir = posix_opendir,
+	.readdir = posix_readdir,
+	.fstatdir = posix_fstatdir,
+	.closedir = posix_closedir,
+	.lstat = posix_lstat,
+	.stat = posix_stat,
+	.data = NULL
+};
+
+static void *posix_opendir(void *data, const char *path)
+{
+	(void)data;
+	return opendir(path);
+}
+
+static int posix_readdir(void *dir, struct fs_dirent *entry)
+{
+	struct dirent *d;
+
+	errno = 0;
+	d = readdir((DIR *)dir);
+
+	if (!d)
+		return errno ? -1 : 0;
+
+	entry->name = d->d_name;
+	entry->type = d->d_type;
+
+	return 1;
+}
+
+static int posix_fstatdir(void *dir, struct stat *st)
+{
+	return fstat(dirfd((DIR *)dir), st);
+}
+
+static int posix_closedir(void *dir)
+{
+	return closedir((DIR *)dir);
+}
+
+static int posix_lstat(void *data, const char *path, struct stat *st)
+{
+	(void)data;
+	return lstat(path, st);
+}
+
+static int posix_stat(void *data, const char *path, struct stat *st)
+{
+	(void)data;
+	return stat(path, st);
+}
@@ -0,0 +1,71 @@
+/* 
+ * Copyright (C) 2025 Zoltán Rácz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  
+ */
+
+#include <stddef.h>
+#include <sys/stat.h>
+
+#ifndef FS_H
+#define FS_H
+
+struct fs_dirent {
+	const char *name;
+	unsigned char type; // DT_DIR, DT_REG etc., like dirent.d_type
+};
+
+/**
+** the filesystem operations dir_scan needs. On errors the functions set errno
+** like their POSIX counterparts. data is passed back to opendir, lstat and 
+** stat, the rest get the handle returned by opendir
+**/
+struct fs_backend {
+	void *(*opendir)(void *data, const char *path);
+	int (*readdir)(void *dir, struct fs_dirent *entry); // 1 if an entry was read, 0 at the end, -1 on error
+	int (*fstatdir)(void *dir, struct stat *st);
+	int (*closedir)(void *dir);
+	int (*lstat)(void *data, const char *path, struct stat *st);
+	int (*stat)(void *data, const char *path, struct stat *st); // follows symlinks, for -L
+	void *data;
+};
+
+// the real filesystem
+extern const struct fs_backend fs_posix_backend;
+
+/**
+** generated trees for benchmarking the scheduler, aggregation and output 
+** without disk and kernel noise. The spec is a comma separated list of
+** key=value pairs, see fs_synth.c
+**/
+struct fs_backend *fs_synth_new(const char *spec);
+void fs_synth_free(struct fs_backend *fs);
+
+/**
+** limits the metadata operations (opendir, lstat, stat) of another backend 
+** to ops_per_sec, without locks (see ratelimit.h)
+**/
+struct fs_backend *fs_throttle_new(const struct fs_backend *inner, long ops_per_sec);
+void fs_throttle_free(struct fs_backend *fs);
+
+/**
+** opens directories ahead of the scan on helper threads (--prefetch). 
+** fs_prefetch_hint names a directory the scan will get to soon, at most
+** capacity of them are waiting at a time
+**/
+struct fs_backend *fs_prefetch_new(const struct fs_backend *inner, int threads, int capacity);
+int fs_prefetch_hint(struct fs_backend *fs, const char *path);
+size_t fs_prefetch_get_hits(struct fs_backend *fs);
+void fs_prefetch_free(struct fs_backend *fs);
+
+#endif //FS_H
@@ -0,0 +1,478 @@
+/* 
+ * Copyright (C) 2025 Zoltán Rácz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "fs.h"
+
+/**
+** --prefetch: wraps another backend, and opens the directories the scan 
+** will get to soon on a few helper threads, together with their first 
+** readdir. On network filesystems those are the slow calls of a directory,
+** this way they overlap with the lstat calls of the workers. 
+**
+** The scan names the upcoming directories with fs_prefetch_hint. opendir 
+** returns a directory opened ahead, waits for it if a helper is on it 
+** already, or opens it itself if no helper got to it yet (or it was never 
+** hinted). At most capacity directories are hinted and not opened by the 
+** scan at a time, the hints over that are dropped
+**/
+
+#define PREFETCH_PENDING 0 // waiting for a helper
+#define PREFETCH_OPENING 1
+#define PREFETCH_READY 2
+
+/**
+** the handle returned by opendir. The first entry was read by the helper,
+** readdir returns it before reading on
+**/
+struct prefetch_dir {
+	const struct fs_backend *inner;
+	void *dir;
+	int first_ret;
+	int first_errno;
+	int replay;
+	struct fs_dirent first;
+};
+
+struct prefetch_entry {
+	char *path;
+	unsigned int hash;
+	int state;
+	int taken; // opened by the scan while pending, the helper only frees it
+	struct prefetch_dir *dir; // NULL if opendir failed, with open_errno
+	int open_errno;
+	struct prefetch_entry *next; // in the bucket
+	struct prefetch_entry *next_pending;
+};
+
+struct prefetch_data {
+	struct fs_backend fs;
+	const struct fs_backend *inner;
+
+	// lock protects everything below, except threads
+	pthread_mutex_t lock;
+	pthread_cond_t work_cond; // wakes the helpers up
+	pthread_cond_t ready_cond; // wakes the workers waiting for a directory
+	struct prefetch_entry **buckets;
+	unsigned int buckets_mask;
+	int len;
+	int capacity;
+	struct prefetch_entry *pending_head;
+	struct prefetch_entry *pending_tail;
+	int stop;
+	size_t hits;
+
+	pthread_t *threads;
+	int threads_len;
+};
+
+static void *prefetch_thread_fn(void *arg);
+static void *prefetch_opendir(void *data, const char *path);
+static int prefetch_readdir(void *dir, struct fs_dirent *entry);
+static int prefetch_fstatdir(void *dir, struct stat *st);
+static int prefetch_closedir(void *dir);
+static int prefetch_lstat(void *data, const char *path, struct stat *st);
+static int prefetch_stat(void *data, const char *path, struct stat *st);
+static struct prefetch_dir *open_dir(const struct fs_backend *inner, const char *path, int *open_errno);
+static struct prefetch_entry **find_entry(struct prefetch_data *prefetch, const char *path, unsigned int hash);
+static void free_entry(struct prefetch_entry *entry);
+static unsigned int prefetch_hash(const char *path);
+
+struct fs_backend *fs_prefetch_new(const struct fs_backend *inner, int threads, int capacity)
+{
+	struct prefetch_data *prefetch = (struct prefetch_data *)calloc(1, sizeof(struct prefetch_data));
+	unsigned int buckets = 16;
+
+	if (!prefetch) {
+		printf("Error allocating memory for the prefetcher!\n");
+		return NULL;
+	}
+
+	// at most half full
+	while (buckets < (unsigned int)capacity * 2)
+		buckets *= 2;
+
+	prefetch->inner = inner;
+	prefetch->capacity = capacity;
+	prefetch->buckets_mask = buckets - 1;
+	prefetch->buckets = calloc(buckets, sizeof(struct prefetch_entry *));
+	prefetch->threads = calloc(threads, sizeof(pthread_t));
+
+	if (!prefetch->buckets || !prefetch->threads) {
+		printf("Error allocating memory for the prefetcher!\n");
+		free(prefetch->buckets);
+		free(prefetch->threads);
+		free(prefetch);
+		return NULL;
+	}
+
+	pthread_mutex_init(&prefetch->lock, NULL);
+	pthread_cond_init(&prefetch->work_cond, NULL);
+	pthread_cond_init(&prefetch->ready_cond, NULL);
+
+	prefetch->fs.opendir = prefetch_opendir;
+	prefetch->fs.readdir = prefetch_readdir;
+	prefetch->fs.fstatdir = prefetch_fstatdir;
+	prefetch->fs.closedir = prefetch_closedir;
+	prefetch->fs.lstat = prefetch_lstat;
+	prefetch->fs.stat = prefetch_stat;
+	prefetch->fs.data = prefetch;
+
+	for (int i = 0; i < threads; i++) {
+		if (pthread_create(&prefetch->threads[i], NULL, prefetch_thread_fn, prefetch) != 0) {
+			printf("Error starting prefetch thread!\n");
+			break;
+		}
+
+		prefetch->threads_len++;
+	}
+
+	if (prefetch->threads_len == 0) {
+		fs_prefetch_free(&prefetch->fs);
+		return NULL;
+	}
+
+	return &prefetch->fs;
+}
+
+/**
+** stops the helpers, and closes the directories opened ahead that the 
+** scan never got to (ex. after --deadline)
+**/
+void fs_prefetch_free(struct fs_backend *fs)
+{
+	struct prefetch_data *prefetch;
+
+	if (!fs)
+		return;
+
+	prefetch = (struct prefetch_data *)fs->data;
+
+	pthread_mutex_lock(&prefetch->lock);
+	prefetch->stop = 1;
+	pthread_cond_broadcast(&prefetch->work_cond);
+	pthread_mutex_unlock(&prefetch->lock);
+
+	for (int i = 0; i < prefetch->threads_len; i++)
+		pthread_join(prefetch->threads[i], NULL);
+
+	// the pending ones are in the buckets too, unless they were taken
+	for (struct prefetch_entry *entry = prefetch->pending_head, *next; entry; entry = next) {
+		next = entry->next_pending;
+
+		if (entry->taken)
+			free_entry(entry);
+	}
+
+	for (unsigned int i = 0; i <= prefetch->buckets_mask; i++) {
+		for (struct prefetch_entry *entry = prefetch->buckets[i], *next; entry; entry = next) {
+			next = entry->next;
+			free_entry(entry);
+		}
+	}
+
+	pthread_cond_destroy(&prefetch->work_cond);
+	pthread_cond_destroy(&prefetch->ready_cond);
+	pthread_mutex_destroy(&prefetch->lock);
+
+	free(prefetch->buckets);
+	free(prefetch->threads);
+	free(prefetch);
+}
+
+/**
+** queues path to be opened ahead. Returns 0 if it was queued or it is 
+** queued already, -1 if there are capacity directories not taken yet
+**/
+int fs_prefetch_hint(struct fs_backend *fs, const char *path)
+{
+	struct prefetch_data *prefetch = (struct prefetch_data *)fs->data;
+	unsigned int hash = prefetch_hash(path);
+	struct prefetch_entry *entry;
+	int ret = 0;
+
+	pthread_mutex_lock(&prefetch->lock);
+
+	if (*find_entry(prefetch, path, hash))
+		goto out;
+
+	if (prefetch->len >= prefetch->capacity) {
+		ret = -1;
+		goto out;
+	}
+
+	entry = (struct prefetch_entry *)calloc(1, sizeof(struct prefetch_entry));
+
+	if (!entry || !(entry->path = strdup(path))) {
+		free(entry);
+		ret = -1;
+		goto out;
+	}
+
+	entry->hash = hash;
+	entry->state = PREFETCH_PENDING;
+	entry->next = prefetch->buckets[hash & prefetch->buckets_mask];
+	prefetch->buckets[hash & prefetch->buckets_mask] = entry;
+	prefetch->len++;
+
+	if (prefetch->pending_tail)
+		prefetch->pending_tail->next_pending = entry;
+	else 
+		prefetch->pending_head = entry;
+
+	prefetch->pending_tail = entry;
+
+	pthread_cond_signal(&prefetch->work_cond);
+
+out:
+	pthread_mutex_unlock(&prefetch->lock);
+
+	return ret;
+}
+
+// the directories the scan got already opened, for --stats
+size_t fs_prefetch_get_hits(struct fs_backend *fs)
+{
+	struct prefetch_data *prefetch = (struct prefetch_data *)fs->data;
+	size_t hits;
+
+	pthread_mutex_lock(&prefetch->lock);
+	hits = prefetch->hits;
+	pthread_mutex_unlock(&prefetch->lock);
+
+	return hits;
+}
+
+static void *prefetch_thread_fn(void *arg)
+{
+	struct prefetch_data *prefetch = (struct prefetch_data *)arg;
+
+	pthread_mutex_lock(&prefetch->lock);
+
+	while (1) {
+		struct prefetch_entry *entry;
+
+		while (!prefetch->stop && !prefetch->pending_head)
+			pthread_cond_wait(&prefetch->work_cond, &prefetch->lock);
+
+		if (prefetch->stop)
+			break;
+
+		entry = prefetch->pending_head;
+		prefetch->pending_head = entry->next_pending;
+
+		if (!prefetch->pending_head)
+			prefetch->pending_tail = NULL;
+
+		// the scan didn`t wait for it, and it is not in the buckets any more
+		if (entry->taken) {
+			free_entry(entry);
+			continue;
+		}
+
+		entry->state = PREFETCH_OPENING;
+		pthread_mutex_unlock(&prefetch->lock);
+
+		struct prefetch_dir *dir = open_dir(prefetch->inner, entry->path, &entry->open_errno);
+
+		pthread_mutex_lock(&prefetch->lock);
+
+		entry->dir = dir;
+		entry->state = PREFETCH_READY;
+		pthread_cond_broadcast(&prefetch->ready_cond);
+	}
+
+	pthread_mutex_unlock(&prefetch->lock);
+
+	return NULL;
+}
+
+static void *prefetch_opendir(void *data, const char *path)
+{
+	struct prefetch_data *prefetch = (struct prefetch_data *)data;
+	unsigned int hash = prefetch_hash(path);
+	struct prefetch_entry **link;
+	struct prefetch_entry *entry;
+	struct prefetch_dir *dir;
+	int open_errno = 0;
+
+	pthread_mutex_lock(&prefetch->lock);
+
+	/**
+	** looked up again after every wait: the same path could be scanned 
+	** twice (ex. the same root given twice), and the other one can take it
+	**/
+	while (1) {
+		link = find_entry(prefetch, path, hash);
+		entry = *link;
+
+		if (!entry || entry->state == PREFETCH_READY)
+			break;
+
+		// no helper got to it yet, opening it here is faster than waiting for one
+		if (entry->state == PREFETCH_PENDING) {
+			*link = entry->next;
+			prefetch->len--;
+			entry->taken = 1;
+			entry = NULL;
+			break;
+		}
+
+		pthread_cond_wait(&prefetch->ready_cond, &prefetch->lock);
+	}
+
+	if (entry) {
+		*link = entry->next;
+		prefetch->len--;
+		prefetch->hits++;
+	}
+
+	pthread_mutex_unlock(&prefetch->lock);
+
+	if (!entry) {
+		dir = open_dir(prefetch->inner, path, &open_errno);
+	}
+	else {
+		dir = entry->dir;
+		open_errno = entry->open_errno;
+		entry->dir = NULL;
+		free_entry(entry);
+	}
+
+	if (!dir)
+		errno = open_errno;
+
+	return dir;
+}
+
+static int prefetch_readdir(void *handle, struct fs_dirent *entry)
+{
+	struct prefetch_dir *dir = (struct prefetch_dir *)handle;
+
+	if (dir->replay) {
+		dir->replay = 0;
+
+		if (dir->first_ret > 0)
+			*entry = dir->first;
+		else 
+			errno = dir->first_errno;
+
+		return dir->first_ret;
+	}
+
+	// readdir is not called again after the end or an error
+	if (dir->first_ret <= 0) 
+		return dir->first_ret;
+
+	return dir->inner->readdir(dir->dir, entry);
+}
+
+static int prefetch_fstatdir(void *handle, struct stat *st)
+{
+	struct prefetch_dir *dir = (struct prefetch_dir *)handle;
+
+	return dir->inner->fstatdir(dir->dir, st);
+}
+
+static int prefetch_closedir(void *handle)
+{
+	struct prefetch_dir *dir = (struct prefetch_dir *)handle;
+	int ret = dir->inner->closedir(dir->dir);
+
+	free(dir);
+
+	return ret;
+}
+
+static int prefetch_lstat(void *data, const char *path, struct stat *st)
+{
+	struct prefetch_data *prefetch = (struct prefetch_data *)data;
+
+	return prefetch->inner->lstat(prefetch->inner->data, path, st);
+}
+
+static int prefetch_stat(void *data, const char *path, struct stat *st)
+{
+	struct prefetch_data *prefetch = (struct prefetch_data *)data;
+
+	return prefetch->inner->stat(prefetch->inner->data, path, st);
+}
+
+/**
+** opens the directory and reads its first entry. Returns NULL 
+** with the errno of opendir in open_errno if it can`t be opened
+**/
+static struct prefetch_dir *open_dir(const struct fs_backend *inner, const char *path, int *open_errno)
+{
+	struct prefetch_dir *dir = (struct prefetch_dir *)malloc(sizeof(struct prefetch_dir));
+
+	if (!dir) {
+		*open_errno = ENOMEM;
+		return NULL;
+	}
+
+	dir->inner = inner;
+	dir->dir = inner->opendir(inner->data, path);
+
+	if (!dir->dir) {
+		*open_errno = errno;
+		free(dir);
+		return NULL;
+	}
+
+	dir->first_ret = inner->readdir(dir->dir, &dir->first);
+	dir->first_errno = errno;
+	dir->replay = 1;
+
+	return dir;
+}
+
+static struct prefetch_entry **find_entry(struct prefetch_data *prefetch, const char *path, unsigned int hash)
+{
+	struct prefetch_entry **link = &prefetch->buckets[hash & prefetch->buckets_mask];
+
+	while (*link && ((*link)->hash != hash || strcmp((*link)->path, path) != 0))
+		link = &(*link)->next;
+
+	return link;
+}
+
+static void free_entry(struct prefetch_entry *entry)
+{
+	if (entry->dir)
+		prefetch_closedir(entry->dir);
+
+	free(entry->path);
+	free(entry);
+}
+
+// FNV-1a
+static unsigned int prefetch_hash(const char *path)
+{
+	unsigned int hash = 2166136261u;
+
+	for (const unsigned char *p = (const unsigned char *)path; *p; p++) {
+		hash ^= *p;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
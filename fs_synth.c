@@ -0,0 +1,319 @@
+/* 
+ * Copyright (C) 2025 Zoltán Rácz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  
+ */
+
+/**
+** Synthetic (generated) filesystem backend.
+**
+** Any path passed to it is the root of a generated tree. Every directory 
+** has "fanout" subdirectories (d0, d1 ...) down to "depth" levels, and "files"
+** regular files (f0.log, f1.dat ...). Sizes, times and owners are derived 
+** from a hash of the path and the seed, so runs are repeatable. Spec keys:
+**
+**	depth=N       levels of subdirectories below the root (default 3)
+**	fanout=N      subdirectories per directory (default 4)
+**	files=N       files per directory (default 16)
+**	rootfiles=N   files in the root directory, for huge single directories (default: files)
+**	size=SIZE     average file size, ex. 64K (default 16K)
+**	latency=N     microseconds slept in every lstat (default 0)
+**	dirlatency=N  microseconds slept in every opendir (default 0)
+**	seed=N        changes the generated sizes, times and owners (default 0)
+**
+** ex: --synthetic=depth=5,fanout=8,files=100,latency=50
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "fs.h"
+#include "utils.h"
+
+struct synth_fs {
+	int depth;
+	int fanout;
+	int files;
+	int root_files;
+	long int size;
+	long int latency_us;
+	long int dir_latency_us;
+	unsigned int seed;
+	time_t now;
+};
+
+struct synth_dir {
+	struct synth_fs *fs;
+	int depth;
+	int num_dirs;
+	int num_files;
+	int pos;
+	unsigned int hash;
+	ino_t ino; // 64 bits, so --dedupe-dirs doesn`t see collisions as hard links
+	char name[32];
+};
+
+static const char *synth_exts[] = { ".log", ".dat", ".txt", ".parquet", ".tmp", ".gz" };
+
+static void *synth_opendir(void *data, const char *path);
+static int synth_readdir(void *dir, struct fs_dirent *entry);
+static int synth_fstatdir(void *dir, struct stat *st);
+static int synth_closedir(void *dir);
+static int synth_lstat(void *data, const char *path, struct stat *st);
+static int synth_stat(void *data, const char *path, struct stat *st);
+static int synth_get_depth(const char *path);
+static unsigned int synth_hash(const char *str, unsigned int seed);
+
+struct fs_backend *fs_synth_new(const char *spec)
+{
+	struct fs_backend *backend = (struct fs_backend *)calloc(1, sizeof(struct fs_backend));
+	struct synth_fs *fs = (struct synth_fs *)calloc(1, sizeof(struct synth_fs));
+	char *spec_copy = strdup(spec ? spec : "");
+	char *saveptr = NULL;
+
+	if (!backend || !fs || !spec_copy) {
+		printf("Error allocating memory for synthetic filesystem!\n");
+		goto err;
+	}
+
+	fs->depth = 3;
+	fs->fanout = 4;
+	fs->files = 16;
+	fs->root_files = -1;
+	fs->size = 16 * 1024;
+	fs->now = time(NULL);
+
+	for (char *token = strtok_r(spec_copy, ",", &saveptr); token; token = strtok_r(NULL, ",", &saveptr)) {
+		char *value = strchr(token, '=');
+
+		if (!value) {
+			printf("Invalid synthetic filesystem option \"%s\"! Should be key=value.\n", token);
+			goto err;
+		}
+
+		*value++ = '\0';
+
+		if (strcmp(token, "depth") == 0)
+			fs->depth = atoi(value);
+		else if (strcmp(token, "fanout") == 0)
+			fs->fanout = atoi(value);
+		else if (strcmp(token, "files") == 0)
+			fs->files = atoi(value);
+		else if (strcmp(token, "rootfiles") == 0)
+			fs->root_files = atoi(value);
+		else if (strcmp(token, "size") == 0)
+			fs->size = human_size_to_bytes(value);
+		else if (strcmp(token, "latency") == 0)
+			fs->latency_us = atol(value);
+		else if (strcmp(token, "dirlatency") == 0)
+			fs->dir_latency_us = atol(value);
+		else if (strcmp(token, "seed") == 0)
+			fs->seed = (unsigned int)strtoul(value, NULL, 10);
+		else {
+			printf("Unknown synthetic filesystem option \"%s\"!\n", token);
+			goto err;
+		}
+	}
+
+	if (fs->root_files < 0)
+		fs->root_files = fs->files;
+
+	free(spec_copy);
+
+	backend->opendir = synth_opendir;
+	backend->readdir = synth_readdir;
+	backend->fstatdir = synth_fstatdir;
+	backend->closedir = synth_closedir;
+	backend->lstat = synth_lstat;
+	backend->stat = synth_stat;
+	backend->data = fs;
+
+	return backend;
+
+err:
+	free(spec_copy);
+	free(fs);
+	free(backend);
+	return NULL;
+}
+
+void fs_synth_free(struct fs_backend *backend)
+{
+	if (!backend)
+		return;
+
+	free(backend->data);
+	free(backend);
+}
+
+static void *synth_opendir(void *data, const char *path)
+{
+	struct synth_fs *fs = (struct synth_fs *)data;
+	struct synth_dir *dir = (struct synth_dir *)malloc(sizeof(struct synth_dir));
+
+	if (!dir) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	if (fs->dir_latency_us > 0) {
+		struct timespec ts = {
+			.tv_sec = fs->dir_latency_us / 1000000,
+			.tv_nsec = (fs->dir_latency_us % 1000000) * 1000
+		};
+
+		nanosleep(&ts, NULL);
+	}
+
+	dir->fs = fs;
+	dir->depth = synth_get_depth(path);
+	dir->num_dirs = dir->depth < fs->depth ? fs->fanout : 0;
+	dir->num_files = dir->depth == 0 ? fs->root_files : fs->files;
+	dir->pos = 0;
+	dir->hash = synth_hash(path, fs->seed);
+	dir->ino = ((ino_t)synth_hash(path, ~fs->seed) << 32) | dir->hash;
+
+	return dir;
+}
+
+static int synth_readdir(void *handle, struct fs_dirent *entry)
+{
+	struct synth_dir *dir = (struct synth_dir *)handle;
+	int pos = dir->pos;
+
+	if (pos >= dir->num_dirs + dir->num_files)
+		return 0;
+
+	dir->pos++;
+
+	if (pos < dir->num_dirs) {
+		snprintf(dir->name, sizeof(dir->name), "d%d", pos);
+		entry->type = DT_DIR;
+	}
+	else {
+		pos -= dir->num_dirs;
+		snprintf(dir->name, sizeof(dir->name), "f%d%s", pos, 
+			synth_exts[(dir->hash + pos) % (sizeof(synth_exts) / sizeof(synth_exts[0]))]);
+		entry->type = DT_REG;
+	}
+
+	entry->name = dir->name;
+
+	return 1;
+}
+
+static int synth_fstatdir(void *handle, struct stat *st)
+{
+	struct synth_dir *dir = (struct synth_dir *)handle;
+
+	memset(st, 0, sizeof(struct stat));
+
+	st->st_mode = S_IFDIR | 0755;
+	st->st_nlink = 2;
+	st->st_ino = dir->ino;
+	st->st_size = 4096;
+	st->st_blocks = 8;
+	st->st_uid = 1000 + dir->hash % 4;
+	st->st_gid = 1000;
+	st->st_mtime = dir->fs->now - dir->hash % (2 * 365 * 86400);
+	st->st_atime = st->st_mtime;
+	st->st_ctime = st->st_mtime;
+
+	return 0;
+}
+
+static int synth_closedir(void *dir)
+{
+	free(dir);
+	return 0;
+}
+
+static int synth_lstat(void *data, const char *path, struct stat *st)
+{
+	struct synth_fs *fs = (struct synth_fs *)data;
+	unsigned int hash = synth_hash(path, fs->seed);
+
+	if (fs->latency_us > 0) {
+		struct timespec ts = {
+			.tv_sec = fs->latency_us / 1000000,
+			.tv_nsec = (fs->latency_us % 1000000) * 1000
+		};
+
+		nanosleep(&ts, NULL);
+	}
+
+	memset(st, 0, sizeof(struct stat));
+
+	// sizes between size/2 and size*3/2, allocated in 4K blocks
+	st->st_mode = S_IFREG | 0644;
+	st->st_nlink = 1;
+	st->st_ino = hash;
+	st->st_size = fs->size / 2 + (fs->size > 0 ? hash % fs->size : 0);
+	st->st_blocks = (st->st_size + 4095) / 4096 * 8;
+	st->st_uid = 1000 + hash % 4;
+	st->st_gid = 1000 + hash % 2;
+	st->st_mtime = fs->now - hash % (2 * 365 * 86400);
+	st->st_atime = st->st_mtime + (hash >> 8) % (30 * 86400);
+	st->st_ctime = st->st_mtime;
+
+	return 0;
+}
+
+// there are no symlinks in the generated trees
+static int synth_stat(void *data, const char *path, struct stat *st)
+{
+	return synth_lstat(data, path, st);
+}
+
+/**
+** the depth of a directory is the number of generated (dN) components 
+** at the end of its path, the root can be any path
+**/
+static int synth_get_depth(const char *path)
+{
+	int depth = 0;
+	const char *end = path + strlen(path);
+
+	while (end > path) {
+		const char *start = end;
+
+		while (start > path && *(start-1) != '/')
+			start--;
+
+		if (end - start < 2 || *start != 'd' || strspn(start+1, "0123456789") != (size_t)(end - start - 1))
+			break;
+
+		depth++;
+		end = start > path ? start - 1 : path;
+	}
+
+	return depth;
+}
+
+static unsigned int synth_hash(const char *str, unsigned int seed)
+{
+	// FNV-1a
+	unsigned int hash = 2166136261u ^ seed;
+
+	for (const char *c = str; *c; c++) {
+		hash ^= (unsigned char)*c;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
@@ -0,0 +1,91 @@
+/* 
+ * Copyright (C) 2025 Zoltán Rácz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fs.h"
+#include "ratelimit.h"
+
+/**
+** --max-ops: wraps another backend, and lets only ops_per_sec opendir, 
+** lstat and stat calls through, shared by all the workers. readdir, fstatdir 
+** and closedir work on already opened directories, they are not limited
+**/
+struct throttle_data {
+	struct fs_backend fs;
+	const struct fs_backend *inner;
+	struct ratelimit rl;
+};
+
+static void *throttle_opendir(void *data, const char *path);
+static int throttle_lstat(void *data, const char *path, struct stat *st);
+static int throttle_stat(void *data, const char *path, struct stat *st);
+
+struct fs_backend *fs_throttle_new(const struct fs_backend *inner, long ops_per_sec)
+{
+	struct throttle_data *throttle = (struct throttle_data *)calloc(1, sizeof(struct throttle_data));
+
+	if (!throttle) {
+		printf("Error allocating memory for the rate limiter!\n");
+		return NULL;
+	}
+
+	throttle->inner = inner;
+	ratelimit_init(&throttle->rl, ops_per_sec);
+
+	throttle->fs.opendir = throttle_opendir;
+	throttle->fs.readdir = inner->readdir;
+	throttle->fs.fstatdir = inner->fstatdir;
+	throttle->fs.closedir = inner->closedir;
+	throttle->fs.lstat = throttle_lstat;
+	throttle->fs.stat = throttle_stat;
+	throttle->fs.data = throttle;
+
+	return &throttle->fs;
+}
+
+void fs_throttle_free(struct fs_backend *fs)
+{
+	if (!fs)
+		return;
+
+	free(fs->data);
+}
+
+static void *throttle_opendir(void *data, const char *path)
+{
+	struct throttle_data *throttle = (struct throttle_data *)data;
+
+	ratelimit_wait(&throttle->rl);
+	return throttle->inner->opendir(throttle->inner->data, path);
+}
+
+static int throttle_lstat(void *data, const char *path, struct stat *st)
+{
+	struct throttle_data *throttle = (struct throttle_data *)data;
+
+	ratelimit_wait(&throttle->rl);
+	return throttle->inner->lstat(throttle->inner->data, path, st);
+}
+
+static int throttle_stat(void *data, const char *path, struct stat *st)
+{
+	struct throttle_data *throttle = (struct throttle_data *)data;
+
+	ratelimit_wait(&throttle->rl);
+	return throttle->inner->stat(throttle->inner->data, path, st);
+}
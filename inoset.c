@@ -0,0 +1,153 @@
+/* 
+ * Copyright (C) 2025 Zoltán Rácz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "inoset.h"
+
+#define INO_SET_SHARD_SIZE 1024 // initial number of slots in a shard
+
+static uint64_t hash_key(dev_t dev, ino_t ino);
+static int grow_shard(struct ino_set_shard *shard);
+
+struct ino_set *ino_set_new()
+{
+	struct ino_set *set = NULL;
+
+	if (posix_memalign((void **)&set, 64, sizeof(struct ino_set)) != 0) {
+		printf("Error allocating memory for visited directories!\n");
+		return NULL;
+	}
+
+	for (int i = 0; i < INO_SET_SHARDS; i++) {
+		struct ino_set_shard *shard = &set->shards[i];
+
+		pthread_mutex_init(&shard->lock, NULL);
+		shard->len = 0;
+		shard->size = INO_SET_SHARD_SIZE;
+		shard->keys = calloc(shard->size, sizeof(struct ino_key));
+
+		if (!shard->keys) {
+			printf("Error allocating memory for visited directories!\n");
+
+			for (int j = 0; j <= i; j++)
+				free(set->shards[j].keys);
+
+			free(set);
+			return NULL;
+		}
+	}
+
+	return set;
+}
+
+/**
+** adds the pair to the set. Returns 1 if it was added, 0 if it was 
+** already there (the directory was seen before), -1 on errors
+**/
+int ino_set_insert(struct ino_set *set, dev_t dev, ino_t ino)
+{
+	uint64_t hash = hash_key(dev, ino);
+	// the low bits pick the shard, the rest the slot in it
+	struct ino_set_shard *shard = &set->shards[hash & (INO_SET_SHARDS - 1)];
+	int ret = 1;
+
+	hash /= INO_SET_SHARDS;
+
+	pthread_mutex_lock(&shard->lock);
+
+	if ((shard->len + 1) * 10 > shard->size * 7 && grow_shard(shard) != 0) {
+		pthread_mutex_unlock(&shard->lock);
+		return -1;
+	}
+
+	size_t i = hash & (shard->size - 1);
+
+	while (shard->keys[i].used) {
+		if (shard->keys[i].dev == dev && shard->keys[i].ino == ino) {
+			ret = 0;
+			break;
+		}
+
+		i = (i + 1) & (shard->size - 1);
+	}
+
+	if (ret == 1) {
+		shard->keys[i].dev = dev;
+		shard->keys[i].ino = ino;
+		shard->keys[i].used = 1;
+		shard->len++;
+	}
+
+	pthread_mutex_unlock(&shard->lock);
+
+	return ret;
+}
+
+void ino_set_free(struct ino_set *set)
+{
+	if (!set)
+		return;
+
+	for (int i = 0; i < INO_SET_SHARDS; i++) {
+		pthread_mutex_destroy(&set->shards[i].lock);
+		free(set->shards[i].keys);
+	}
+
+	free(set);
+}
+
+// splitmix64 finalizer, inode numbers are often sequential
+static uint64_t hash_key(dev_t dev, ino_t ino)
+{
+	uint64_t z = (uint64_t)ino ^ ((uint64_t)dev * 0x9E3779B97F4A7C15ULL);
+
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+
+	return z ^ (z >> 31);
+}
+
+static int grow_shard(struct ino_set_shard *shard)
+{
+	size_t size = shard->size * 2;
+	struct ino_key *keys = calloc(size, sizeof(struct ino_key));
+
+	if (!keys) {
+		printf("Error allocating memory for visited directories!\n");
+		return -1;
+	}
+
+	for (size_t i = 0; i < shard->size; i++) {
+		if (!shard->keys[i].used)
+			continue;
+
+		size_t j = (hash_key(shard->keys[i].dev, shard->keys[i].ino) / INO_SET_SHARDS) & (size - 1);
+
+		while (keys[j].used)
+			j = (j + 1) & (size - 1);
+
+		keys[j] = shard->keys[i];
+	}
+
+	free(shard->keys);
+	shard->keys = keys;
+	shard->size = size;
+
+	return 0;
+}
@@ -0,0 +1,57 @@
+/* 
+ * Copyright (C) 2025 Zoltán Rácz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  
+ */
+
+#include <pthread.h>
+#include <sys/types.h>
+
+#ifndef INOSET_H
+#define INOSET_H
+
+// a power of 2, so the shard is picked with a mask
+#define INO_SET_SHARDS 64
+
+struct ino_key {
+	dev_t dev;
+	ino_t ino;
+	int used;
+};
+
+/**
+** open addressing hash table with its own lock. Aligned to a cache line,
+** so workers locking neighbouring shards don`t slow each other down
+**/
+struct ino_set_shard {
+	pthread_mutex_t lock;
+	struct ino_key *keys;
+	size_t size;
+	size_t len;
+} __attribute__((aligned(64)));
+
+/**
+** set of (st_dev, st_ino) pairs of the directories already scanned (-L and
+** --dedupe-dirs). The pairs are spread over INO_SET_SHARDS independently 
+** locked shards by their hash, so workers only wait for each other when 
+** they look up directories in the same shard at the same time
+**/
+struct ino_set {
+	struct ino_set_shard shards[INO_SET_SHARDS];
+};
+
+struct ino_set *ino_set_new();
+int ino_set_insert(struct ino_set *set, dev_t dev, ino_t ino);
+void ino_set_free(struct ino_set *set);
+
+#endif //INOSET_H
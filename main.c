@@ -21,52 +21,160 @@
 #include <getopt.h>
 #include <sys/stat.h>
 #include <pthread.h>
+#include <signal.h>
 #include <linux/limits.h>
 #include <unistd.h>
 
 #include "bdu.h"
 #include "dir.h"
-#include "queue.h"
 #include "output.h"
 #include "utils.h"
+#include "agg.h"
+#include "fs.h"
+#include "estimate.h"
+#include "numa.h"
+#include "metrics.h"
+#include "snapshot.h"
 
 #define NUM_THREADS_DEFAULT 12
 
+/**
+** --threads=auto starts this many workers (at least 8 per core), 
+** the scan decides how many of them are needed
+**/
+#define AUTO_THREADS_MAX 64
+
+// --lazy-html without a depth: the levels written into the page itself
+#define LAZY_HTML_DEPTH_DEFAULT 2
+
+// error groups printed on stderr after the scan, the json output has all of them
+#define ERRORS_SHOWN_MAX 10
+
+// --checkpoint without --checkpoint-interval, in seconds
+#define CHECKPOINT_INTERVAL_DEFAULT 60
+
+// --serve-metrics without --refresh-interval, in seconds
+#define REFRESH_INTERVAL_DEFAULT 300
+
 char output_file_path[PATH_MAX];
 int output_file_path_len;
 
-struct dir_entry **root_entries;
-int root_entries_len = 0;
 int show_file_mtime = 0;
 int show_help = 0;
 int show_summary = 0;
 int show_in_bytes = 0;
 int show_no_leading_tabs = 0;
+int json_errors = 0; // --json-errors, the json output is an object with the errors in it
+int show_apparent_size = 0;
+int show_inodes = 0;
 int num_threads = 0;
+int auto_threads = 0;
+int show_stats = 0;
+int by_type = BY_TYPE_NONE;
+int by_owner = BY_OWNER_NONE;
+
+int num_age_limits = 0;
+time_t age_limits[DIR_AGE_BUCKETS_MAX-1];
+char *age_limit_names[DIR_AGE_BUCKETS_MAX-1];
+int age_by_atime = 0;
+time_t scan_start_time;
 
 int max_depth = -1;
 long unsigned int warn_at_bytes = 0;
 long unsigned int critical_at_bytes = 0;
+long unsigned int memory_limit = 0;
+long int deadline = 0;
+
+// --threshold and --min-inodes, smaller subdirectories are shown as one "(other)" entry
+long unsigned int threshold = 0;
+long unsigned int min_inodes = 0;
+
+double sample_rate = 0;
+double confidence = 0.95;
+unsigned long sample_seed = 0;
+
+int *cpus = NULL;
+int cpus_len = 0;
+int numa_mode = NUMA_NONE;
+
+int io_class = IO_CLASS_NONE;
+int io_level = 4;
+long max_ops = 0;
+
+int dereference = 0;
+int dedupe_dirs = 0;
+
+/**
+** --checkpoint saves the scan periodically, and once more on Ctrl-C or 
+** SIGTERM. --resume continues from the file, and keeps saving to it
+**/
+char *checkpoint_path = NULL;
+char *resume_path = NULL;
+long int checkpoint_interval = CHECKPOINT_INTERVAL_DEFAULT;
+volatile sig_atomic_t interrupted = 0;
+
+// --serve-metrics=unix:PATH or textfile:PATH, rescans every refresh_interval seconds
+char *metrics_target = NULL;
+long int refresh_interval = REFRESH_INTERVAL_DEFAULT;
+
+/**
+** --snapshot-out saves the scanned tree, or the merged one with --merge.
+** --load-snapshot and --merge show saved trees instead of scanning
+**/
+char *snapshot_out_path = NULL;
+char *load_snapshot_path = NULL;
+int merge_snapshots = 0;
+
+// directories with more files than this are split into chunks, 0 = never
+int large_dir_files = 10000;
+
+// --prefetch, directories per worker opened ahead by helper threads, 0 = off
+int prefetch_depth = 0;
 
 int sort_flags = 0;
 
-char output_format[6];
+// --lazy-html, the chunk files are written to <output file>.d
+int lazy_html_depth = 0;
+char chunk_dir[PATH_MAX+4];
+char chunk_url[PATH_MAX+4];
+
+FILE *info_fp = NULL; // the separator lines and the summary, stdout by default
+
+char output_format[16];
 
-pthread_t **threads;
-int active_workers = 0;
+struct bdu_scan *scan = NULL;
 
-struct queue_list *qlist = NULL;
+/**
+** roots are printed as soon as they are scanned, unless the output 
+** has breakdown tables, which are only complete after the whole scan
+**/
+int stream_roots = 0;
+int show_total = 0;
+FILE *output_fp = NULL;
+struct output_options output_opts = {.no_styles=0, .human_readable=0};
+pthread_mutex_t output_lock = PTHREAD_MUTEX_INITIALIZER;
+int roots_printed = 0;
+struct dir_entry grand_total;
 
-pthread_mutex_t active_workers_mutex = PTHREAD_MUTEX_INITIALIZER;
+char *synthetic_spec = NULL;
+struct fs_backend *synthetic_fs = NULL;
 
 struct option cmdline_options[] =
 	{
 		// options without arguments
 		{"summarize",     no_argument, NULL, 's'},
+		{"total",     no_argument, NULL, 'c'},
+		{"dereference",     no_argument, NULL, 'L'},
+		{"dedupe-dirs",     no_argument, &dedupe_dirs, 1},
 		{"in-bytes",     no_argument, &show_in_bytes, 1},
 		{"no-leading-tabs",     no_argument, &show_no_leading_tabs, 1},
 		{"time",     no_argument, &show_file_mtime, 1},
+		{"apparent-size",     no_argument, &show_apparent_size, 1},
+		{"inodes",     no_argument, &show_inodes, 1},
+		{"stats",     no_argument, &show_stats, 1},
 		{"help",     no_argument, &show_help, 1},
+		{"merge",     no_argument, &merge_snapshots, 1},
+		{"json-errors",     no_argument, &json_errors, 1},
 
 		// options with argument
 		{"max-depth",     required_argument, NULL, 'd'},
@@ -77,6 +185,34 @@ struct option cmdline_options[] =
 		{"output-file",     required_argument, NULL, 0},
 		{"sort-by",     required_argument, NULL, 0},
 		{"sort-order",     required_argument, NULL, 0},
+		{"age-buckets",     required_argument, NULL, 0},
+		{"age-by",     required_argument, NULL, 0},
+		{"by-owner",     required_argument, NULL, 0},
+		{"synthetic",     required_argument, NULL, 0},
+		{"memory-limit",     required_argument, NULL, 0},
+		{"deadline",     required_argument, NULL, 0},
+		{"confidence",     required_argument, NULL, 0},
+		{"seed",     required_argument, NULL, 0},
+		{"cpus",     required_argument, NULL, 0},
+		{"numa",     required_argument, NULL, 0},
+		{"io-class",     required_argument, NULL, 0},
+		{"max-ops",     required_argument, NULL, 0},
+		{"large-dir",     required_argument, NULL, 0},
+		{"prefetch",     required_argument, NULL, 0},
+		{"threshold",     required_argument, NULL, 0},
+		{"min-inodes",     required_argument, NULL, 0},
+		{"checkpoint",     required_argument, NULL, 0},
+		{"checkpoint-interval",     required_argument, NULL, 0},
+		{"resume",     required_argument, NULL, 0},
+		{"serve-metrics",     required_argument, NULL, 0},
+		{"refresh-interval",     required_argument, NULL, 0},
+		{"snapshot-out",     required_argument, NULL, 0},
+		{"load-snapshot",     required_argument, NULL, 0},
+
+		// options with optional argument
+		{"by-type",     optional_argument, NULL, 0},
+		{"estimate",     optional_argument, NULL, 0},
+		{"lazy-html",     optional_argument, NULL, 0},
 
 		{0, 0, 0, 0}
 	};
@@ -84,127 +220,50 @@ struct option cmdline_options[] =
 static int parse_args(int argc, char *argv[]);
 static int get_num_cpu_cores();
 static void print_help();
-static int process_output();
-
-
-int add_root_entry(char *path)
-{
-	if (root_entries_len == 0)
-		root_entries = calloc(root_entries_len+1, sizeof(char *));
-	else 
-		root_entries = realloc(root_entries, (root_entries_len+1) * sizeof(char *));
-
-	if (!root_entries) {
-		printf("Error allocating memory for root entries array!\n");
-		return -1;
-	}
-
-	struct dir_entry *d = dir_create_dentry(path);
-
-	if (!d) {
-		printf("Error allocating memory for root entry!\n");
-		return -1;
-	}
-
-	root_entries[root_entries_len] = d;
-	root_entries_len++;
+static int open_output();
+static void print_root(struct dir_entry *root);
+static void root_complete_callback(struct dir_entry *dentry, void *user_data);
+static void close_output();
+static void print_errors();
+static int parse_age_buckets(char *arg);
+static void interrupt_handler(int sig);
+static int show_snapshots(int paths_len, char **paths);
+static int print_snapshot(const char *path);
 
-	queue_add_elem(qlist, d);
-
-	return 0;
-}
 
 int process_files_args(int argc, char **argv)
 {
+	// the directories of a resumed scan are the ones in the checkpoint
+	if (resume_path)
+		return bdu_scan_resume(scan, resume_path);
+
 	/**
 	** checking for the argument containing the path to be scanned
 	**/
 	if (argc > optind) {
 		for (int i=optind;i<argc;i++) {
-			add_root_entry(argv[i]);
+			bdu_scan_add_root(scan, argv[i]);
 		}
 	}
 	else {
 		/**
 		** if no path was specified in the command line options we default it to "./"
 		**/
-		add_root_entry(".");
+		bdu_scan_add_root(scan, ".");
 	}
 
 	return 0;
 }
 
-void increment_active_workers()
-{
-	pthread_mutex_lock(&active_workers_mutex);
-	active_workers++;
-	pthread_mutex_unlock(&active_workers_mutex);
-}
-
-void decrement_active_workers()
-{
-	pthread_mutex_lock(&active_workers_mutex);
-	active_workers--;
-	pthread_mutex_unlock(&active_workers_mutex);
-}
-
-int num_active_workers()
-{
-	int num = 0;
-
-	pthread_mutex_lock(&active_workers_mutex);
-	num = active_workers;
-	pthread_mutex_unlock(&active_workers_mutex);
-
-	return num;
-}
-
-void subdir_scan_callback(struct dir_entry *d)
-{
-	queue_add_elem(qlist, d);
-}
-
-void* thread_worker() 
-{
-	struct queue_elem *elem = NULL;
-	struct dir_entry *dentry = NULL;
-
-	while (1) {
-		pthread_mutex_lock(&qlist->lock);
-		elem = queue_get_next_elem(qlist);
-		pthread_mutex_unlock(&qlist->lock);
-
-
-		if (!elem) {
-			if (num_active_workers() == 0) {
-				return NULL;
-			}
-			
-			continue;
-		}
-
-		increment_active_workers();
-
-		dentry = (struct dir_entry *)elem->data;
-
-		pthread_mutex_lock(&qlist->lock);
-		dir_scan(dentry, subdir_scan_callback, show_file_mtime);
-		pthread_mutex_unlock(&qlist->lock);
-
-		decrement_active_workers();
-
-		queue_free_elem(elem);
-	}
-
-	return NULL;
-}
-
 int main(int argc, char *argv[])
 {
 	int ret = 0;
 
 	time_t start = time(NULL);
 
+	scan_start_time = start;
+	info_fp = stdout;
+
 	ret = parse_args(argc, argv);
 
 	if (ret < 0) 
@@ -223,31 +282,30 @@ int main(int argc, char *argv[])
 		sort_flags |= SORT_DESC;
 
 	/**
-	** if sort-by was not set, we default it to size
-	**/
-	if (!(sort_flags & SORT_BY_FULL_MASK))
-		sort_flags |= SORT_BY_SIZE;
-
-
-	/**
-	** we check if qlist has been initialized. If not, we initialize it. 
-	** If queue_new_list() returns NULL, no need to go further
+	** if sort-by was not set, we default it to the displayed counter
+	** (size, or apparent size / inodes if requested)
 	**/
-	if (!qlist) {
-		qlist = queue_new_list();
-		if (!qlist) {
-			printf("Error allocating memory for scan queue list!\n");
-			return -1;
-		}
+	if (!(sort_flags & SORT_BY_FULL_MASK)) {
+		if (show_inodes)
+			sort_flags |= SORT_BY_INODES;
+		else if (show_apparent_size)
+			sort_flags |= SORT_BY_APPARENT;
+		else 
+			sort_flags |= SORT_BY_SIZE;
 	}
 
-	process_files_args(argc, argv);
 
 	/**
 	** we check if the user didn`t for some reason set --threads=0
 	** if it did, we set it to 1
 	**/
-	if (num_threads <= 0) 
+	if (auto_threads) {
+		num_threads = get_num_cpu_cores() * 8;
+
+		if (num_threads < AUTO_THREADS_MAX)
+			num_threads = AUTO_THREADS_MAX;
+	}
+	else if (num_threads <= 0) 
 		num_threads = get_num_cpu_cores();
 
 	/**
@@ -264,37 +322,279 @@ int main(int argc, char *argv[])
 	if (strlen(output_format) < 1)
 		strcpy(output_format, "text");
 
+	// the chunk files are written next to the page, so it needs a path
+	if (lazy_html_depth && (strcmp(output_format, "html") != 0 || !output_file_path_len)) {
+		printf("--lazy-html needs --output-format=html and --output-file!\n");
+		return -1;
+	}
+
+	/**
+	** ndjson, csv and folded are read by other programs from a pipe, and 
+	** svg is an image, the separator lines and the summary go to stderr there
+	**/
+	if (strcmp(output_format, "ndjson") == 0 || strcmp(output_format, "csv") == 0 || 
+			strcmp(output_format, "folded") == 0 || strcmp(output_format, "svg") == 0)
+		info_fp = stderr;
+
+	/**
+	** the breakdown tables of the displayed directories point to the 
+	** dentries, so those can`t be moved to the spill file
+	**/
+	if (memory_limit && (by_type == BY_TYPE_TREE || by_owner)) {
+		printf("--memory-limit can`t be used together with --by-type=tree or --by-owner!\n");
+		return -1;
+	}
+
+	// the same goes for the folded subdirectories, they are freed during the scan
+	if ((threshold || min_inodes) && (by_type == BY_TYPE_TREE || by_owner)) {
+		printf("--threshold and --min-inodes can`t be used together with --by-type=tree or --by-owner!\n");
+		return -1;
+	}
+
+	/**
+	** the breakdown tables are not extrapolated, they would only 
+	** show the sampled files
+	**/
+	if (sample_rate > 0 && (by_type || by_owner)) {
+		printf("--estimate can`t be used together with --by-type or --by-owner!\n");
+		return -1;
+	}
+
+	// a resumed scan is saved to the same file again, unless told otherwise
+	if (resume_path && !checkpoint_path)
+		checkpoint_path = resume_path;
+
+	/**
+	** the checkpoint holds only the tree: not the breakdown tables, the 
+	** visited directories, the sample or the spilled subtrees
+	**/
+	if (checkpoint_path && (by_type || by_owner || sample_rate > 0 || memory_limit || dereference || dedupe_dirs)) {
+		printf("--checkpoint and --resume can`t be used together with --by-type, --by-owner, --estimate,\n"
+			"--memory-limit, -L or --dedupe-dirs!\n");
+		return -1;
+	}
+
+	/**
+	** the refreshes reuse the previous tree, which has to be complete and
+	** unchanged. The age buckets would be off by the time between them
+	**/
+	if (metrics_target && (by_type || by_owner || sample_rate > 0 || memory_limit || dereference || dedupe_dirs || 
+			threshold || min_inodes || num_age_limits || deadline || checkpoint_path)) {
+		printf("--serve-metrics can`t be used together with --by-type, --by-owner, --estimate, --memory-limit,\n"
+			"-L, --dedupe-dirs, --threshold, --min-inodes, --age-buckets, --deadline or --checkpoint!\n");
+		return -1;
+	}
+
+	/**
+	** the spilled subtrees are not in memory when the snapshot is written.
+	** The breakdown tables are not saved in it, only the tree
+	**/
+	if (snapshot_out_path && (memory_limit || metrics_target)) {
+		printf("--snapshot-out can`t be used together with --memory-limit or --serve-metrics!\n");
+		return -1;
+	}
+
+	// the saved trees are only shown, the options of the scan don`t apply to them
+	if ((merge_snapshots || load_snapshot_path) && (by_type || by_owner || sample_rate > 0 || memory_limit || 
+			threshold || min_inodes || checkpoint_path || metrics_target || synthetic_spec)) {
+		printf("--merge and --load-snapshot can`t be used together with --by-type, --by-owner, --estimate,\n"
+			"--memory-limit, --threshold, --min-inodes, --checkpoint, --serve-metrics or --synthetic!\n");
+		return -1;
+	}
+
+	if (load_snapshot_path && (merge_snapshots || snapshot_out_path)) {
+		printf("--load-snapshot can`t be used together with --merge or --snapshot-out!\n");
+		return -1;
+	}
+
+	if (merge_snapshots || load_snapshot_path) 
+		return show_snapshots(argc - optind, argv + optind);
+
+	if (checkpoint_path || metrics_target) {
+		struct sigaction sa;
+
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_handler = interrupt_handler;
+		sigaction(SIGINT, &sa, NULL);
+		sigaction(SIGTERM, &sa, NULL);
+	}
+
+	struct bdu_scan_options scan_opts = {
+		.num_threads = num_threads,
+		.auto_threads = auto_threads,
+		.sort_flags = sort_flags,
+		.memory_limit = memory_limit,
+		.deadline = deadline,
+		.cpus = cpus,
+		.cpus_len = cpus_len,
+		.numa = numa_mode,
+		.io_class = io_class,
+		.io_level = io_level,
+		.max_ops = max_ops,
+		.dedupe_dirs = dedupe_dirs,
+		.threshold = threshold,
+		.threshold_apparent = show_apparent_size,
+		.min_inodes = min_inodes,
+		.checkpoint_path = checkpoint_path,
+		.checkpoint_interval = checkpoint_interval,
+		.interrupt = &interrupted,
+		.prefetch_depth = prefetch_depth,
+		.dir = {
+			.proc_mtime = show_file_mtime,
+			.by_type = by_type,
+			.by_owner = by_owner,
+			.max_depth = max_depth,
+			.num_age_limits = num_age_limits,
+			.age_by_atime = age_by_atime,
+			.now = scan_start_time,
+			.sample_rate = sample_rate,
+			.seed = sample_seed,
+			.chunk_size = large_dir_files,
+			.dereference = dereference
+		}
+	};
+
+	memcpy(scan_opts.dir.age_limits, age_limits, sizeof(age_limits));
+
+	/**
+	** --synthetic scans a generated tree instead of the real filesystem,
+	** for benchmarking
+	**/
+	if (synthetic_spec) {
+		synthetic_fs = fs_synth_new(synthetic_spec);
+
+		if (!synthetic_fs)
+			return -1;
+
+		scan_opts.dir.fs = synthetic_fs;
+	}
+
+	/**
+	** the exporter runs its own scans until it is stopped, 
+	** with the directories of the command line
+	**/
+	if (metrics_target) {
+		char *default_paths[] = {"."};
+
+		if (argc > optind)
+			ret = metrics_serve(metrics_target, &scan_opts, argv + optind, argc - optind, refresh_interval, max_depth, &interrupted);
+		else 
+			ret = metrics_serve(metrics_target, &scan_opts, default_paths, 1, refresh_interval, max_depth, &interrupted);
+
+		fs_synth_free(synthetic_fs);
+		free(cpus);
+
+		return ret;
+	}
+
+	stream_roots = !by_type && !by_owner;
+
+	if (stream_roots)
+		scan_opts.callbacks.dir_complete = root_complete_callback;
+
+	/**
+	** If bdu_scan_new() returns NULL, no need to go further
+	**/
+	scan = bdu_scan_new(&scan_opts);
+
+	if (!scan)
+		return -1;
+
+	if (process_files_args(argc, argv) != 0) {
+		bdu_scan_free(scan);
+		return -1;
+	}
+
+	fprintf(info_fp, "-------------------------------------------\n");
+
+	if (open_output() != 0) {
+		bdu_scan_free(scan);
+		return -1;
+	}
+
+	ret = bdu_scan_run(scan);
+
+	if (ret == BDU_SCAN_INTERRUPTED) {
+		fprintf(stderr, "bdu: interrupted, continue the scan with --resume=%s\n", checkpoint_path);
+		bdu_scan_free(scan);
+		return 130;
+	}
 
-	threads = calloc(num_threads, sizeof(pthread_t *));
+	if (ret != 0) {
+		bdu_scan_free(scan);
+		return -1;
+	}
 
-	for (int i = 0; i < num_threads; i++) {
-		threads[i] = (pthread_t *) malloc(sizeof(pthread_t));
+	if (!stream_roots) {
+		int roots_len = 0;
+		struct dir_entry **roots = bdu_scan_get_roots(scan, &roots_len);
 
-		pthread_create(threads[i], NULL, thread_worker, NULL);
+		dir_sort_entries(roots, roots_len, max_depth, 0, sort_flags);
+
+		for (int i=0;i<roots_len;i++)
+			print_root(roots[i]);
 	}
 
-	for (int i = 0; i < num_threads; i++) {
-		pthread_join(*(threads[i]), NULL);
+	if (snapshot_out_path) {
+		int roots_len = 0;
+		struct dir_entry **roots = bdu_scan_get_roots(scan, &roots_len);
+		struct snapshot_info info = {.num_age_limits = num_age_limits, .estimated = sample_rate > 0};
+
+		memcpy(info.age_limits, age_limits, sizeof(age_limits));
+
+		if (snapshot_write(snapshot_out_path, roots, roots_len, &info) != 0) {
+			close_output();
+			bdu_scan_free(scan);
+			return -1;
+		}
 	}
 
-	printf("-------------------------------------------\n");
+	close_output();
+	print_errors();
 
-	dir_sort_entries(root_entries, root_entries_len, max_depth, 0, sort_flags);
+	size_t errors_total = output_opts.errors_total;
+	int active_workers = bdu_scan_get_active_workers(scan);
+	size_t unscanned = bdu_scan_get_unscanned(scan);
+	struct bdu_scan_stats stats;
 
-	process_output();
+	bdu_scan_get_stats(scan, &stats);
 
-	dir_free_entries(root_entries, root_entries_len);
-	dir_cleanup();
+	bdu_scan_free(scan);
+	fs_synth_free(synthetic_fs);
+	free(cpus);
 
 	time_t end = time(NULL);
 	double elapsed = difftime(end, start);
 
-	printf("-------------------------------------------\n");
-	printf("Number of threads used: %d\n", num_threads);
-	printf("Active workers at the end: %d\n", active_workers);
-	printf("Took: %.2f seconds\n", elapsed);
+	fprintf(info_fp, "-------------------------------------------\n");
+	if (auto_threads)
+		fprintf(info_fp, "Number of threads used: %d (auto, up to %d)\n", stats.workers, stats.max_workers);
+	else 
+		fprintf(info_fp, "Number of threads used: %d\n", num_threads);
+	fprintf(info_fp, "Active workers at the end: %d\n", active_workers);
+	fprintf(info_fp, "Took: %.2f seconds\n", elapsed);
 
-	return 0;
+	if (unscanned && deadline > 0)
+		fprintf(info_fp, "Deadline reached, %ld directories were not scanned, the results are partial\n", unscanned);
+	else if (unscanned)
+		fprintf(info_fp, "%ld directories were not scanned, the results are partial\n", unscanned);
+
+	if (show_stats) {
+		fprintf(info_fp, "Entries scanned: %zu (%.0f/s)\n", stats.entries, stats.elapsed > 0 ? stats.entries / stats.elapsed : 0);
+		fprintf(info_fp, "Average time per entry: %.1f us\n", stats.entry_us);
+		fprintf(info_fp, "Workers: %d of %d", stats.workers, stats.max_workers);
+
+		if (auto_threads)
+			fprintf(info_fp, ", chosen by --threads=auto in %d adjustments", stats.adjustments);
+
+		fprintf(info_fp, "\n");
+
+		if (prefetch_depth)
+			fprintf(info_fp, "Directories opened ahead: %zu\n", stats.prefetched);
+	}
+
+	// like du, failing to read a part of the tree is an error
+	return errors_total ? 1 : 0;
 }
 
 static int parse_args(int argc, char *argv[])
@@ -304,7 +604,7 @@ static int parse_args(int argc, char *argv[])
 	int c;
 
 	while (1) {
-		c = getopt_long (argc, argv, "sd:o:",
+		c = getopt_long (argc, argv, "Lcsd:o:",
 			cmdline_options, &option_index);
 
 		switch(c) {
@@ -312,16 +612,26 @@ static int parse_args(int argc, char *argv[])
 				max_depth = atoi(optarg);
 				break;
 			case 'o':
-				strncpy(output_format, optarg, strlen(optarg));
+				strncpy(output_format, optarg, sizeof(output_format)-1);
 				break;
 			case 's':
 				show_summary = 1;
 				break;
+			case 'c':
+				show_total = 1;
+				break;
+			case 'L':
+				dereference = 1;
+				break;
 			case 0:
 				opt = cmdline_options[option_index];
 
-				if (strcmp(opt.name, "threads") == 0) 
-					num_threads = atoi(optarg);
+				if (strcmp(opt.name, "threads") == 0) {
+					if (strcmp(optarg, "auto") == 0)
+						auto_threads = 1;
+					else 
+						num_threads = atoi(optarg);
+				}
 				else if (strcmp(opt.name, "warn-at") == 0)
 					warn_at_bytes = human_size_to_bytes(optarg);
 				else if (strcmp(opt.name, "critical-at") == 0)
@@ -337,8 +647,180 @@ static int parse_args(int argc, char *argv[])
 						sort_flags |= SORT_BY_NAME;
 					else if (strcmp(optarg, "date") == 0)
 						sort_flags |= SORT_BY_DATE;
+					else if (strcmp(optarg, "inodes") == 0)
+						sort_flags |= SORT_BY_INODES;
+					else if (strcmp(optarg, "apparent") == 0)
+						sort_flags |= SORT_BY_APPARENT;
 					else {
-						printf("Invalid sort field! Should be \"size\", \"name\" or \"date\".");
+						printf("Invalid sort field! Should be \"size\", \"apparent\", \"inodes\", \"name\" or \"date\".");
+						return -1;
+					}
+				}
+				else if (strcmp(opt.name, "by-type") == 0) {
+					if (!optarg || strcmp(optarg, "total") == 0)
+						by_type = BY_TYPE_TOTAL;
+					else if (strcmp(optarg, "tree") == 0)
+						by_type = BY_TYPE_TREE;
+					else {
+						printf("Invalid by-type mode! Should be \"total\" or \"tree\".");
+						return -1;
+					}
+				}
+				else if (strcmp(opt.name, "by-owner") == 0) {
+					if (strcmp(optarg, "uid") == 0)
+						by_owner = BY_OWNER_UID;
+					else if (strcmp(optarg, "gid") == 0)
+						by_owner = BY_OWNER_GID;
+					else {
+						printf("Invalid by-owner mode! Should be \"uid\" or \"gid\".");
+						return -1;
+					}
+				}
+				else if (strcmp(opt.name, "threshold") == 0)
+					threshold = human_size_to_bytes(optarg);
+				else if (strcmp(opt.name, "min-inodes") == 0)
+					min_inodes = strtoul(optarg, NULL, 10);
+				else if (strcmp(opt.name, "memory-limit") == 0)
+					memory_limit = human_size_to_bytes(optarg);
+				else if (strcmp(opt.name, "deadline") == 0) {
+					deadline = human_duration_to_seconds(optarg);
+
+					if (deadline <= 0) {
+						printf("Invalid deadline \"%s\"! Should be a duration like 30s or 5m.", optarg);
+						return -1;
+					}
+				}
+				else if (strcmp(opt.name, "estimate") == 0) {
+					sample_rate = optarg ? atof(optarg) : ESTIMATE_SAMPLE_RATE_DEFAULT;
+
+					if (sample_rate <= 0 || sample_rate > 1) {
+						printf("Invalid sample rate! Should be between 0 and 1, ex: --estimate=0.1");
+						return -1;
+					}
+				}
+				else if (strcmp(opt.name, "lazy-html") == 0) {
+					lazy_html_depth = optarg ? atoi(optarg) : LAZY_HTML_DEPTH_DEFAULT;
+
+					if (lazy_html_depth < 1) {
+						printf("Invalid lazy-html depth! Should be the number of levels written into the page, ex: --lazy-html=2");
+						return -1;
+					}
+				}
+				else if (strcmp(opt.name, "confidence") == 0) {
+					confidence = atof(optarg) / 100;
+
+					if (confidence <= 0 || confidence >= 1) {
+						printf("Invalid confidence! Should be a percentage between 0 and 100, ex: --confidence=95");
+						return -1;
+					}
+				}
+				else if (strcmp(opt.name, "cpus") == 0) {
+					free(cpus);
+					cpus_len = numa_parse_cpu_list(optarg, &cpus);
+
+					if (cpus_len <= 0) {
+						printf("Invalid CPU list! Should be like 0-3,8,10-11.");
+						return -1;
+					}
+				}
+				else if (strcmp(opt.name, "numa") == 0) {
+					if (strcmp(optarg, "local") == 0)
+						numa_mode = NUMA_LOCAL;
+					else if (strcmp(optarg, "interleave") == 0)
+						numa_mode = NUMA_INTERLEAVE;
+					else {
+						printf("Invalid NUMA mode! Should be \"local\" or \"interleave\".");
+						return -1;
+					}
+				}
+				else if (strcmp(opt.name, "io-class") == 0) {
+					if (strcmp(optarg, "idle") == 0)
+						io_class = IO_CLASS_IDLE;
+					else if (strncmp(optarg, "best-effort", 11) == 0) {
+						io_class = IO_CLASS_BEST_EFFORT;
+
+						// optional level, ex. best-effort:7
+						if (optarg[11] == ':')
+							io_level = atoi(optarg + 12);
+
+						if ((optarg[11] != ':' && optarg[11] != '\0') || io_level < 0 || io_level > 7) {
+							printf("Invalid I/O class! Should be \"idle\" or \"best-effort[:0-7]\".");
+							return -1;
+						}
+					}
+					else {
+						printf("Invalid I/O class! Should be \"idle\" or \"best-effort[:0-7]\".");
+						return -1;
+					}
+				}
+				else if (strcmp(opt.name, "max-ops") == 0) {
+					char *end = NULL;
+
+					// N or N/s
+					max_ops = strtol(optarg, &end, 10);
+
+					if (max_ops <= 0 || (*end != '\0' && strcmp(end, "/s") != 0)) {
+						printf("Invalid max-ops! Should be operations per second, ex: --max-ops=2000/s");
+						return -1;
+					}
+				}
+				else if (strcmp(opt.name, "prefetch") == 0) {
+					prefetch_depth = atoi(optarg);
+
+					if (prefetch_depth < 0) {
+						printf("Invalid prefetch depth! Should be the number of directories per worker, or 0 to turn it off.");
+						return -1;
+					}
+				}
+				else if (strcmp(opt.name, "large-dir") == 0) {
+					large_dir_files = atoi(optarg);
+
+					if (large_dir_files < 0) {
+						printf("Invalid large-dir! Should be the number of files, or 0 to never split directories.");
+						return -1;
+					}
+				}
+				else if (strcmp(opt.name, "checkpoint-interval") == 0) {
+					checkpoint_interval = human_duration_to_seconds(optarg);
+
+					if (checkpoint_interval <= 0) {
+						printf("Invalid checkpoint interval \"%s\"! Should be a duration like 30s or 5m.", optarg);
+						return -1;
+					}
+				}
+				else if (strcmp(opt.name, "refresh-interval") == 0) {
+					refresh_interval = human_duration_to_seconds(optarg);
+
+					if (refresh_interval <= 0) {
+						printf("Invalid refresh interval \"%s\"! Should be a duration like 30s or 5m.", optarg);
+						return -1;
+					}
+				}
+				else if (strcmp(opt.name, "serve-metrics") == 0)
+					metrics_target = optarg;
+				else if (strcmp(opt.name, "checkpoint") == 0)
+					checkpoint_path = optarg;
+				else if (strcmp(opt.name, "resume") == 0)
+					resume_path = optarg;
+				else if (strcmp(opt.name, "snapshot-out") == 0)
+					snapshot_out_path = optarg;
+				else if (strcmp(opt.name, "load-snapshot") == 0)
+					load_snapshot_path = optarg;
+				else if (strcmp(opt.name, "seed") == 0)
+					sample_seed = strtoul(optarg, NULL, 10);
+				else if (strcmp(opt.name, "synthetic") == 0)
+					synthetic_spec = optarg;
+				else if (strcmp(opt.name, "age-buckets") == 0) {
+					if (parse_age_buckets(optarg) != 0)
+						return -1;
+				}
+				else if (strcmp(opt.name, "age-by") == 0) {
+					if (strcmp(optarg, "mtime") == 0) 
+						age_by_atime = 0;
+					else if (strcmp(optarg, "atime") == 0)
+						age_by_atime = 1;
+					else {
+						printf("Invalid age field! Should be \"mtime\" or \"atime\".");
 						return -1;
 					}
 				}
@@ -362,6 +844,55 @@ static int parse_args(int argc, char *argv[])
 	return 0;
 }
 
+/**
+** parses a comma separated list of ascending durations, ex. 7d,30d,90d,1y.
+** N limits give N+1 buckets, the last one holding everything older
+**/
+static int parse_age_buckets(char *arg)
+{
+	char *saveptr = NULL;
+	char *token = strtok_r(arg, ",", &saveptr);
+
+	num_age_limits = 0;
+
+	while (token) {
+		long int seconds = human_duration_to_seconds(token);
+
+		if (seconds <= 0) {
+			printf("Invalid age bucket \"%s\"! Should be a duration like 7d, 12h or 1y.", token);
+			return -1;
+		}
+
+		if (num_age_limits == DIR_AGE_BUCKETS_MAX-1) {
+			printf("Too many age buckets! At most %d limits are allowed.", DIR_AGE_BUCKETS_MAX-1);
+			return -1;
+		}
+
+		if (num_age_limits > 0 && seconds <= age_limits[num_age_limits-1]) {
+			printf("Age buckets should be in ascending order!");
+			return -1;
+		}
+
+		age_limits[num_age_limits] = seconds;
+		age_limit_names[num_age_limits] = token;
+		num_age_limits++;
+
+		token = strtok_r(NULL, ",", &saveptr);
+	}
+
+	return 0;
+}
+
+/**
+** Ctrl-C and SIGTERM with --checkpoint: the scan writes a last checkpoint
+** and stops. A second one kills the process as usual
+**/
+static void interrupt_handler(int sig)
+{
+	interrupted = 1;
+	signal(sig, SIG_DFL);
+}
+
 static int get_num_cpu_cores()
 {
 	long num_cores = sysconf(_SC_NPROCESSORS_ONLN);
@@ -374,16 +905,51 @@ static int get_num_cpu_cores()
     return num_cores;
 }
 
-static int process_output()
+/**
+** opens the output and prints its header. The roots are printed by 
+** print_root, either as soon as they are scanned or after the whole scan
+**/
+static int open_output()
 {
-	struct output_options output_opts = {.no_styles=0, .human_readable=0};
-	FILE *out;
-
 	output_opts.max_depth = max_depth;
 	output_opts.show_warn_at_bytes = warn_at_bytes;
 	output_opts.show_critical_at_bytes = critical_at_bytes;
 	output_opts.human_readable = !show_in_bytes;
 	output_opts.no_leading_tabs = show_no_leading_tabs;
+	output_opts.json_errors = json_errors;
+	output_opts.grand_total = show_total;
+	output_opts.by_type = by_type;
+	output_opts.by_owner = by_owner;
+	output_opts.num_age_limits = num_age_limits;
+	output_opts.age_limit_names = age_limit_names;
+	output_opts.spill = scan ? bdu_scan_get_spill(scan) : NULL;
+	output_opts.deadline = deadline > 0;
+
+	if (lazy_html_depth) {
+		const char *name = strrchr(output_file_path, '/');
+
+		snprintf(chunk_dir, sizeof(chunk_dir), "%s.d", output_file_path);
+		snprintf(chunk_url, sizeof(chunk_url), "%s.d/", name ? name + 1 : output_file_path);
+
+		if (mkdir(chunk_dir, 0755) != 0 && errno != EEXIST) {
+			printf("Error creating the chunk directory \"%s\" (%s)\n", chunk_dir, strerror(errno));
+			return -1;
+		}
+
+		output_opts.lazy_depth = lazy_html_depth;
+		output_opts.chunk_dir = chunk_dir;
+		output_opts.chunk_url = chunk_url;
+	}
+
+	if (sample_rate > 0)
+		output_opts.estimate_z = estimate_get_z(confidence);
+
+	if (show_inodes)
+		output_opts.metric = OUTPUT_METRIC_INODES;
+	else if (show_apparent_size)
+		output_opts.metric = OUTPUT_METRIC_APPARENT;
+	else 
+		output_opts.metric = OUTPUT_METRIC_BYTES;
 	
 
 	if (output_file_path_len) {
@@ -394,33 +960,263 @@ static int process_output()
 			return -1;
 		}
 
-		out = fp;
+		output_fp = fp;
 		// when writing to a file we don`t want any styles (colors for ex.)
 		output_opts.no_styles = 1; 
 	}
 	else 
-		out = stdout;
+		output_fp = stdout;
 
-	output_print(out, root_entries, root_entries_len, output_format, output_opts);
+	output_begin(output_fp, output_format, output_opts);
 
 	return 0;
 }
 
+/**
+** sorts and prints a scanned root, and adds it to the grand total (-c).
+** Called from the workers when streaming, so it is serialized with a lock
+**/
+static void print_root(struct dir_entry *root)
+{
+	pthread_mutex_lock(&output_lock);
+
+	dir_sort_entries(&root, 1, max_depth, 0, sort_flags);
+	output_print_entry(output_fp, root, roots_printed++, output_format, output_opts);
+
+	dir_totals_add(&grand_total.totals, &root->totals);
+
+	for (int i=0;i<3;i++)
+		grand_total.estimate.var[i] += root->estimate.var[i];
+
+	pthread_mutex_unlock(&output_lock);
+}
+
+static void root_complete_callback(struct dir_entry *dentry, void *user_data)
+{
+	(void)user_data;
+
+	if (!dentry->parent)
+		print_root(dentry);
+}
+
+/**
+** --merge and --load-snapshot. The snapshots are merged into --snapshot-out,
+** or into a temporary file that is shown like a loaded one
+**/
+static int show_snapshots(int paths_len, char **paths)
+{
+	const char *tmp_dir = getenv("TMPDIR");
+	char tmp_path[PATH_MAX];
+	int fd, ret;
+
+	if (load_snapshot_path)
+		return print_snapshot(load_snapshot_path);
+
+	if (paths_len < 1) {
+		printf("--merge needs the snapshot files to merge!\n");
+		return -1;
+	}
+
+	if (snapshot_out_path) {
+		if (snapshot_merge(snapshot_out_path, paths, paths_len) != 0)
+			return -1;
+
+		fprintf(info_fp, "Merged %d snapshots into %s\n", paths_len, snapshot_out_path);
+		return 0;
+	}
+
+	snprintf(tmp_path, sizeof(tmp_path), "%s/bdu-merge-XXXXXX", tmp_dir ? tmp_dir : "/tmp");
+	fd = mkstemp(tmp_path);
+
+	if (fd < 0) {
+		printf("Error creating temporary file \"%s\" (%s)\n", tmp_path, strerror(errno));
+		return -1;
+	}
+
+	close(fd);
+
+	ret = snapshot_merge(tmp_path, paths, paths_len);
+
+	if (ret == 0)
+		ret = print_snapshot(tmp_path);
+
+	unlink(tmp_path);
+
+	return ret;
+}
+
+/**
+** prints the trees of a snapshot like the ones of a scan. Only the 
+** levels down to --max-depth are read into memory
+**/
+static int print_snapshot(const char *path)
+{
+	struct snapshot_info info;
+	struct dir_entry **roots = NULL;
+	int roots_len = 0;
+
+	if (snapshot_load(path, max_depth, show_file_mtime, &info, &roots, &roots_len) != 0)
+		return -1;
+
+	// the age buckets are named after the command line, they have to be the same
+	if (num_age_limits && (info.num_age_limits != num_age_limits || 
+			memcmp(info.age_limits, age_limits, num_age_limits * sizeof(time_t)) != 0)) {
+		printf("The snapshot was not scanned with the same --age-buckets!\n");
+		dir_free_entries(roots, roots_len);
+		return -1;
+	}
+
+	if (info.estimated)
+		output_opts.estimate_z = estimate_get_z(confidence);
+
+	fprintf(info_fp, "-------------------------------------------\n");
+
+	if (open_output() != 0) {
+		dir_free_entries(roots, roots_len);
+		return -1;
+	}
+
+	dir_sort_entries(roots, roots_len, max_depth, 0, sort_flags);
+
+	for (int i=0;i<roots_len;i++)
+		print_root(roots[i]);
+
+	close_output();
+	dir_free_entries(roots, roots_len);
+
+	return 0;
+}
+
+static void close_output()
+{
+	// du -c style grand total, printed as one more entry
+	if (show_total) {
+		grand_total.path = "total";
+		grand_total.path_len = strlen(grand_total.path);
+		output_print_total(output_fp, &grand_total, roots_printed, output_format, output_opts);
+	}
+
+	// nothing is scanned when a snapshot is shown
+	if (scan) {
+		output_opts.breakdown = bdu_scan_get_breakdown(scan);
+		output_opts.errors = bdu_scan_get_errors(scan, &output_opts.errors_len, &output_opts.errors_total);
+	}
+
+	output_end(output_fp, output_format, output_opts);
+
+	if (output_fp != stdout)
+		fclose(output_fp);
+}
+
+/**
+** the errors of the scan on stderr like du, but the entries with the same 
+** error in the same directory on one line, and only the largest groups
+**/
+static void print_errors()
+{
+	size_t shown = 0;
+
+	for (int i=0;i<output_opts.errors_len && i<ERRORS_SHOWN_MAX;i++) {
+		struct err_group *group = &output_opts.errors[i];
+		const char *msg = "cannot access";
+
+		if (group->op == ERRLOG_OPENDIR)
+			msg = "cannot open directory";
+		else if (group->op == ERRLOG_READDIR)
+			msg = "cannot read directory";
+
+		if (group->count == 1)
+			fprintf(stderr, "bdu: %s '%s': %s\n", msg, group->path, strerror(group->err));
+		else 
+			fprintf(stderr, "bdu: %s '%s' and %zu more in '%s': %s\n", msg, group->path, 
+				group->count - 1, group->dir, strerror(group->err));
+
+		shown += group->count;
+	}
+
+	if (output_opts.errors_total > shown)
+		fprintf(stderr, "bdu: %zu more errors\n", output_opts.errors_total - shown);
+}
+
 static void print_help() 
 {
     printf("Usage: bdu [OPTIONS] [DIRECTORY...]\n");
     printf("Multithreaded disk usage analyzer inspired by the classic \"du\" command, written from scratch.\n\n");
     printf("Options:\n");
     printf("  -s, --summarize                     Display only the total size for each argument\n");
+    printf("  -c, --total                         Produce a grand total of all the arguments\n");
+    printf("  -L, --dereference                   Follow symbolic links, each directory is still counted only once\n");
     printf("  -d, --max-depth=N                   Limit depth of directory traversal\n");
-    printf("  -o, --output-format=FMT             Output format: \"text\", \"json\" or \"html\"\n");
-    printf("      --threads=N                     Number of threads to use\n");
+    printf("  -o, --output-format=FMT             Output format: \"text\", \"json\", \"html\", or \"ndjson\" and\n");
+    printf("                                         \"csv\" with one record per directory, \"folded\" stacks for flamegraph\n");
+    printf("                                         tools, or an \"svg\" flamegraph\n");
+    printf("      --threads=N                     Number of threads to use. With \"auto\" the number of scanning threads\n");
+    printf("                                         is adjusted to the best measured throughput of the storage\n");
+    printf("      --stats                         Show the scanned entries per second, the time spent on one entry\n");
+    printf("                                         and the number of workers\n");
     printf("      --time                          Show last file modification time\n");
 	printf("      --in-bytes                      Outputs the size of the entries in raw bytes instead of human readable\n");
 	printf("      --no-leading-tabs               Doesn`t add the additional tabs in front of each row to display tree-like output,\n");
 	printf("                                         instead it only shows the results as a simple list\n");
-	printf("      --sort-by=[FIELD]               The field sorting whould be done after - \"size\", \"name\" or \"date\"\n");
+	printf("      --apparent-size                 Show apparent sizes (st_size) instead of disk usage\n");
+	printf("      --inodes                        Show the number of inodes instead of disk usage\n");
+	printf("      --sort-by=[FIELD]               The field sorting whould be done after - \"size\", \"apparent\", \"inodes\",\n");
+	printf("                                         \"name\" or \"date\"\n");
 	printf("      --sort-order=[asc/desc]         Ascending or descending order\n");
+	printf("      --by-type[=total/tree]          Breakdown of the usage by file extension (or file type for non regular files).\n");
+	printf("                                         With \"tree\" the breakdown is shown for each displayed directory too\n");
+	printf("      --by-owner=[uid/gid]            Breakdown of the usage by owner user or group, for the whole scan\n");
+	printf("                                         and for each displayed directory\n");
+	printf("      --age-buckets=[LIST]            Shows the usage of each directory by file age, ex: --age-buckets=7d,30d,90d,1y\n");
+	printf("                                         together with the newest modification time below the directory\n");
+	printf("      --age-by=[mtime/atime]          The file time --age-buckets is computed from (default is mtime)\n");
+	printf("      --memory-limit=[VALUE][UNIT]    Above this size completed subtrees are moved to a temporary file\n");
+	printf("                                         and read back while printing, ex: --memory-limit=2G\n");
+	printf("      --threshold=[VALUE][UNIT]       Subdirectories smaller than this (apparent size with --apparent-size) are\n");
+	printf("                                         shown as one \"(other)\" entry of their parent, and freed during the scan\n");
+	printf("      --min-inodes=N                  The same for subdirectories with less than N inodes\n");
+	printf("      --deadline=[DURATION]           Stops scanning new directories after this time and prints what was\n");
+	printf("                                         collected so far, marking the partial directories, ex: --deadline=30s\n");
+	printf("      --estimate[=RATE]               Scans only a random sample (default 10%%) of the subdirectories below the\n");
+	printf("                                         displayed ones and extrapolates the totals, with error bounds\n");
+	printf("      --confidence=[PERCENT]          The confidence level of the --estimate error bounds (default 95). It only\n");
+	printf("                                         widens or narrows the reported bounds, the sample size is set by RATE\n");
+	printf("      --seed=N                        Seed of the --estimate sampling, the same seed gives the same sample\n");
+	printf("      --cpus=[LIST]                   Pins the workers to these CPUs, ex: --cpus=0-7,16-23\n");
+	printf("      --numa=[local/interleave]       Pins the workers node by node, and allocates memory from the worker`s\n");
+	printf("                                         own node (local) or spread over all nodes (interleave)\n");
+	printf("      --io-class=[CLASS]              I/O scheduling class of the workers: \"idle\" or \"best-effort[:0-7]\"\n");
+	printf("      --max-ops=[N/s]                 Limits the opendir and lstat calls of all the workers together,\n");
+	printf("                                         ex: --max-ops=2000/s\n");
+	printf("      --large-dir=N                   Files of directories with more than N files (default 10000) are\n");
+	printf("                                         lstat-ed in chunks of N by all the workers. 0 turns it off\n");
+	printf("      --prefetch=N                    Opens the next N queued directories per worker ahead, on helper threads,\n");
+	printf("                                         so the opendir and first readdir latency of network filesystems\n");
+	printf("                                         overlaps with the lstat calls (default 0, off)\n");
+	printf("      --dedupe-dirs                   Directories reachable on more paths (bind mounts) are counted only once,\n");
+	printf("                                         where they are found first\n");
+	printf("      --json-errors                   With --output-format=json, writes an object with the entries and the\n");
+	printf("                                         scan errors, {\"entries\": [...], \"errors\": {...}}. Plain json is\n");
+	printf("                                         an array of the entries, without the errors (those are on stderr)\n");
+	printf("      --lazy-html[=DEPTH]             With --output-format=html and --output-file, only the top DEPTH (default 2)\n");
+	printf("                                         levels are written into the page, the rest into script files in\n");
+	printf("                                         <output file>.d, loaded when a directory is opened. Shows a treemap too\n");
+	printf("      --checkpoint=[FILE]             Saves the state of the scan to FILE periodically and on Ctrl-C, an\n");
+	printf("                                         interrupted scan can be continued from it with --resume\n");
+	printf("      --checkpoint-interval=[DURATION] Time between two checkpoints (default 60s)\n");
+	printf("      --resume=[FILE]                 Continues the scan saved in FILE, the directories are taken from it\n");
+	printf("      --serve-metrics=[TARGET]        Rescans periodically and exports the directories down to --max-depth\n");
+	printf("                                         (default 2) as Prometheus metrics, on a unix socket (unix:PATH)\n");
+	printf("                                         or in a node_exporter textfile (textfile:PATH)\n");
+	printf("      --refresh-interval=[DURATION]   Time between two --serve-metrics scans (default 5m). Unmodified\n");
+	printf("                                         directories reuse the totals of the previous scan\n");
+	printf("      --snapshot-out=[FILE]           Saves the scanned tree to FILE, to be shown later with --load-snapshot or\n");
+	printf("                                         combined with other snapshots with --merge\n");
+	printf("      --load-snapshot=[FILE]          Shows the tree saved in FILE instead of scanning\n");
+	printf("      --merge                         The arguments are snapshot files, their trees are combined into one\n");
+	printf("                                         (summing up the same paths) and saved to --snapshot-out, or shown\n");
+	printf("      --synthetic=[SPEC]              Scans a generated tree instead of the filesystem, for benchmarking\n");
+	printf("                                         ex: --synthetic=depth=4,fanout=8,files=100,size=64K,latency=50\n");
 	printf("      --warn-at=[VALUE][UNIT]         If set and the size of the entry is greater than this value, the size will be printed in yellow\n");
 	printf("                                         ex: --warn-at=100M, warn-at=1G etc.\n");
 	printf("      --critical-at=[VALUE][UNIT]     If set and the size of the entry is greater than this value, the size will be printed in red\n");
@@ -0,0 +1,408 @@
+/* 
+ * Copyright (C) 2025 Zoltán Rácz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  
+ */
+
+/**
+** --serve-metrics: scans the roots again every interval, and exposes the 
+** totals of the directories down to max_depth in the Prometheus text format,
+** together with the counters of the scans. The target is either
+**
+**	unix:PATH      a unix socket answering every connection with an HTTP
+**	               response, ex. curl --unix-socket PATH http://localhost/metrics
+**	textfile:PATH  a file rewritten (atomically) after every refresh, for the 
+**	               textfile collector of node_exporter
+**
+** Every refresh reuses the previous scan for the directories not modified 
+** since then (bdu_scan_reuse), with a full scan every METRICS_FULL_SCAN_EVERY
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <linux/limits.h>
+
+#include "bdu.h"
+#include "metrics.h"
+
+#define METRICS_TARGET_UNIX 1
+#define METRICS_TARGET_TEXTFILE 2
+
+/**
+** the last rendered metrics, the server thread answers every
+** connection with a copy of them
+**/
+struct metrics_server {
+	int fd;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	char *body; // NULL until the first scan is done
+	size_t body_len;
+};
+
+/**
+** the counters of all the refreshes so far
+**/
+struct metrics_totals {
+	size_t scans;
+	size_t entries;
+	double seconds;
+};
+
+static int open_server(struct metrics_server *server, const char *path);
+static void *server_thread_fn(void *arg);
+static int write_textfile(const char *path, const char *body, size_t body_len);
+static void print_metrics(FILE *fp, struct bdu_scan *scan, int max_depth, const struct metrics_totals *totals);
+static void print_dir_metric(FILE *fp, struct dir_entry *dentry, const char *name, int max_depth);
+static void print_label_value(FILE *fp, const char *str);
+
+int metrics_serve(const char *target, const struct bdu_scan_options *opts, char **paths, int paths_len, 
+	time_t interval, int max_depth, volatile sig_atomic_t *stop)
+{
+	struct metrics_server server = {.fd = -1};
+	struct metrics_totals totals = {0};
+	struct bdu_scan *prev = NULL;
+	const char *path = strchr(target, ':');
+	int kind = 0;
+	int ret = 0;
+
+	if (path && strncmp(target, "unix:", 5) == 0)
+		kind = METRICS_TARGET_UNIX;
+	else if (path && strncmp(target, "textfile:", 9) == 0)
+		kind = METRICS_TARGET_TEXTFILE;
+
+	if (!kind || !path[1]) {
+		printf("Invalid metrics target \"%s\"! Should be unix:PATH or textfile:PATH.\n", target);
+		return -1;
+	}
+
+	path++;
+
+	if (max_depth < 0)
+		max_depth = METRICS_DEPTH_DEFAULT;
+
+	pthread_mutex_init(&server.lock, NULL);
+
+	if (kind == METRICS_TARGET_UNIX && open_server(&server, path) != 0)
+		return -1;
+
+	printf("Serving metrics on %s, refreshed every %ld seconds\n", target, (long)interval);
+	fflush(stdout);
+
+	while (!*stop) {
+		struct bdu_scan_options scan_opts = *opts;
+		struct bdu_scan *scan;
+		char *body = NULL;
+		size_t body_len = 0;
+		FILE *fp;
+
+		// ages are relative to the start of every refresh
+		scan_opts.dir.now = time(NULL);
+
+		scan = bdu_scan_new(&scan_opts);
+
+		if (!scan) {
+			ret = -1;
+			break;
+		}
+
+		for (int i=0;i<paths_len;i++)
+			bdu_scan_add_root(scan, paths[i]);
+
+		if (prev && totals.scans % METRICS_FULL_SCAN_EVERY != 0)
+			bdu_scan_reuse(scan, prev);
+
+		if (bdu_scan_run(scan) != 0) {
+			bdu_scan_free(scan);
+			ret = -1;
+			break;
+		}
+
+		// the previous scan is only needed until this one is done
+		bdu_scan_free(prev);
+		prev = scan;
+
+		struct bdu_scan_stats stats;
+
+		bdu_scan_get_stats(scan, &stats);
+
+		totals.scans++;
+		totals.entries += stats.entries;
+		totals.seconds += stats.elapsed;
+
+		fp = open_memstream(&body, &body_len);
+
+		if (!fp) {
+			printf("Error allocating memory for metrics!\n");
+			ret = -1;
+			break;
+		}
+
+		print_metrics(fp, scan, max_depth, &totals);
+		fclose(fp);
+
+		if (kind == METRICS_TARGET_TEXTFILE) {
+			write_textfile(path, body, body_len);
+			free(body);
+		}
+		else {
+			pthread_mutex_lock(&server.lock);
+			free(server.body);
+			server.body = body;
+			server.body_len = body_len;
+			pthread_mutex_unlock(&server.lock);
+		}
+
+		for (time_t slept = 0; slept < interval && !*stop; slept++)
+			sleep(1);
+	}
+
+	bdu_scan_free(prev);
+
+	if (server.fd >= 0) {
+		// wakes the server thread up from accept
+		shutdown(server.fd, SHUT_RDWR);
+		pthread_join(server.thread, NULL);
+		close(server.fd);
+		unlink(path);
+	}
+
+	free(server.body);
+	pthread_mutex_destroy(&server.lock);
+
+	return ret;
+}
+
+static int open_server(struct metrics_server *server, const char *path)
+{
+	struct sockaddr_un addr;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		printf("The socket path \"%s\" is too long!\n", path);
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	server->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	if (server->fd < 0) {
+		printf("Error creating metrics socket (%s)\n", strerror(errno));
+		return -1;
+	}
+
+	// the socket of a previous run that didn`t exit cleanly
+	unlink(path);
+
+	if (bind(server->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(server->fd, 16) != 0) {
+		printf("Error listening on \"%s\" (%s)\n", path, strerror(errno));
+		close(server->fd);
+		server->fd = -1;
+		return -1;
+	}
+
+	if (pthread_create(&server->thread, NULL, server_thread_fn, server) != 0) {
+		printf("Error starting the metrics server thread!\n");
+		close(server->fd);
+		server->fd = -1;
+		unlink(path);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+** answers the connections one by one. The request is not parsed, every
+** one gets the metrics (or 503 before the first scan is done)
+**/
+static void *server_thread_fn(void *arg)
+{
+	struct metrics_server *server = (struct metrics_server *)arg;
+	struct timeval timeout = {.tv_sec = 1};
+	char request[4096];
+	char header[256];
+
+	while (1) {
+		int fd = accept(server->fd, NULL, NULL);
+
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			break;
+		}
+
+		// a client that doesn`t send its request can`t hold the others up for long
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+		if (recv(fd, request, sizeof(request), 0) < 0) {
+			close(fd);
+			continue;
+		}
+
+		pthread_mutex_lock(&server->lock);
+
+		if (server->body) {
+			int len = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\n"
+				"Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+				"Content-Length: %zu\r\n\r\n", server->body_len);
+
+			if (send(fd, header, len, MSG_NOSIGNAL) == len)
+				send(fd, server->body, server->body_len, MSG_NOSIGNAL);
+		}
+		else {
+			const char *busy = "HTTP/1.0 503 Service Unavailable\r\nContent-Length: 0\r\n\r\n";
+
+			send(fd, busy, strlen(busy), MSG_NOSIGNAL);
+		}
+
+		pthread_mutex_unlock(&server->lock);
+
+		close(fd);
+	}
+
+	return NULL;
+}
+
+/**
+** the textfile collector may read the file any time, so it is 
+** written next to it and renamed over it
+**/
+static int write_textfile(const char *path, const char *body, size_t body_len)
+{
+	char tmp_path[PATH_MAX+4];
+	FILE *fp;
+	int ret = 0;
+
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+	fp = fopen(tmp_path, "w");
+
+	if (!fp) {
+		printf("Error creating metrics file \"%s\" (%s)\n", tmp_path, strerror(errno));
+		return -1;
+	}
+
+	if (fwrite(body, 1, body_len, fp) != body_len)
+		ret = -1;
+
+	if (fclose(fp) != 0)
+		ret = -1;
+
+	if (ret == 0 && rename(tmp_path, path) != 0)
+		ret = -1;
+
+	if (ret != 0) {
+		printf("Error writing metrics file \"%s\" (%s)\n", path, strerror(errno));
+		unlink(tmp_path);
+	}
+
+	return ret;
+}
+
+static void print_metrics(FILE *fp, struct bdu_scan *scan, int max_depth, const struct metrics_totals *totals)
+{
+	static const char *dir_metrics[][2] = {
+		{"bdu_directory_size_bytes", "Disk usage of the directory and everything below it."},
+		{"bdu_directory_apparent_size_bytes", "Apparent size (st_size) of the directory and everything below it."},
+		{"bdu_directory_inodes", "Inodes in the directory and everything below it, including itself."},
+	};
+	struct bdu_scan_stats stats;
+	struct dir_entry **roots;
+	int roots_len = 0;
+	int errors_len = 0;
+	size_t errors = 0;
+
+	roots = bdu_scan_get_roots(scan, &roots_len);
+	bdu_scan_get_stats(scan, &stats);
+	bdu_scan_get_errors(scan, &errors_len, &errors);
+
+	// all the samples of a metric have to be together
+	for (int i=0;i<3;i++) {
+		fprintf(fp, "# HELP %s %s\n", dir_metrics[i][0], dir_metrics[i][1]);
+		fprintf(fp, "# TYPE %s gauge\n", dir_metrics[i][0]);
+
+		for (int j=0;j<roots_len;j++)
+			print_dir_metric(fp, roots[j], dir_metrics[i][0], max_depth);
+	}
+
+	fprintf(fp, "# HELP bdu_scan_duration_seconds Time the last refresh took.\n");
+	fprintf(fp, "# TYPE bdu_scan_duration_seconds gauge\n");
+	fprintf(fp, "bdu_scan_duration_seconds %.3f\n", stats.elapsed);
+	fprintf(fp, "# HELP bdu_scan_entries Directories and files looked at by the last refresh.\n");
+	fprintf(fp, "# TYPE bdu_scan_entries gauge\n");
+	fprintf(fp, "bdu_scan_entries %zu\n", stats.entries);
+	fprintf(fp, "# HELP bdu_scan_entries_per_second Throughput of the last refresh.\n");
+	fprintf(fp, "# TYPE bdu_scan_entries_per_second gauge\n");
+	fprintf(fp, "bdu_scan_entries_per_second %.0f\n", stats.elapsed > 0 ? stats.entries / stats.elapsed : 0);
+	fprintf(fp, "# HELP bdu_scan_reused_directories Directories of the last refresh counted from the previous one, unmodified.\n");
+	fprintf(fp, "# TYPE bdu_scan_reused_directories gauge\n");
+	fprintf(fp, "bdu_scan_reused_directories %zu\n", stats.reused);
+	fprintf(fp, "# HELP bdu_scan_errors Entries the last refresh failed to read.\n");
+	fprintf(fp, "# TYPE bdu_scan_errors gauge\n");
+	fprintf(fp, "bdu_scan_errors %zu\n", errors);
+	fprintf(fp, "# HELP bdu_scan_last_timestamp_seconds When the last refresh finished.\n");
+	fprintf(fp, "# TYPE bdu_scan_last_timestamp_seconds gauge\n");
+	fprintf(fp, "bdu_scan_last_timestamp_seconds %ld\n", (long)time(NULL));
+	fprintf(fp, "# HELP bdu_scans_total Refreshes done since the start.\n");
+	fprintf(fp, "# TYPE bdu_scans_total counter\n");
+	fprintf(fp, "bdu_scans_total %zu\n", totals->scans);
+	fprintf(fp, "# HELP bdu_scan_entries_total Directories and files looked at since the start.\n");
+	fprintf(fp, "# TYPE bdu_scan_entries_total counter\n");
+	fprintf(fp, "bdu_scan_entries_total %zu\n", totals->entries);
+	fprintf(fp, "# HELP bdu_scan_seconds_total Time spent scanning since the start.\n");
+	fprintf(fp, "# TYPE bdu_scan_seconds_total counter\n");
+	fprintf(fp, "bdu_scan_seconds_total %.3f\n", totals->seconds);
+}
+
+static void print_dir_metric(FILE *fp, struct dir_entry *dentry, const char *name, int max_depth)
+{
+	size_t value = dentry->totals.bytes;
+
+	if (strcmp(name, "bdu_directory_apparent_size_bytes") == 0)
+		value = dentry->totals.apparent_bytes;
+	else if (strcmp(name, "bdu_directory_inodes") == 0)
+		value = dentry->totals.inodes;
+
+	fprintf(fp, "%s{path=\"", name);
+	print_label_value(fp, dentry->path);
+	fprintf(fp, "\"} %zu\n", value);
+
+	if (dentry->depth >= max_depth)
+		return;
+
+	for (int i=0;i<dentry->children_len;i++)
+		print_dir_metric(fp, dentry->children[i], name, max_depth);
+}
+
+// backslash, double quote and newline are escaped in label values
+static void print_label_value(FILE *fp, const char *str)
+{
+	for (; *str; str++) {
+		if (*str == '\\' || *str == '"')
+			fprintf(fp, "\\%c", *str);
+		else if (*str == '\n')
+			fprintf(fp, "\\n");
+		else 
+			fputc(*str, fp);
+	}
+}
@@ -0,0 +1,33 @@
+/* 
+ * Copyright (C) 2025 Zoltán Rácz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  
+ */
+
+#include <signal.h>
+
+#include "bdu.h"
+
+#ifndef METRICS_H
+#define METRICS_H
+
+// --serve-metrics without --max-depth, the levels exported below the roots
+#define METRICS_DEPTH_DEFAULT 2
+
+// every this many refreshes all the files are lstat-ed again, see bdu_scan_reuse
+#define METRICS_FULL_SCAN_EVERY 12
+
+int metrics_serve(const char *target, const struct bdu_scan_options *opts, char **paths, int paths_len, 
+	time_t interval, int max_depth, volatile sig_atomic_t *stop);
+
+#endif //METRICS_H
@@ -0,0 +1,303 @@
+/* 
+ * Copyright (C) 2025 Zoltán Rácz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  
+ */
+
+#define _GNU_SOURCE // pthread_setaffinity_np
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "numa.h"
+
+/**
+** set_mempolicy modes, from linux/mempolicy.h. Called through syscall(), 
+** so bdu doesn`t depend on libnuma
+**/
+#define MPOL_INTERLEAVE_MODE 3
+#define MPOL_LOCAL_MODE 4
+
+#define NUMA_MASK_WORDS 16 // up to 1024 nodes
+
+static int read_node_cpus(struct numa_topology *topo, int node, const char *path);
+
+/**
+** reads which CPUs belong to which node. Machines without NUMA 
+** (or without the sysfs directory) have a single node 0
+**/
+struct numa_topology *numa_get_topology()
+{
+	struct numa_topology *topo = (struct numa_topology *)calloc(1, sizeof(struct numa_topology));
+	char path[512];
+	struct dirent *entry;
+	DIR *dir;
+
+	if (!topo) {
+		printf("Error allocating memory for NUMA topology!\n");
+		return NULL;
+	}
+
+	dir = opendir(NUMA_SYSFS_PATH);
+
+	if (dir) {
+		while ((entry = readdir(dir)) != NULL) {
+			int node;
+
+			if (strncmp(entry->d_name, "node", 4) != 0 || sscanf(entry->d_name + 4, "%d", &node) != 1)
+				continue;
+
+			snprintf(path, sizeof(path), "%s/%s/cpulist", NUMA_SYSFS_PATH, entry->d_name);
+
+			if (read_node_cpus(topo, node, path) != 0) {
+				closedir(dir);
+				numa_free_topology(topo);
+				return NULL;
+			}
+		}
+
+		closedir(dir);
+	}
+
+	if (topo->num_nodes == 0) {
+		long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+		topo->num_nodes = 1;
+		topo->num_cpus = num_cpus > 0 ? num_cpus : 1;
+		topo->cpu_node = calloc(topo->num_cpus, sizeof(int));
+
+		if (!topo->cpu_node) {
+			printf("Error allocating memory for NUMA topology!\n");
+			free(topo);
+			return NULL;
+		}
+	}
+
+	return topo;
+}
+
+void numa_free_topology(struct numa_topology *topo)
+{
+	if (!topo)
+		return;
+
+	free(topo->cpu_node);
+	free(topo);
+}
+
+int numa_get_cpu_node(const struct numa_topology *topo, int cpu)
+{
+	if (cpu < 0 || cpu >= topo->num_cpus || topo->cpu_node[cpu] < 0)
+		return 0;
+
+	return topo->cpu_node[cpu];
+}
+
+/**
+** all the online CPUs, ordered by node, so assigning them to the workers 
+** in order fills one node before moving on to the next
+**/
+int numa_get_node_cpus(const struct numa_topology *topo, int **cpus)
+{
+	int cpus_len = 0;
+
+	*cpus = malloc(topo->num_cpus * sizeof(int));
+
+	if (!*cpus) {
+		printf("Error allocating memory for CPU list!\n");
+		return -1;
+	}
+
+	for (int node = 0; node < topo->num_nodes; node++) {
+		for (int cpu = 0; cpu < topo->num_cpus; cpu++) {
+			if (topo->cpu_node[cpu] == node)
+				(*cpus)[cpus_len++] = cpu;
+		}
+	}
+
+	return cpus_len;
+}
+
+/**
+** parses CPU lists like 0-3,8,10-11 (the format of taskset and sysfs).
+** Returns the number of CPUs, or -1 if the list is invalid
+**/
+int numa_parse_cpu_list(const char *list, int **cpus)
+{
+	const char *p = list;
+	int cpus_len = 0;
+
+	*cpus = NULL;
+
+	while (*p) {
+		int first, last, n = 0;
+		int *tmp;
+
+		if (sscanf(p, "%d-%d%n", &first, &last, &n) != 2) {
+			if (sscanf(p, "%d%n", &first, &n) != 1)
+				goto err;
+
+			last = first;
+		}
+
+		if (first < 0 || last < first)
+			goto err;
+
+		tmp = realloc(*cpus, (cpus_len + last - first + 1) * sizeof(int));
+
+		if (!tmp)
+			goto err;
+
+		*cpus = tmp;
+
+		for (int cpu = first; cpu <= last; cpu++)
+			(*cpus)[cpus_len++] = cpu;
+
+		p += n;
+
+		if (*p == ',')
+			p++;
+		else if (*p != '\0' && *p != '\n')
+			goto err;
+		else 
+			break;
+	}
+
+	if (cpus_len == 0)
+		goto err;
+
+	return cpus_len;
+
+err:
+	free(*cpus);
+	*cpus = NULL;
+	return -1;
+}
+
+/**
+** pins the calling thread to a single CPU
+**/
+int numa_pin_thread(int cpu)
+{
+	cpu_set_t set;
+	int ret;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+
+	ret = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set);
+
+	if (ret != 0) {
+		printf("Error pinning worker to CPU %d (%s)\n", cpu, strerror(ret));
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+** sets the memory policy of the calling thread. With NUMA_INTERLEAVE the 
+** pages are spread over the nodes of the given CPUs (all nodes if NULL)
+**/
+int numa_set_mempolicy(int mode, const struct numa_topology *topo, const int *cpus, int cpus_len)
+{
+	unsigned long mask[NUMA_MASK_WORDS] = {0};
+	long ret;
+
+	if (mode == NUMA_NONE || topo->num_nodes < 2)
+		return 0;
+
+	if (mode == NUMA_LOCAL)
+		ret = syscall(SYS_set_mempolicy, MPOL_LOCAL_MODE, NULL, 0);
+	else {
+		for (int node = 0; node < topo->num_nodes && node < NUMA_MASK_WORDS * 64; node++) {
+			int used = cpus == NULL;
+
+			for (int i = 0; i < cpus_len && !used; i++)
+				used = numa_get_cpu_node(topo, cpus[i]) == node;
+
+			if (used)
+				mask[node / 64] |= 1UL << (node % 64);
+		}
+
+		ret = syscall(SYS_set_mempolicy, MPOL_INTERLEAVE_MODE, mask, NUMA_MASK_WORDS * 64);
+	}
+
+	if (ret != 0) {
+		printf("Error setting NUMA memory policy (%s)\n", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+** cpulist files contain ranges like 0-15,32-47
+**/
+static int read_node_cpus(struct numa_topology *topo, int node, const char *path)
+{
+	char buf[4096];
+	int *cpus = NULL;
+	int cpus_len;
+	FILE *fp = fopen(path, "r");
+
+	if (!fp)
+		return 0;
+
+	if (!fgets(buf, sizeof(buf), fp)) {
+		// nodes without CPUs (memory only) have an empty list
+		fclose(fp);
+		return 0;
+	}
+
+	fclose(fp);
+
+	cpus_len = numa_parse_cpu_list(buf, &cpus);
+
+	if (cpus_len <= 0)
+		return 0;
+
+	for (int i = 0; i < cpus_len; i++) {
+		if (cpus[i] >= topo->num_cpus) {
+			int *tmp = realloc(topo->cpu_node, (cpus[i] + 1) * sizeof(int));
+
+			if (!tmp) {
+				printf("Error allocating memory for NUMA topology!\n");
+				free(cpus);
+				return -1;
+			}
+
+			for (int cpu = topo->num_cpus; cpu <= cpus[i]; cpu++)
+				tmp[cpu] = -1;
+
+			topo->cpu_node = tmp;
+			topo->num_cpus = cpus[i] + 1;
+		}
+
+		topo->cpu_node[cpus[i]] = node;
+	}
+
+	if (node + 1 > topo->num_nodes)
+		topo->num_nodes = node + 1;
+
+	free(cpus);
+
+	return 0;
+}
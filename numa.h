@@ -0,0 +1,45 @@
+/* 
+ * Copyright (C) 2025 Zoltán Rácz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  
+ */
+
+#ifndef NUMA_H
+#define NUMA_H
+
+// --numa memory policies of the workers
+#define NUMA_NONE 0
+#define NUMA_LOCAL 1 // allocate from the node the worker runs on
+#define NUMA_INTERLEAVE 2 // spread the allocations over the nodes of the workers
+
+// where the CPUs of the NUMA nodes are listed, can be changed to simulate topologies
+#ifndef NUMA_SYSFS_PATH
+#define NUMA_SYSFS_PATH "/sys/devices/system/node"
+#endif
+
+struct numa_topology {
+	int *cpu_node; // node of each CPU, -1 if it is not online
+	int num_cpus; // length of cpu_node (highest CPU id + 1)
+	int num_nodes; // highest node id + 1
+};
+
+struct numa_topology *numa_get_topology();
+void numa_free_topology(struct numa_topology *topo);
+int numa_get_cpu_node(const struct numa_topology *topo, int cpu);
+int numa_get_node_cpus(const struct numa_topology *topo, int **cpus);
+
+int numa_parse_cpu_list(const char *list, int **cpus);
+int numa_pin_thread(int cpu);
+int numa_set_mempolicy(int mode, const struct numa_topology *topo, const int *cpus, int cpus_len);
+
+#endif //NUMA_H
@@ -15,169 +15,1425 @@
  */
  
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <pwd.h>
+#include <grp.h>
+#include <limits.h>
+#include <linux/limits.h>
 
 #include "dir.h"
+#include "agg.h"
+#include "spill.h"
+#include "estimate.h"
 #include "output.h"
 
+// max. number of types listed under each directory in text and html output
+#define BREAKDOWN_DIR_TOP 10
+
+static unsigned int items_sort_metric;
+
+/**
+** a chunk file of --lazy-html holds at most this many directories below 
+** its directory (at least one level of them). Most subtrees below the 
+** page are one file each, only the large ones are split
+**/
+#define LAZY_HTML_CHUNK_NODES 5000
+
+// the id of the last ndjson / csv record, 0 = none yet (roots have parent 0)
+static size_t flat_record_id;
+
+// the entry printed is the -c grand total, not a directory (see output_print_total)
+static int printing_total;
+
+// the id of the last --lazy-html chunk file written, 0 = none yet
+static int lazy_chunk_id;
+
+// svg flamegraph geometry, in pixels
+#define FLAME_WIDTH 1200
+#define FLAME_PADDING 10
+#define FLAME_TITLE_HEIGHT 30
+#define FLAME_FRAME_HEIGHT 16
+#define FLAME_CHAR_WIDTH 7 // about, with the 12px font of the labels
+
+/**
+** frames narrower than this are not drawn, together with their subtrees. 
+** It keeps the svg of a tree with millions of directories small: at most
+** about width / FLAME_MIN_WIDTH frames are drawn on any level
+**/
+#define FLAME_MIN_WIDTH 0.1
+
+/**
+** folded stacks: the names of the directories above the one printed. They
+** point into the paths of the dentries, which stay loaded while their
+** subtree is printed, so no path string is built for the lines
+**/
+struct flame_frame {
+	const char *name;
+	int len;
+};
+
+static struct flame_frame *flame_stack = NULL;
+static int flame_stack_size = 0;
+
+// svg: the roots are drawn at the end, when the width of all of them is known
+static struct dir_entry **flame_roots = NULL;
+static int flame_roots_len = 0;
+
+/**
+** the page of --lazy-html. The tree is rendered from the nodes the roots
+** add, [name, size, apparent size, inodes, children], where children is 
+** a list of nodes, 0 if there are none, or the id of the chunk file holding
+** them. Chunk files are scripts (calling bdu.chunk), so they can be loaded
+** from the disk without a server, where fetch() is not allowed
+**/
+static const char lazy_html_script[] =
+	"var bdu = {\n"
+	"	roots: [], waiting: {},\n"
+	"	add: function(n) { this.roots.push(n); },\n"
+	"	// called by the chunk files, n[4] is the chunk id until then\n"
+	"	chunk: function(id, kids) {\n"
+	"		var w = this.waiting[id];\n"
+	"		delete this.waiting[id];\n"
+	"		w.node[4] = kids;\n"
+	"		w.done();\n"
+	"	},\n"
+	"	kids: function(n, done) {\n"
+	"		if (typeof n[4] != \"number\" || n[4] == 0) { done(); return; }\n"
+	"		if (this.waiting[n[4]]) return;\n"
+	"		this.waiting[n[4]] = {node: n, done: done};\n"
+	"		var s = document.createElement(\"script\");\n"
+	"		s.src = this.dir + \"c\" + n[4] + \".js\";\n"
+	"		document.head.appendChild(s);\n"
+	"	},\n"
+	"	value: function(n) { return n[1 + this.metric]; },\n"
+	"	text: function(n) {\n"
+	"		var v = this.value(n), u = [\"B\", \"K\", \"M\", \"G\", \"T\", \"P\"], i = 0;\n"
+	"		if (this.metric == 2 || !this.human) return \"\" + v;\n"
+	"		while (v >= 1024 && i < u.length - 1) { v /= 1024; i++; }\n"
+	"		return v.toFixed(2) + u[i];\n"
+	"	},\n"
+	"	// --warn-at and --critical-at are sizes, with --inodes too\n"
+	"	color: function(n) {\n"
+	"		var v = n[this.metric == 1 ? 2 : 1];\n"
+	"		if (this.crit > 0 && v >= this.crit) return \"red\";\n"
+	"		if (this.warn > 0 && v >= this.warn) return \"yellow\";\n"
+	"		return this.crit > 0 || this.warn > 0 ? \"green\" : \"\";\n"
+	"	},\n"
+	"	item: function(n, path) {\n"
+	"		var li = document.createElement(\"li\"), t = document.createElement(\"span\");\n"
+	"		var s = document.createElement(\"span\"), a = document.createElement(\"a\");\n"
+	"		t.className = \"toggle\";\n"
+	"		t.textContent = n[4] ? \"\\u25b8\" : \" \";\n"
+	"		s.className = \"size \" + this.color(n);\n"
+	"		s.textContent = this.text(n);\n"
+	"		a.href = \"#\";\n"
+	"		a.textContent = n[0];\n"
+	"		t.onclick = function() {\n"
+	"			if (li.lastChild.tagName == \"UL\") { li.removeChild(li.lastChild); t.textContent = \"\\u25b8\"; return; }\n"
+	"			bdu.kids(n, function() { li.appendChild(bdu.list(n[4] || [], path.concat([n]))); t.textContent = \"\\u25be\"; });\n"
+	"		};\n"
+	"		a.onclick = function(e) { e.preventDefault(); bdu.show(n, path); };\n"
+	"		li.append(t, s, a);\n"
+	"		return li;\n"
+	"	},\n"
+	"	list: function(nodes, path) {\n"
+	"		var ul = document.createElement(\"ul\");\n"
+	"		nodes.forEach(function(n) { ul.appendChild(bdu.item(n, path)); });\n"
+	"		return ul;\n"
+	"	},\n"
+	"	// squarified treemap of the children of n\n"
+	"	show: function(n, path) {\n"
+	"		bdu.kids(n, function() {\n"
+	"			var map = document.getElementById(\"map\"), crumbs = document.getElementById(\"crumbs\");\n"
+	"			var w = map.clientWidth, h = map.clientHeight, all = path.concat([n]);\n"
+	"			var kids = (n[4] || []).filter(function(k) { return bdu.value(k) > 0; });\n"
+	"			var total = kids.reduce(function(s, k) { return s + bdu.value(k); }, 0), x = 0, y = 0, i = 0;\n"
+	"			var scale = w * h / total; // from value to area\n"
+	"			map.innerHTML = \"\";\n"
+	"			crumbs.innerHTML = \"\";\n"
+	"			all.forEach(function(p, j) {\n"
+	"				var a = document.createElement(\"a\");\n"
+	"				a.href = \"#\";\n"
+	"				a.textContent = (j ? \" / \" : \"\") + p[0];\n"
+	"				a.onclick = function(e) { e.preventDefault(); bdu.show(p, all.slice(0, j)); };\n"
+	"				crumbs.appendChild(a);\n"
+	"			});\n"
+	"			kids.sort(function(a, b) { return bdu.value(b) - bdu.value(a); });\n"
+	"			while (i < kids.length) {\n"
+	"				var side = Math.min(w, h), row = [], sum = 0, best = Infinity;\n"
+	"				while (i < kids.length) {\n"
+	"					var area = bdu.value(kids[i]) * scale, s = sum + area;\n"
+	"					var max = row.length ? bdu.value(row[0]) * scale : area;\n"
+	"					var worst = Math.max(side * side * max / (s * s), s * s / (side * side * area));\n"
+	"					if (worst > best) break;\n"
+	"					best = worst; row.push(kids[i]); sum = s; i++;\n"
+	"				}\n"
+	"				var thick = sum / side, off = 0;\n"
+	"				row.forEach(function(k) {\n"
+	"					var len = bdu.value(k) * scale / thick, d = document.createElement(\"div\");\n"
+	"					d.className = \"cell\";\n"
+	"					d.title = k[0] + \" \" + bdu.text(k);\n"
+	"					d.textContent = k[0];\n"
+	"					d.style.cssText = w >= h ? \"left:\" + x + \"px;top:\" + (y + off) + \"px;width:\" + thick + \"px;height:\" + len + \"px\"\n"
+	"						: \"left:\" + (x + off) + \"px;top:\" + y + \"px;width:\" + len + \"px;height:\" + thick + \"px\";\n"
+	"					d.style.background = \"hsl(\" + (bdu.value(k) * 37 % 360) + \",45%,35%)\";\n"
+	"					if (k[4]) d.onclick = function() { bdu.show(k, all); };\n"
+	"					map.appendChild(d);\n"
+	"					off += len;\n"
+	"				});\n"
+	"				if (w >= h) { x += thick; w -= thick; } else { y += thick; h -= thick; }\n"
+	"			}\n"
+	"		});\n"
+	"	},\n"
+	"	start: function() {\n"
+	"		document.getElementById(\"tree\").appendChild(this.list(this.roots, []));\n"
+	"		if (this.roots.length) this.show(this.roots[0], []);\n"
+	"	}\n"
+	"};\n";
+
+
+/**
+** user and group names, resolved only once per id
+**/
+struct owner_name {
+	int kind;
+	long id;
+	char *name;
+};
+
+static struct owner_name *owner_names = NULL;
+static int owner_names_len = 0;
+
 static void print_size(FILE *fp, long int bytes, int human_readable, int leading_spaces);
+static void print_metric(FILE *fp, struct dir_entry *head, struct output_options options, int leading_spaces);
+static void print_metric_error(FILE *fp, struct dir_entry *head, struct output_options options);
+static size_t get_metric(struct dir_entry *head, struct output_options options);
+static size_t get_size(struct dir_entry *head, struct output_options options);
+static size_t get_totals_metric(const struct dir_totals *totals, unsigned int metric);
+static struct agg_item **get_sorted_items(struct agg_table *table, int kind, struct output_options options, int *items_len);
+static int sort_items_cb(const void *a, const void *b);
+
+static void print_json_breakdown(FILE *fp, struct agg_table *table, int kind, struct output_options options);
+static void print_json_errors(FILE *fp, struct output_options options);
+static void print_text_breakdown(FILE *fp, struct agg_table *table, int kind, struct output_options options, int depth, int limit);
+static void print_html_breakdown(FILE *fp, struct agg_table *table, int kind, struct output_options options, int limit);
+static const char *get_item_name(struct agg_item *item);
+static const char *get_owner_name(int kind, long id);
+static void free_owner_names();
+
+static int load_children(struct dir_entry *head, struct output_options options);
+static void unload_children(struct dir_entry *head, struct output_options options);
+
+static void print_age_label(FILE *fp, struct output_options options, int bucket);
+static void print_json_ages(FILE *fp, struct dir_entry *head, struct output_options options);
+static void print_text_ages(FILE *fp, struct dir_entry *head, struct output_options options, int depth);
+
+// json
+static void print_json(FILE *fp, struct dir_entry **entries, int entries_len, struct output_options options, int depth);
+static void print_json_entry(FILE *fp, struct dir_entry *head, struct output_options options, int depth);
+
+// ndjson and csv
+static void print_csv_header(FILE *fp, struct output_options options);
+static void print_flat_entry(FILE *fp, struct dir_entry *head, struct output_options options, int depth, size_t parent_id, int csv);
+static void print_csv_string(FILE *fp, const char *str);
+static void print_json_string(FILE *fp, const char *str);
+
+// folded stacks and svg flamegraph
+static const char *get_flame_name(struct dir_entry *head, struct dir_entry *parent, int *len);
+static size_t get_own_metric(struct dir_entry *head, struct output_options options, int children_shown);
+static void print_folded_entry(FILE *fp, struct dir_entry *head, struct dir_entry *parent, struct output_options options, int depth);
+static void print_folded_name(FILE *fp, const char *name, int len);
+static void print_svg(FILE *fp, struct output_options options);
+static int get_svg_levels(struct dir_entry *head, struct output_options options, int depth, double scale);
+static void print_svg_frame(FILE *fp, struct dir_entry *head, struct dir_entry *parent, struct output_options options, int depth, double x, double scale, int bottom);
+static void print_svg_value(FILE *fp, size_t value, struct output_options options);
+static void print_xml_string(FILE *fp, const char *str, int len);
+
+// plain text
+void print_plain_text(FILE *fp, struct dir_entry **entries, int entries_len, struct output_options options, int depth);
+
+// html
+static void print_html_entries(FILE *fp, struct dir_entry **entries, int entries_len, struct output_options options, int depth);
+static void print_html_entry(FILE *fp, struct dir_entry *head, struct output_options options, int depth);
+static void print_lazy_html_begin(FILE *fp, struct output_options options);
+static void print_lazy_node(FILE *fp, struct dir_entry *head, struct output_options options, int depth, int levels);
+static int write_lazy_chunk(struct dir_entry *head, struct output_options options, int depth);
+static int get_lazy_chunk_levels(struct dir_entry *head, struct output_options options, int depth);
+static int count_lazy_nodes(struct dir_entry *head, struct output_options options, int depth, int levels, int limit);
+static void print_js_string(FILE *fp, const char *str);
+
+
+void output_print(FILE *fp, struct dir_entry **entries, int entries_len, const char *format, struct output_options options)
+{
+	output_begin(fp, format, options);
+
+	for (int i=0;i<entries_len;i++)
+		output_print_entry(fp, entries[i], i, format, options);
+
+	output_end(fp, format, options);
+}
+
+/**
+** the output can be printed in parts too, to print each root as soon as 
+** it is scanned: output_begin, output_print_entry for every root (index 
+** counts from 0), then output_end
+**/
+void output_begin(FILE *fp, const char *format, struct output_options options)
+{
+	if (strcmp(format, "json") == 0) {
+		/**
+		** the breakdown and the errors of the whole scan don`t belong to 
+		** any of the entries, so with those the entries array is wrapped 
+		** into an object. The errors are only written into it, plain json 
+		** stays an array
+		**/
+		if (options.by_type || options.by_owner || options.json_errors)
+			fprintf(fp, "{\"entries\":");
+
+		fprintf(fp, "[");
+	}
+	else if (strcmp(format, "ndjson") == 0 || strcmp(format, "csv") == 0) {
+		flat_record_id = 0;
+
+		if (strcmp(format, "csv") == 0)
+			print_csv_header(fp, options);
+	}
+	else if (strcmp(format, "svg") == 0)
+		flame_roots_len = 0;
+	else if (strcmp(format, "html") == 0 && options.lazy_depth > 0)
+		print_lazy_html_begin(fp, options);
+	else if (strcmp(format, "html") == 0) {
+		fprintf(fp, "<!DOCTYPE html>\n<html lang=\"en\">\n");
+		fprintf(fp, "<head><meta charset=\"UTF-8\"><title>Disk Usage Report</title><style>body {font-family: monospace; background: #1e1e1e; color: #dcdcdc; padding: 20px;} ul {list-style-type: none; padding-left: 20px;} li {margin: 4px 0;} .size {display: inline-block; width: 80px; font-weight: bold;} .date {display: inline-block; width: 185px; } .red {color: #ff5c5c;} .orange {color: #ffa500;} .yellow {color: #ffd700;} .green {color: #7fff00;} .types, .ages {color: #8a8a8a;} .partial {color: #ffa500;}</style></head>\n");
+		fprintf(fp, "<body>");
+		fprintf(fp, "<h1>Disk Usage Report</h1>");
+		fprintf(fp, "<ul>");
+	}
+	else if (strcmp(format, "text") != 0 && strcmp(format, "folded") != 0)
+		fprintf(fp, "Invalid output format!\n");
+}
+
+void output_print_entry(FILE *fp, struct dir_entry *entry, int index, const char *format, struct output_options options)
+{
+	if (strcmp(format, "json") == 0) {
+		if (index > 0)
+			fprintf(fp, ",");
+
+		print_json_entry(fp, entry, options, 0);
+	}
+	else if (strcmp(format, "ndjson") == 0)
+		print_flat_entry(fp, entry, options, 0, 0, 0);
+	else if (strcmp(format, "csv") == 0)
+		print_flat_entry(fp, entry, options, 0, 0, 1);
+	else if (strcmp(format, "text") == 0)
+		print_plain_text(fp, &entry, 1, options, 0);
+	else if (strcmp(format, "folded") == 0)
+		print_folded_entry(fp, entry, NULL, options, 0);
+	else if (strcmp(format, "svg") == 0) {
+		struct dir_entry **roots = realloc(flame_roots, (flame_roots_len + 1) * sizeof(struct dir_entry *));
+
+		if (!roots) {
+			printf("Error allocating memory for the flamegraph roots\n");
+			return;
+		}
+
+		flame_roots = roots;
+		flame_roots[flame_roots_len++] = entry;
+	}
+	else if (strcmp(format, "html") == 0 && options.lazy_depth > 0) {
+		fprintf(fp, "<script>bdu.add([");
+		print_lazy_node(fp, entry, options, 0, options.lazy_depth);
+		fprintf(fp, "]);</script>\n");
+	}
+	else if (strcmp(format, "html") == 0)
+		print_html_entry(fp, entry, options, 0);
+
+	fflush(fp);
+}
+
+/**
+** the -c grand total, after the roots. In json, ndjson and csv it is 
+** marked with total: true instead of a path, so it can`t be mistaken 
+** for a directory. Flamegraphs sum up the roots themselves, they don`t 
+** show it
+**/
+void output_print_total(FILE *fp, struct dir_entry *total, int index, const char *format, struct output_options options)
+{
+	if (strcmp(format, "folded") == 0 || strcmp(format, "svg") == 0)
+		return;
+
+	printing_total = 1;
+	output_print_entry(fp, total, index, format, options);
+	printing_total = 0;
+}
+
+void output_end(FILE *fp, const char *format, struct output_options options)
+{
+	int owner_kind = options.by_owner == BY_OWNER_GID ? AGG_KIND_GID : AGG_KIND_UID;
+
+	if (strcmp(format, "json") == 0) {
+		fprintf(fp, "]");
+
+		if (options.by_type || options.by_owner || options.json_errors) {
+			if (options.by_type && options.breakdown) {
+				fprintf(fp, ",\"types\":");
+				print_json_breakdown(fp, options.breakdown, AGG_KIND_TYPE, options);
+			}
+
+			if (options.by_owner && options.breakdown) {
+				fprintf(fp, ",\"owners\":");
+				print_json_breakdown(fp, options.breakdown, owner_kind, options);
+			}
+
+			print_json_errors(fp, options);
+
+			fprintf(fp, "}");
+		}
+
+		fprintf(fp, "\n");
+	}
+	else if (strcmp(format, "text") == 0) {
+		if (options.by_type && options.breakdown) {
+			fprintf(fp, "\nUsage by type:\n");
+			print_text_breakdown(fp, options.breakdown, AGG_KIND_TYPE, options, 0, -1);
+		}
+
+		if (options.by_owner && options.breakdown) {
+			fprintf(fp, "\nUsage by %s:\n", owner_kind == AGG_KIND_GID ? "group" : "user");
+			print_text_breakdown(fp, options.breakdown, owner_kind, options, 0, -1);
+		}
+	}
+	else if (strcmp(format, "svg") == 0) {
+		print_svg(fp, options);
+
+		free(flame_roots);
+		flame_roots = NULL;
+		flame_roots_len = 0;
+	}
+	else if (strcmp(format, "html") == 0 && options.lazy_depth > 0) {
+		fprintf(fp, "<script>bdu.start();</script>\n");
+		fprintf(fp, "</body>\n");
+		fprintf(fp, "</html>\n");
+	}
+	else if (strcmp(format, "html") == 0) {
+		fprintf(fp, "</ul>\n");
+
+		if (options.by_type && options.breakdown) {
+			fprintf(fp, "<h2>Usage by type</h2>");
+			print_html_breakdown(fp, options.breakdown, AGG_KIND_TYPE, options, -1);
+		}
+
+		if (options.by_owner && options.breakdown) {
+			fprintf(fp, "<h2>Usage by %s</h2>", owner_kind == AGG_KIND_GID ? "group" : "user");
+			print_html_breakdown(fp, options.breakdown, owner_kind, options, -1);
+		}
+
+		fprintf(fp, "</body>\n");
+		fprintf(fp, "</html>\n");
+	}
+
+	free(flame_stack);
+	flame_stack = NULL;
+	flame_stack_size = 0;
+
+	free_owner_names();
+}
+
+/**
+** JSON output
+**/
+static void print_json(FILE *fp, struct dir_entry **entries, int entries_len, struct output_options options, int depth)
+{
+	fprintf(fp, "[");
+	for (int i=0;i<entries_len;i++) {
+		print_json_entry(fp, entries[i], options, depth);
+
+		if (i < (entries_len-1))
+			fprintf(fp, ",");
+	}
+	fprintf(fp, "]");
+}
+
+static void print_json_entry(FILE *fp, struct dir_entry *head, struct output_options options, int depth)
+{
+
+	fprintf(fp, "{");
+
+	if (printing_total)
+		fprintf(fp, "\"total\":true,");
+	else {
+		fprintf(fp, "\"path\":");
+		print_json_string(fp, head->path);
+		fprintf(fp, ",");
+	}
+
+	fprintf(fp, "\"size-bytes\":%ld,", head->totals.bytes);
+	fprintf(fp, "\"apparent-size-bytes\":%ld,", head->totals.apparent_bytes);
+	fprintf(fp, "\"inodes\":%ld,", head->totals.inodes);
+
+	// if last_mdate was set, we print it too
+	if (head->last_mdate)
+		fprintf(fp, "\"last-modified\":\"%s\",", head->last_mdate);
+
+	fprintf(fp, "\"size-human\":\"");	
+	print_size(fp, head->totals.bytes, 1, 0);
+	fprintf(fp, "\"");
+
+	if (options.num_age_limits)
+		print_json_ages(fp, head, options);
+
+	if (options.estimate_z > 0) {
+		fprintf(fp, ",\"size-bytes-error\":%.0f", estimate_get_error(head, OUTPUT_METRIC_BYTES, options.estimate_z));
+		fprintf(fp, ",\"apparent-size-bytes-error\":%.0f", estimate_get_error(head, OUTPUT_METRIC_APPARENT, options.estimate_z));
+		fprintf(fp, ",\"inodes-error\":%.0f", estimate_get_error(head, OUTPUT_METRIC_INODES, options.estimate_z));
+	}
+
+	if (options.deadline)
+		fprintf(fp, ",\"complete\":%s,\"unscanned-dirs\":%ld", 
+			head->totals.unscanned_dirs ? "false" : "true", head->totals.unscanned_dirs);
+
+	if (options.by_type == BY_TYPE_TREE && head->breakdown) {
+		fprintf(fp, ",\"types\":");
+		print_json_breakdown(fp, head->breakdown, AGG_KIND_TYPE, options);
+	}
+
+	if (options.by_owner && head->breakdown) {
+		fprintf(fp, ",\"owners\":");
+		print_json_breakdown(fp, head->breakdown, 
+			options.by_owner == BY_OWNER_GID ? AGG_KIND_GID : AGG_KIND_UID, options);
+	}
+	
+	if (depth < options.max_depth || options.max_depth < 0) {
+		if (head->children_len > 0 && load_children(head, options) == 0) {
+			fprintf(fp, ",\"children\":");
+			print_json(fp, head->children, head->children_len, options, depth+1);
+			unload_children(head, options);
+		}
+	}
+
+	fprintf(fp, "}");
+}
+
+/**
+** NDJSON and CSV output: one flat record per directory, written while 
+** the tree is walked, so the consumers can load it as a stream. The 
+** records point to their parents by id, the roots have no parent
+**/
+static void print_csv_header(FILE *fp, struct output_options options)
+{
+	fprintf(fp, "id,parent,depth,path,size-bytes,apparent-size-bytes,inodes,mtime,newest-mtime");
+
+	for (int i=0;i<=options.num_age_limits && options.num_age_limits;i++) {
+		fprintf(fp, ",age-bytes-");
+		print_age_label(fp, options, i);
+	}
+
+	if (options.estimate_z > 0)
+		fprintf(fp, ",size-bytes-error,apparent-size-bytes-error,inodes-error");
+
+	if (options.deadline)
+		fprintf(fp, ",complete,unscanned-dirs");
+
+	if (options.grand_total)
+		fprintf(fp, ",total");
+
+	fprintf(fp, "\n");
+}
+
+/**
+** the csv columns are in the order of print_csv_header, the 
+** ndjson fields have the same names
+**/
+static void print_flat_entry(FILE *fp, struct dir_entry *head, struct output_options options, int depth, size_t parent_id, int csv)
+{
+	size_t id = ++flat_record_id;
+
+	if (csv) {
+		fprintf(fp, "%zu,", id);
+		if (parent_id)
+			fprintf(fp, "%zu", parent_id);
+		fprintf(fp, ",%d,", depth);
+
+		// the grand total has no path and no mtimes
+		if (!printing_total)
+			print_csv_string(fp, head->path);
+
+		fprintf(fp, ",%ld,%ld,%ld", head->totals.bytes, head->totals.apparent_bytes, head->totals.inodes);
+
+		if (printing_total)
+			fprintf(fp, ",,");
+		else
+			fprintf(fp, ",%ld,%ld", (long int)head->last_mtime, (long int)head->totals.newest_mtime);
+
+		for (int i=0;i<=options.num_age_limits && options.num_age_limits;i++)
+			fprintf(fp, ",%ld", head->totals.age_bytes[i]);
+
+		if (options.estimate_z > 0)
+			fprintf(fp, ",%.0f,%.0f,%.0f", 
+				estimate_get_error(head, OUTPUT_METRIC_BYTES, options.estimate_z),
+				estimate_get_error(head, OUTPUT_METRIC_APPARENT, options.estimate_z),
+				estimate_get_error(head, OUTPUT_METRIC_INODES, options.estimate_z));
+
+		if (options.deadline)
+			fprintf(fp, ",%s,%ld", head->totals.unscanned_dirs ? "false" : "true", head->totals.unscanned_dirs);
+
+		if (options.grand_total)
+			fprintf(fp, ",%s", printing_total ? "true" : "false");
+	}
+	else {
+		fprintf(fp, "{\"id\":%zu,", id);
+		if (parent_id)
+			fprintf(fp, "\"parent\":%zu,", parent_id);
+		else 
+			fprintf(fp, "\"parent\":null,");
+		fprintf(fp, "\"depth\":%d,", depth);
+
+		if (printing_total)
+			fprintf(fp, "\"total\":true,");
+		else {
+			fprintf(fp, "\"path\":");
+			print_json_string(fp, head->path);
+			fprintf(fp, ",");
+		}
+
+		fprintf(fp, "\"size-bytes\":%ld,", head->totals.bytes);
+		fprintf(fp, "\"apparent-size-bytes\":%ld,", head->totals.apparent_bytes);
+		fprintf(fp, "\"inodes\":%ld", head->totals.inodes);
+
+		if (!printing_total) {
+			fprintf(fp, ",\"mtime\":%ld", (long int)head->last_mtime);
+			fprintf(fp, ",\"newest-mtime\":%ld", (long int)head->totals.newest_mtime);
+		}
+
+		for (int i=0;i<=options.num_age_limits && options.num_age_limits;i++) {
+			fprintf(fp, ",\"age-bytes-");
+			print_age_label(fp, options, i);
+			fprintf(fp, "\":%ld", head->totals.age_bytes[i]);
+		}
+
+		if (options.estimate_z > 0) {
+			fprintf(fp, ",\"size-bytes-error\":%.0f", estimate_get_error(head, OUTPUT_METRIC_BYTES, options.estimate_z));
+			fprintf(fp, ",\"apparent-size-bytes-error\":%.0f", estimate_get_error(head, OUTPUT_METRIC_APPARENT, options.estimate_z));
+			fprintf(fp, ",\"inodes-error\":%.0f", estimate_get_error(head, OUTPUT_METRIC_INODES, options.estimate_z));
+		}
+
+		if (options.deadline)
+			fprintf(fp, ",\"complete\":%s,\"unscanned-dirs\":%ld", 
+				head->totals.unscanned_dirs ? "false" : "true", head->totals.unscanned_dirs);
+
+		fprintf(fp, "}");
+	}
+
+	fprintf(fp, "\n");
+
+	if (depth < options.max_depth || options.max_depth < 0) {
+		if (head->children_len > 0 && load_children(head, options) == 0) {
+			for (int i=0;i<head->children_len;i++)
+				print_flat_entry(fp, head->children[i], options, depth+1, id, csv);
+
+			unload_children(head, options);
+		}
+	}
+}
+
+// quoted, with the quotes inside doubled (RFC 4180)
+static void print_csv_string(FILE *fp, const char *str)
+{
+	fputc('"', fp);
+
+	for (const char *c = str; *c; c++) {
+		if (*c == '"')
+			fputc('"', fp);
+		fputc(*c, fp);
+	}
+
+	fputc('"', fp);
+}
+
+/**
+** a json string literal, with the quotes, backslashes and 
+** control characters escaped (RFC 8259)
+**/
+static void print_json_string(FILE *fp, const char *str)
+{
+	fputc('"', fp);
+
+	for (const unsigned char *c = (const unsigned char *)str; *c; c++) {
+		if (*c == '"' || *c == '\\')
+			fprintf(fp, "\\%c", *c);
+		else if (*c < 0x20)
+			fprintf(fp, "\\u%04x", *c);
+		else 
+			fputc(*c, fp);
+	}
+
+	fputc('"', fp);
+}
+
+/**
+** Folded stacks, the input of flamegraph tools: "a;b;c 123" lines with 
+** the directories from the root down, and the bytes (or the counter
+** selected) of the last one, without its subdirectories. Below 
+** --max-depth the whole subtree is counted to the last directory printed
+**/
+static void print_folded_entry(FILE *fp, struct dir_entry *head, struct dir_entry *parent, struct output_options options, int depth)
+{
+	int show_children = 0;
+	size_t own;
+
+	if (depth >= flame_stack_size) {
+		int size = flame_stack_size ? flame_stack_size * 2 : 64;
+		struct flame_frame *stack = realloc(flame_stack, size * sizeof(struct flame_frame));
+
+		if (!stack) {
+			printf("Error allocating memory for the folded stacks\n");
+			return;
+		}
+
+		flame_stack = stack;
+		flame_stack_size = size;
+	}
+
+	flame_stack[depth].name = get_flame_name(head, parent, &flame_stack[depth].len);
+
+	if (depth < options.max_depth || options.max_depth < 0)
+		show_children = head->children_len > 0 && load_children(head, options) == 0;
+
+	own = get_own_metric(head, options, show_children);
+
+	// directories without own bytes get no line, their subdirectories have them
+	if (own > 0) {
+		for (int i=0;i<=depth;i++) {
+			if (i > 0)
+				fputc(';', fp);
+			print_folded_name(fp, flame_stack[i].name, flame_stack[i].len);
+		}
+
+		fprintf(fp, " %zu\n", own);
+	}
+
+	if (show_children) {
+		for (int i=0;i<head->children_len;i++)
+			print_folded_entry(fp, head->children[i], head, options, depth+1);
+
+		unload_children(head, options);
+	}
+}
+
+// ; separates the frames and a line break the lines, they are replaced in the names
+static void print_folded_name(FILE *fp, const char *name, int len)
+{
+	if (!memchr(name, ';', len) && !memchr(name, '\n', len)) {
+		fwrite(name, 1, len, fp);
+		return;
+	}
+
+	for (int i=0;i<len;i++)
+		fputc(name[i] == ';' || name[i] == '\n' ? '_' : name[i], fp);
+}
+
+/**
+** the last component of the path of a directory, or the whole path 
+** of a root. Children paths are the path of the parent, a / (except 
+** under "/") and the name
+**/
+static const char *get_flame_name(struct dir_entry *head, struct dir_entry *parent, int *len)
+{
+	const char *name;
+
+	if (!parent) {
+		*len = head->path_len;
+		return head->path;
+	}
+
+	if (head->path_len > parent->path_len && strncmp(head->path, parent->path, parent->path_len) == 0) {
+		name = head->path + parent->path_len;
+
+		if (*name == '/')
+			name++;
+	}
+	else {
+		name = strrchr(head->path, '/');
+		name = name ? name + 1 : head->path;
+	}
+
+	*len = head->path_len - (name - head->path);
+
+	return name;
+}
+
+/**
+** the counter of a directory minus the ones of its subdirectories, 
+** or all of it if its subdirectories are not shown (not loaded)
+**/
+static size_t get_own_metric(struct dir_entry *head, struct output_options options, int children_shown)
+{
+	size_t total = get_metric(head, options);
+	size_t children = 0;
+
+	if (!children_shown)
+		return total;
+
+	for (int i=0;i<head->children_len;i++)
+		children += get_metric(head->children[i], options);
+
+	return total > children ? total - children : 0;
+}
+
+/**
+** SVG flamegraph, the roots stacked on an "all" frame when there are 
+** more of them. Every frame has the width of its subtree, the frames 
+** of its subdirectories are on top of it, in the order of the tree 
+** (--sort). The text of a frame is cut to its width, the whole path 
+** and the size are in its tooltip
+**/
+static void print_svg(FILE *fp, struct output_options options)
+{
+	size_t total = 0;
+	double scale = 0, x = FLAME_PADDING;
+	int levels = 0, base = flame_roots_len > 1;
+	int height, bottom;
+
+	for (int i=0;i<flame_roots_len;i++)
+		total += get_metric(flame_roots[i], options);
+
+	if (total > 0)
+		scale = (double)(FLAME_WIDTH - 2 * FLAME_PADDING) / total;
+
+	for (int i=0;i<flame_roots_len && total > 0;i++) {
+		int root_levels = get_svg_levels(flame_roots[i], options, 0, scale);
+
+		if (root_levels > levels)
+			levels = root_levels;
+	}
+
+	levels += base;
+	height = FLAME_TITLE_HEIGHT + levels * FLAME_FRAME_HEIGHT + FLAME_PADDING;
+	bottom = height - FLAME_PADDING;
+
+	fprintf(fp, "<?xml version=\"1.0\" standalone=\"no\"?>\n");
+	fprintf(fp, "<svg version=\"1.1\" width=\"%d\" height=\"%d\" viewBox=\"0 0 %d %d\" xmlns=\"http://www.w3.org/2000/svg\">\n", 
+		FLAME_WIDTH, height, FLAME_WIDTH, height);
+	fprintf(fp, "<style>text {font-family: Verdana, sans-serif; font-size: 12px; fill: #000;} .title {font-size: 17px;} rect {stroke: #fff; stroke-width: 0.5;}</style>\n");
+	fprintf(fp, "<rect x=\"0\" y=\"0\" width=\"%d\" height=\"%d\" fill=\"#f8f8f8\" stroke=\"none\"/>\n", FLAME_WIDTH, height);
+	fprintf(fp, "<text class=\"title\" x=\"%d\" y=\"22\" text-anchor=\"middle\">Disk usage (%s)</text>\n", FLAME_WIDTH / 2,
+		options.metric == OUTPUT_METRIC_INODES ? "inodes" : options.metric == OUTPUT_METRIC_APPARENT ? "apparent size" : "size");
+
+	if (total > 0 && base) {
+		fprintf(fp, "<g><title>all, ");
+		print_svg_value(fp, total, options);
+		fprintf(fp, "</title><rect x=\"%d\" y=\"%d\" width=\"%.1f\" height=\"%d\" fill=\"rgb(210,210,210)\"/>", 
+			FLAME_PADDING, bottom - FLAME_FRAME_HEIGHT, total * scale, FLAME_FRAME_HEIGHT - 1);
+		fprintf(fp, "<text x=\"%d\" y=\"%d\">all</text></g>\n", FLAME_PADDING + 3, bottom - 4);
+	}
+
+	for (int i=0;i<flame_roots_len && total > 0;i++) {
+		print_svg_frame(fp, flame_roots[i], NULL, options, 0, x, scale, bottom - base * FLAME_FRAME_HEIGHT);
+		x += get_metric(flame_roots[i], options) * scale;
+	}
+
+	fprintf(fp, "</svg>\n");
+}
+
+/**
+** the number of levels drawn of a subtree, so the height of the 
+** image is known before the frames are printed
+**/
+static int get_svg_levels(struct dir_entry *head, struct output_options options, int depth, double scale)
+{
+	int levels = 0;
+
+	if (get_metric(head, options) * scale < FLAME_MIN_WIDTH)
+		return 0;
+
+	if (depth < options.max_depth || options.max_depth < 0) {
+		if (head->children_len > 0 && load_children(head, options) == 0) {
+			for (int i=0;i<head->children_len;i++) {
+				int child_levels = get_svg_levels(head->children[i], options, depth+1, scale);
+
+				if (child_levels > levels)
+					levels = child_levels;
+			}
+
+			unload_children(head, options);
+		}
+	}
+
+	return levels + 1;
+}
+
+/**
+** one frame and the ones above it. The roots (depth 0) are drawn 
+** right above bottom. The color is picked by the name, so the same 
+** directory has the same color in every graph
+**/
+static void print_svg_frame(FILE *fp, struct dir_entry *head, struct dir_entry *parent, struct output_options options, int depth, double x, double scale, int bottom)
+{
+	size_t value = get_metric(head, options);
+	double width = value * scale;
+	int y = bottom - (depth + 1) * FLAME_FRAME_HEIGHT;
+	int len, chars;
+	unsigned int hash = 2166136261u;
+	const char *name;
+
+	if (width < FLAME_MIN_WIDTH)
+		return;
+
+	name = get_flame_name(head, parent, &len);
+
+	for (int i=0;i<len;i++)
+		hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+
+	fprintf(fp, "<g><title>");
+	print_xml_string(fp, head->path, head->path_len);
+	fprintf(fp, ", ");
+	print_svg_value(fp, value, options);
+	fprintf(fp, "</title><rect x=\"%.1f\" y=\"%d\" width=\"%.1f\" height=\"%d\" fill=\"rgb(%u,%u,%u)\"/>", 
+		x, y, width, FLAME_FRAME_HEIGHT - 1, 205 + hash % 50, (hash >> 8) % 230, (hash >> 16) % 55);
+
+	// the name is cut at a character boundary, with .. after it
+	chars = (int)((width - 6) / FLAME_CHAR_WIDTH);
+
+	if (chars >= 3) {
+		int cut = len;
+
+		if (len > chars) {
+			cut = chars - 2;
+			while (cut > 0 && (name[cut] & 0xC0) == 0x80)
+				cut--;
+		}
+
+		fprintf(fp, "<text x=\"%.1f\" y=\"%d\">", x + 3, y + FLAME_FRAME_HEIGHT - 4);
+		print_xml_string(fp, name, cut);
+		fprintf(fp, "%s</text>", cut < len ? ".." : "");
+	}
+
+	fprintf(fp, "</g>\n");
+
+	if (depth < options.max_depth || options.max_depth < 0) {
+		if (head->children_len > 0 && load_children(head, options) == 0) {
+			for (int i=0;i<head->children_len;i++) {
+				print_svg_frame(fp, head->children[i], head, options, depth+1, x, scale, bottom);
+				x += get_metric(head->children[i], options) * scale;
+			}
+
+			unload_children(head, options);
+		}
+	}
+}
+
+// the counter of a frame in its tooltip, with the unit
+static void print_svg_value(FILE *fp, size_t value, struct output_options options)
+{
+	if (options.metric == OUTPUT_METRIC_INODES)
+		fprintf(fp, "%zu inodes", value);
+	else
+		print_size(fp, value, 1, 0);
+}
+
+/**
+** text and attribute values. Control characters are not allowed 
+** in xml at all, they are replaced with ?
+**/
+static void print_xml_string(FILE *fp, const char *str, int len)
+{
+	for (int i=0;i<len;i++) {
+		unsigned char c = str[i];
+
+		if (c == '<')
+			fputs("&lt;", fp);
+		else if (c == '>')
+			fputs("&gt;", fp);
+		else if (c == '&')
+			fputs("&amp;", fp);
+		else if (c == '"')
+			fputs("&quot;", fp);
+		else if (c < 0x20)
+			fputc('?', fp);
+		else
+			fputc(c, fp);
+	}
+}
+
+/**
+** Plain text output
+**/
+void print_plain_text(FILE *fp, struct dir_entry **entries, int entries_len, struct output_options options, int depth)
+{
+	if (!entries || entries_len == 0)
+		return;
+
+	for (int i=0;i<entries_len;i++) {
+		struct dir_entry *head = entries[i];
+
+		if (!head)
+			continue;
+
+		if (!options.no_leading_tabs) {
+			for (int j=0;j<depth;j++)
+				printf("\t");
+		}
+
+		if (!options.no_styles)
+			if (options.show_critical_at_bytes > 0 || options.show_warn_at_bytes) {
+				if (options.show_critical_at_bytes > 0 && get_size(head, options) >= options.show_critical_at_bytes)
+					fprintf(fp, "\033[31m"); // red
+				else if (options.show_warn_at_bytes > 0 && get_size(head, options) >= options.show_warn_at_bytes)
+					fprintf(fp, "\033[33m"); // yellow
+				else 
+					fprintf(fp, "\033[32m"); // green
+			}
+	
+		print_metric(fp, head, options, 1);
+
+		if (options.estimate_z > 0)
+			print_metric_error(fp, head, options);
+	
+		if (!options.no_styles)
+			fprintf(fp, "\033[0m"); // reset font color
+	
+		// if last_mdate was set, we print it too
+		if (head->last_mdate) {
+			fprintf(fp, "   %s  ", head->last_mdate);
+		}
+	
+		fprintf(fp, " %s", head->path);
+
+		// --deadline ran out before everything below was scanned
+		if (head->totals.unscanned_dirs)
+			fprintf(fp, "  (partial, %ld unscanned)", head->totals.unscanned_dirs);
+
+		fprintf(fp, "\n");
+
+		if (options.num_age_limits)
+			print_text_ages(fp, head, options, depth+1);
+
+		if (options.by_type == BY_TYPE_TREE && head->breakdown)
+			print_text_breakdown(fp, head->breakdown, AGG_KIND_TYPE, options, depth+1, BREAKDOWN_DIR_TOP);
+
+		if (options.by_owner && head->breakdown)
+			print_text_breakdown(fp, head->breakdown, 
+				options.by_owner == BY_OWNER_GID ? AGG_KIND_GID : AGG_KIND_UID, options, depth+1, BREAKDOWN_DIR_TOP);
+	
+		if (options.max_depth < 0 || depth < options.max_depth)
+		{
+			if (load_children(head, options) == 0) {
+				print_plain_text(fp, head->children, head->children_len, options, depth+1);
+				unload_children(head, options);
+			}
+		}
+	}
+}
+
+static void print_html_entries(FILE *fp, struct dir_entry **entries, int entries_len, struct output_options options, int depth)
+{
+	fprintf(fp, "<ul>");
+
+	for (int i=0;i<entries_len;i++)
+		print_html_entry(fp, entries[i], options, depth);
+
+	fprintf(fp, "</ul>\n");
+}
+
+static void print_html_entry(FILE *fp, struct dir_entry *head, struct output_options options, int depth)
+{
+	char size_cls[10];
+
+	if (options.show_critical_at_bytes > 0 || options.show_warn_at_bytes) {
+		if (options.show_critical_at_bytes > 0 && get_size(head, options) >= options.show_critical_at_bytes)
+			strcpy(size_cls, "red");
+		else if (options.show_warn_at_bytes > 0 && get_size(head, options) >= options.show_warn_at_bytes)
+			strcpy(size_cls, "orange");
+		else 
+			strcpy(size_cls, "green");
+	}
+
+	fprintf(fp, "<li><span class=\"size %s\">", size_cls);
+	print_metric(fp, head, options, 0);
+
+	if (options.estimate_z > 0)
+		print_metric_error(fp, head, options);
+
+	fprintf(fp, "</span> ");
+
+	if (head->last_mdate) {
+		fprintf(fp, "<span class=\"date\">%s</span>", head->last_mdate);
+	}
+
+	fprintf(fp, "%s", head->path);
+
+	if (head->totals.unscanned_dirs)
+		fprintf(fp, " <span class=\"partial\">(partial, %ld unscanned)</span>", head->totals.unscanned_dirs);
+
+	if (options.num_age_limits) {
+		fprintf(fp, "<div class=\"ages\">");
+		print_text_ages(fp, head, options, -1);
+		fprintf(fp, "</div>");
+	}
+
+	if (options.by_type == BY_TYPE_TREE && head->breakdown)
+		print_html_breakdown(fp, head->breakdown, AGG_KIND_TYPE, options, BREAKDOWN_DIR_TOP);
+
+	if (options.by_owner && head->breakdown)
+		print_html_breakdown(fp, head->breakdown, 
+			options.by_owner == BY_OWNER_GID ? AGG_KIND_GID : AGG_KIND_UID, options, BREAKDOWN_DIR_TOP);
 
-// json
-static void print_json(FILE *fp, struct dir_entry **entries, int entries_len, struct output_options options, int depth);
+	if (depth < options.max_depth || options.max_depth < 0) {
+		if (head->children_len > 0 && load_children(head, options) == 0) {
+			print_html_entries(fp, head->children, head->children_len, options, depth+1);
+			unload_children(head, options);
+		}
+	}
 
-// plain text
-void print_plain_text(FILE *fp, struct dir_entry **entries, int entries_len, struct output_options options, int depth);
+	fprintf(fp, "</li>");
+}
 
-// html
-static void print_html(FILE *fp, struct dir_entry **entries, int entries_len, struct output_options options, int depth);
-static void print_html_entries(FILE *fp, struct dir_entry **entries, int entries_len, struct output_options options, int depth);
+/**
+** children moved to the spill file (--memory-limit) are read back only 
+** while they are printed, one level at a time
+**/
+static int load_children(struct dir_entry *head, struct output_options options)
+{
+	if (head->spill_off < 0 || !options.spill)
+		return 0;
 
+	return spill_load_children(options.spill, head);
+}
 
-void output_print(FILE *fp, struct dir_entry **entries, int entries_len, const char *format, struct output_options options)
+static void unload_children(struct dir_entry *head, struct output_options options)
 {
-	if (strcmp(format, "json") == 0)
-		print_json(fp, entries, entries_len, options, 0);
-	else if (strcmp(format, "text") == 0)
-		print_plain_text(fp, entries, entries_len, options, 0);
-	else if (strcmp(format, "html") == 0)
-		print_html(fp, entries, entries_len, options, 0);
-	else 
-		fprintf(fp, "Invalid output format!\n");
+	if (options.spill)
+		spill_unload_children(head);
 }
 
 /**
-** JSON output
+** Age buckets (--age-buckets). With limits 7d,30d the buckets are 
+** labeled "<7d", "7d-30d" and ">30d"
 **/
-static void print_json(FILE *fp, struct dir_entry **entries, int entries_len, struct output_options options, int depth)
+static void print_age_label(FILE *fp, struct output_options options, int bucket)
 {
-	fprintf(fp, "[");
-	for (int i=0;i<entries_len;i++) {
-		struct dir_entry *head = entries[i];
+	if (bucket == 0)
+		fprintf(fp, "<%s", options.age_limit_names[0]);
+	else if (bucket == options.num_age_limits)
+		fprintf(fp, ">%s", options.age_limit_names[bucket-1]);
+	else
+		fprintf(fp, "%s-%s", options.age_limit_names[bucket-1], options.age_limit_names[bucket]);
+}
 
-		fprintf(fp, "{");
-		fprintf(fp, "\"path\":\"%s\",", head->path);
-		fprintf(fp, "\"size-bytes\":%ld,", head->bytes);
-	
-		// if last_mdate was set, we print it too
-		if (head->last_mdate)
-			fprintf(fp, "\"last-modified\":\"%s\",", head->last_mdate);
-	
-		fprintf(fp, "\"size-human\":\"");	
-		print_size(fp, head->bytes, 1, 0);
-		fprintf(fp, "\"");
-		
-		if (depth < options.max_depth || options.max_depth < 0) {
-			if (head->children_len > 0) {
-				fprintf(fp, ",\"children\":");
-				print_json(fp, head->children, head->children_len, options, depth+1);
-			}
-		}
-	
-		fprintf(fp, "}");
-		if (i < (entries_len-1))
+static void print_json_ages(FILE *fp, struct dir_entry *head, struct output_options options)
+{
+	char *newest = dir_get_dentry_mdate(head->totals.newest_mtime);
+
+	fprintf(fp, ",\"age-buckets\":[");
+	for (int i=0;i<=options.num_age_limits;i++) {
+		fprintf(fp, "{\"bucket\":\"");
+		print_age_label(fp, options, i);
+		fprintf(fp, "\",\"size-bytes\":%ld}", head->totals.age_bytes[i]);
+
+		if (i < options.num_age_limits)
 			fprintf(fp, ",");
 	}
 	fprintf(fp, "]");
 
-	if (depth == 0)
+	fprintf(fp, ",\"newest-mtime\":%ld", (long int)head->totals.newest_mtime);
+
+	if (newest) {
+		fprintf(fp, ",\"newest-modified\":\"%s\"", newest);
+		free(newest);
+	}
+}
+
+/**
+** prints the buckets in one row. depth < 0 means no line break 
+** and indentation (html)
+**/
+static void print_text_ages(FILE *fp, struct dir_entry *head, struct output_options options, int depth)
+{
+	char *newest = dir_get_dentry_mdate(head->totals.newest_mtime);
+
+	if (!options.no_leading_tabs) {
+		for (int j=0;j<depth;j++)
+			fprintf(fp, "\t");
+	}
+
+	if (depth >= 0)
+		fprintf(fp, "  ");
+
+	for (int i=0;i<=options.num_age_limits;i++) {
+		print_age_label(fp, options, i);
+		fprintf(fp, ": ");
+		print_size(fp, head->totals.age_bytes[i], options.human_readable, 0);
+		fprintf(fp, " | ");
+	}
+
+	fprintf(fp, "newest: %s", newest ? newest : "-");
+
+	if (depth >= 0)
 		fprintf(fp, "\n");
+
+	if (newest)
+		free(newest);
 }
 
 /**
-** Plain text output
+** returns the counter selected with --apparent-size or --inodes
 **/
-void print_plain_text(FILE *fp, struct dir_entry **entries, int entries_len, struct output_options options, int depth)
+static size_t get_metric(struct dir_entry *head, struct output_options options)
 {
-	if (!entries || entries_len == 0)
-		return;
+	return get_totals_metric(&head->totals, options.metric);
+}
 
-	for (int i=0;i<entries_len;i++) {
-		struct dir_entry *head = entries[i];
+/**
+** the size compared with --warn-at and --critical-at: the apparent 
+** size with --apparent-size, the disk usage otherwise (with --inodes too)
+**/
+static size_t get_size(struct dir_entry *head, struct output_options options)
+{
+	return options.metric == OUTPUT_METRIC_APPARENT ? head->totals.apparent_bytes : head->totals.bytes;
+}
 
-		if (!head)
-			continue;
+static size_t get_totals_metric(const struct dir_totals *totals, unsigned int metric)
+{
+	switch (metric) {
+		case OUTPUT_METRIC_APPARENT:
+			return totals->apparent_bytes;
+		case OUTPUT_METRIC_INODES:
+			return totals->inodes;
+		default:
+			return totals->bytes;
+	}
+}
+
+/**
+** Breakdown tables (--by-type). Items are listed by the displayed counter, 
+** in descending order
+**/
+static struct agg_item **get_sorted_items(struct agg_table *table, int kind, struct output_options options, int *items_len)
+{
+	struct agg_item **items = agg_get_items(table, kind, items_len);
+
+	if (!items)
+		return NULL;
+
+	items_sort_metric = options.metric;
+	qsort(items, *items_len, sizeof(struct agg_item *), sort_items_cb);
+
+	return items;
+}
+
+static int sort_items_cb(const void *a, const void *b)
+{
+	size_t val_a = get_totals_metric(&(*(struct agg_item **)a)->totals, items_sort_metric);
+	size_t val_b = get_totals_metric(&(*(struct agg_item **)b)->totals, items_sort_metric);
+
+	return val_a < val_b ? 1 : (val_a == val_b ? 0 : -1);
+}
+
+static void print_json_breakdown(FILE *fp, struct agg_table *table, int kind, struct output_options options)
+{
+	int items_len = 0;
+	struct agg_item **items = get_sorted_items(table, kind, options, &items_len);
+
+	fprintf(fp, "[");
+	for (int i=0;i<items_len;i++) {
+		if (kind == AGG_KIND_TYPE) {
+			fprintf(fp, "{\"type\":");
+			print_json_string(fp, items[i]->name);
+		}
+		else {
+			fprintf(fp, "{\"%s\":%ld,\"name\":", kind == AGG_KIND_GID ? "gid" : "uid", items[i]->id);
+			print_json_string(fp, get_item_name(items[i]));
+		}
+
+		fprintf(fp, ",");
+
+		fprintf(fp, "\"size-bytes\":%ld,", items[i]->totals.bytes);
+		fprintf(fp, "\"apparent-size-bytes\":%ld,", items[i]->totals.apparent_bytes);
+		fprintf(fp, "\"%s\":%ld}", kind == AGG_KIND_TYPE ? "count" : "inodes", items[i]->totals.inodes);
+
+		if (i < (items_len-1))
+			fprintf(fp, ",");
+	}
+	fprintf(fp, "]");
+
+	free(items);
+}
+
+/**
+** "errors": the number of all the errors and the recorded ones grouped 
+** by operation, errno and directory, with the first path of each group
+**/
+static void print_json_errors(FILE *fp, struct output_options options)
+{
+	fprintf(fp, ",\"errors\":{\"total\":%zu,\"groups\":[", options.errors_total);
 
+	for (int i=0;i<options.errors_len;i++) {
+		struct err_group *group = &options.errors[i];
+
+		fprintf(fp, "{\"operation\":\"%s\",", errlog_get_op_name(group->op));
+		fprintf(fp, "\"errno\":%d,", group->err);
+		fprintf(fp, "\"error\":");
+		print_json_string(fp, strerror(group->err));
+		fprintf(fp, ",\"directory\":");
+		print_json_string(fp, group->dir);
+		fprintf(fp, ",\"count\":%zu,", group->count);
+		fprintf(fp, "\"path\":");
+		print_json_string(fp, group->path);
+		fprintf(fp, "}");
+
+		if (i < (options.errors_len-1))
+			fprintf(fp, ",");
+	}
+
+	fprintf(fp, "]}");
+}
+
+static void print_text_breakdown(FILE *fp, struct agg_table *table, int kind, struct output_options options, int depth, int limit)
+{
+	int items_len = 0;
+	struct agg_item **items = get_sorted_items(table, kind, options, &items_len);
+
+	for (int i=0;i<items_len;i++) {
 		if (!options.no_leading_tabs) {
 			for (int j=0;j<depth;j++)
-				printf("\t");
+				fprintf(fp, "\t");
 		}
 
-		if (!options.no_styles)
-			if (options.show_critical_at_bytes > 0 || options.show_warn_at_bytes) {
-				if (options.show_critical_at_bytes > 0 && head->bytes >= options.show_critical_at_bytes)
-					fprintf(fp, "\033[31m"); // red
-				else if (options.show_warn_at_bytes > 0 && head->bytes >= options.show_warn_at_bytes)
-					fprintf(fp, "\033[33m"); // yellow
-				else 
-					fprintf(fp, "\033[32m"); // green
-			}
-	
-		print_size(fp, head->bytes, options.human_readable, 1);
-	
-		if (!options.no_styles)
-			fprintf(fp, "\033[0m"); // reset font color
-	
-		// if last_mdate was set, we print it too
-		if (head->last_mdate) {
-			fprintf(fp, "   %s  ", head->last_mdate);
+		fprintf(fp, "  ");
+
+		if (limit >= 0 && i >= limit) {
+			fprintf(fp, "... %d more\n", items_len - limit);
+			break;
 		}
-	
-		fprintf(fp, " %s\n", head->path);
-	
-		if (options.max_depth < 0 || depth < options.max_depth)
-		{
-			print_plain_text(fp, head->children, head->children_len, options, depth+1);
+
+		if (options.metric == OUTPUT_METRIC_INODES)
+			fprintf(fp, "%ld", items[i]->totals.inodes);
+		else
+			print_size(fp, get_totals_metric(&items[i]->totals, options.metric), options.human_readable, 1);
+
+		fprintf(fp, "  %s (%ld)\n", get_item_name(items[i]), items[i]->totals.inodes);
+	}
+
+	free(items);
+}
+
+static void print_html_breakdown(FILE *fp, struct agg_table *table, int kind, struct output_options options, int limit)
+{
+	int items_len = 0;
+	struct agg_item **items = get_sorted_items(table, kind, options, &items_len);
+
+	fprintf(fp, "<ul class=\"types\">");
+	for (int i=0;i<items_len;i++) {
+		if (limit >= 0 && i >= limit) {
+			fprintf(fp, "<li>... %d more</li>", items_len - limit);
+			break;
 		}
+
+		fprintf(fp, "<li><span class=\"size\">");
+
+		if (options.metric == OUTPUT_METRIC_INODES)
+			fprintf(fp, "%ld", items[i]->totals.inodes);
+		else
+			print_size(fp, get_totals_metric(&items[i]->totals, options.metric), options.human_readable, 0);
+
+		fprintf(fp, "</span> %s (%ld)</li>", get_item_name(items[i]), items[i]->totals.inodes);
 	}
+	fprintf(fp, "</ul>\n");
+
+	free(items);
 }
 
-static void print_html(FILE *fp, struct dir_entry **entries, int entries_len, struct output_options options, int depth)
+static const char *get_item_name(struct agg_item *item)
 {
-	fprintf(fp, "<!DOCTYPE html>\n<html lang=\"en\">\n");
-	fprintf(fp, "<head><meta charset=\"UTF-8\"><title>Disk Usage Report</title><style>body {font-family: monospace; background: #1e1e1e; color: #dcdcdc; padding: 20px;} ul {list-style-type: none; padding-left: 20px;} li {margin: 4px 0;} .size {display: inline-block; width: 80px; font-weight: bold;} .date {display: inline-block; width: 185px; } .red {color: #ff5c5c;} .orange {color: #ffa500;} .yellow {color: #ffd700;} .green {color: #7fff00;}</style></head>\n");
-	fprintf(fp, "<body>");
-		fprintf(fp, "<h1>Disk Usage Report</h1>");
-		print_html_entries(fp, entries, entries_len, options, depth);
-	fprintf(fp, "</body>\n");
-	fprintf(fp, "</html>\n");
+	if (item->kind == AGG_KIND_TYPE)
+		return item->name;
+
+	return get_owner_name(item->kind, item->id);
 }
 
-static void print_html_entries(FILE *fp, struct dir_entry **entries, int entries_len, struct output_options options, int depth)
+/**
+** resolves user and group ids to names. The same id shows up in the table 
+** of many directories, so every id is looked up only once, and ids 
+** without a name are shown as numbers
+**/
+static const char *get_owner_name(int kind, long id)
 {
-	fprintf(fp, "<ul>");
+	char buf[16384];
+	char name[64];
+	struct owner_name *names;
 
-	for (int i=0;i<entries_len;i++) {
-		char size_cls[10];
-		struct dir_entry *head = entries[i];
+	for (int i=0;i<owner_names_len;i++) {
+		if (owner_names[i].kind == kind && owner_names[i].id == id)
+			return owner_names[i].name;
+	}
 
-		if (options.show_critical_at_bytes > 0 || options.show_warn_at_bytes) {
-			if (options.show_critical_at_bytes > 0 && head->bytes >= options.show_critical_at_bytes)
-				strcpy(size_cls, "red");
-			else if (options.show_warn_at_bytes > 0 && head->bytes >= options.show_warn_at_bytes)
-				strcpy(size_cls, "orange");
-			else 
-				strcpy(size_cls, "green");
-		}
-	
-		fprintf(fp, "<li><span class=\"size %s\">", size_cls);
-		print_size(fp, head->bytes, options.human_readable, 0);
-		fprintf(fp, "</span> ");
+	snprintf(name, sizeof(name), "%ld", id);
 
-		if (head->last_mdate) {
-			fprintf(fp, "<span class=\"date\">%s</span>", head->last_mdate);
-		}
+	if (kind == AGG_KIND_UID) {
+		struct passwd pwd, *result = NULL;
 
-		fprintf(fp, "%s", head->path);
+		if (getpwuid_r((uid_t)id, &pwd, buf, sizeof(buf), &result) == 0 && result)
+			snprintf(name, sizeof(name), "%s", result->pw_name);
+	}
+	else {
+		struct group grp, *result = NULL;
 
-		if (depth < options.max_depth || options.max_depth < 0) {
-			if (head->children_len > 0)
-				print_html_entries(fp, head->children, head->children_len, options, depth+1);
-		}
-	
-		fprintf(fp, "</li>");
+		if (getgrgid_r((gid_t)id, &grp, buf, sizeof(buf), &result) == 0 && result)
+			snprintf(name, sizeof(name), "%s", result->gr_name);
 	}
 
-	fprintf(fp, "</ul>\n");
+	names = realloc(owner_names, (owner_names_len+1) * sizeof(struct owner_name));
+
+	if (!names) {
+		printf("Error allocating memory for owner names!\n");
+		return "?";
+	}
+
+	owner_names = names;
+	owner_names[owner_names_len].kind = kind;
+	owner_names[owner_names_len].id = id;
+	owner_names[owner_names_len].name = strdup(name);
+	owner_names_len++;
+
+	return owner_names[owner_names_len-1].name ? owner_names[owner_names_len-1].name : "?";
+}
+
+static void free_owner_names()
+{
+	for (int i=0;i<owner_names_len;i++)
+		free(owner_names[i].name);
+
+	free(owner_names);
+	owner_names = NULL;
+	owner_names_len = 0;
+}
+
+static void print_metric(FILE *fp, struct dir_entry *head, struct output_options options, int leading_spaces)
+{
+	// inode counts are never printed with size units
+	if (options.metric == OUTPUT_METRIC_INODES) {
+		fprintf(fp, "%*ld", leading_spaces, head->totals.inodes);
+		return;
+	}
+
+	print_size(fp, get_metric(head, options), options.human_readable, leading_spaces);
+}
+
+/**
+** --estimate: the half width of the confidence interval, after the metric
+**/
+static void print_metric_error(FILE *fp, struct dir_entry *head, struct output_options options)
+{
+	double error = estimate_get_error(head, options.metric, options.estimate_z);
+
+	fprintf(fp, " ±");
+
+	if (options.metric == OUTPUT_METRIC_INODES)
+		fprintf(fp, "%.0f", error);
+	else 
+		print_size(fp, (long int)error, options.human_readable, 0);
 }
 
 static void print_size(FILE *fp, long int bytes, int human_readable, int leading_spaces)
@@ -208,4 +1464,180 @@ static void print_size(FILE *fp, long int bytes, int human_readable, int leading
 	fprintf(fp, "%*.*f%s", leading_spaces, precision, fin_size, show_unit ? units[unit_cntr] : "");
 
 	return;
-}
\ No newline at end of file
+}
+
+/**
+** --lazy-html: the page only holds the top lazy_depth levels of the tree,
+** the rest is in chunk files next to it, loaded when a directory is 
+** opened. Next to the tree a treemap shows the selected directory
+**/
+static void print_lazy_html_begin(FILE *fp, struct output_options options)
+{
+	lazy_chunk_id = 0;
+
+	fprintf(fp, "<!DOCTYPE html>\n<html lang=\"en\">\n");
+	fprintf(fp, "<head><meta charset=\"UTF-8\"><title>Disk Usage Report</title><style>body {font-family: monospace; background: #1e1e1e; color: #dcdcdc; padding: 20px;} ul {list-style-type: none; padding-left: 20px;} li {margin: 4px 0;} a {color: #dcdcdc;} .size {display: inline-block; width: 80px; font-weight: bold;} .toggle {display: inline-block; width: 16px; cursor: pointer;} .red {color: #ff5c5c;} .yellow {color: #ffd700;} .green {color: #7fff00;} #map {position: relative; height: 480px; margin: 10px 0; overflow: hidden;} .cell {position: absolute; box-sizing: border-box; border: 1px solid #1e1e1e; overflow: hidden; font-size: 11px; padding: 2px; cursor: pointer;}</style>\n");
+	fprintf(fp, "<script>\n%s", lazy_html_script);
+	fprintf(fp, "bdu.dir = ");
+	print_js_string(fp, options.chunk_url ? options.chunk_url : "");
+	fprintf(fp, ";\nbdu.metric = %u;\nbdu.human = %u;\n", options.metric, options.human_readable);
+	fprintf(fp, "bdu.warn = %lu;\nbdu.crit = %lu;\n", options.show_warn_at_bytes, options.show_critical_at_bytes);
+	fprintf(fp, "</script></head>\n");
+	fprintf(fp, "<body>");
+	fprintf(fp, "<h1>Disk Usage Report</h1>");
+	fprintf(fp, "<div id=\"crumbs\"></div><div id=\"map\"></div><div id=\"tree\"></div>\n");
+}
+
+/**
+** prints the node of head, with levels more levels below it inline. 
+** The children below that are written to a chunk file
+**/
+static void print_lazy_node(FILE *fp, struct dir_entry *head, struct output_options options, int depth, int levels)
+{
+	const char *name = strrchr(head->path, '/');
+
+	// the roots have their full path, the rest only their name
+	print_js_string(fp, depth == 0 || !name || !name[1] ? head->path : name + 1);
+	fprintf(fp, ",%ld,%ld,%ld,", head->totals.bytes, head->totals.apparent_bytes, head->totals.inodes);
+
+	if (head->children_len == 0 || (depth >= options.max_depth && options.max_depth >= 0))
+		fprintf(fp, "0");
+	else if (levels > 0) {
+		if (load_children(head, options) == 0) {
+			fprintf(fp, "[");
+			for (int i=0;i<head->children_len;i++) {
+				if (i > 0)
+					fprintf(fp, ",");
+
+				fprintf(fp, "[");
+				print_lazy_node(fp, head->children[i], options, depth+1, levels-1);
+				fprintf(fp, "]");
+			}
+			fprintf(fp, "]");
+
+			unload_children(head, options);
+		}
+		else 
+			fprintf(fp, "0");
+	}
+	else 
+		fprintf(fp, "%d", write_lazy_chunk(head, options, depth));
+}
+
+/**
+** writes the children of head (as many levels of them as fit, see 
+** LAZY_HTML_CHUNK_NODES) to the next chunk file, and returns its id. 
+** 0 on errors, the directory is shown without children then
+**/
+static int write_lazy_chunk(struct dir_entry *head, struct output_options options, int depth)
+{
+	char path[PATH_MAX];
+	int id = ++lazy_chunk_id;
+	int levels;
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "%s/c%d.js", options.chunk_dir, id);
+
+	fp = fopen(path, "w");
+
+	if (!fp) {
+		printf("Error opening chunk file \"%s\" for writing!\n", path);
+		return 0;
+	}
+
+	if (load_children(head, options) != 0) {
+		fclose(fp);
+		return 0;
+	}
+
+	levels = get_lazy_chunk_levels(head, options, depth);
+
+	fprintf(fp, "bdu.chunk(%d,[", id);
+	for (int i=0;i<head->children_len;i++) {
+		if (i > 0)
+			fprintf(fp, ",");
+
+		fprintf(fp, "[");
+		print_lazy_node(fp, head->children[i], options, depth+1, levels-1);
+		fprintf(fp, "]");
+	}
+	fprintf(fp, "]);\n");
+
+	unload_children(head, options);
+	fclose(fp);
+
+	return id;
+}
+
+/**
+** the number of levels below head written into its chunk. The whole 
+** subtree if it fits, otherwise the cut is made at the level with the 
+** fewest directories, as each of them may need a chunk of its own
+**/
+static int get_lazy_chunk_levels(struct dir_entry *head, struct output_options options, int depth)
+{
+	int levels, prev = 0, best = 1, best_width = INT_MAX;
+
+	for (levels=1;;levels++) {
+		int count = count_lazy_nodes(head, options, depth, levels, LAZY_HTML_CHUNK_NODES);
+
+		if (count == prev)
+			return levels - 1;
+
+		if (count > LAZY_HTML_CHUNK_NODES)
+			return best;
+
+		if (count - prev <= best_width) {
+			best = levels;
+			best_width = count - prev;
+		}
+
+		prev = count;
+	}
+}
+
+/**
+** the number of directories shown in the top levels below head, 
+** counting stops above limit. The children of head are already loaded
+**/
+static int count_lazy_nodes(struct dir_entry *head, struct output_options options, int depth, int levels, int limit)
+{
+	int count = 0;
+
+	if (depth >= options.max_depth && options.max_depth >= 0)
+		return 0;
+
+	for (int i=0;i<head->children_len && count <= limit;i++) {
+		struct dir_entry *child = head->children[i];
+
+		count++;
+
+		if (levels <= 1 || child->children_len == 0 || load_children(child, options) != 0)
+			continue;
+
+		count += count_lazy_nodes(child, options, depth+1, levels-1, limit - count);
+		unload_children(child, options);
+	}
+
+	return count;
+}
+
+/**
+** a javascript string literal. < is escaped too, so a name
+** can`t close the script tag it is in
+**/
+static void print_js_string(FILE *fp, const char *str)
+{
+	fputc('"', fp);
+
+	for (const unsigned char *c = (const unsigned char *)str; *c; c++) {
+		if (*c == '"' || *c == '\\')
+			fprintf(fp, "\\%c", *c);
+		else if (*c < 0x20 || *c == '<')
+			fprintf(fp, "\\u%04x", *c);
+		else 
+			fputc(*c, fp);
+	}
+
+	fputc('"', fp);
+}
@@ -14,9 +14,16 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.  
  */
 
+#include "errlog.h"
+
 #ifndef OUTPUT_H
 #define OUTPUT_H
 
+// the counter displayed as the "size" of an entry in text and html output
+#define OUTPUT_METRIC_BYTES 0
+#define OUTPUT_METRIC_APPARENT 1
+#define OUTPUT_METRIC_INODES 2
+
 struct output_options {
 	int max_depth;
 	long unsigned int show_warn_at_bytes;
@@ -24,8 +31,29 @@ struct output_options {
 	unsigned int no_styles;
 	unsigned int human_readable;
 	unsigned int no_leading_tabs;
+	unsigned int metric;
+	unsigned int by_type;
+	unsigned int by_owner;
+	struct agg_table *breakdown; // --by-type and --by-owner totals of the whole scan
+	int num_age_limits;
+	char **age_limit_names; // --age-buckets limits, as given in the command line
+	struct spill_file *spill; // NULL if nothing was spilled to disk
+	unsigned int deadline; // --deadline was set, entries are marked complete or partial in json
+	double estimate_z; // --estimate, error bounds are printed as z * standard deviation. 0 if not estimating
+	struct err_group *errors; // the failed filesystem operations, grouped (see errlog.h)
+	int errors_len;
+	size_t errors_total;
+	unsigned int grand_total; // -c, csv gets a total column
+	unsigned int json_errors; // --json-errors, json is an object with the errors, even without the breakdowns
+	int lazy_depth; // --lazy-html, the levels written into the html page, 0 = all of them (no chunk files)
+	const char *chunk_dir; // --lazy-html, where the chunk files are written
+	const char *chunk_url; // the same directory, relative to the page
 };
 
 void output_print(FILE *fp, struct dir_entry **entries, int entries_len, const char *format, struct output_options options);
+void output_begin(FILE *fp, const char *format, struct output_options options);
+void output_print_entry(FILE *fp, struct dir_entry *entry, int index, const char *format, struct output_options options);
+void output_print_total(FILE *fp, struct dir_entry *total, int index, const char *format, struct output_options options);
+void output_end(FILE *fp, const char *format, struct output_options options);
 
 #endif //OUTPUT_H
\ No newline at end of file
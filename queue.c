@@ -62,11 +62,41 @@ struct queue_elem *queue_add_elem(struct queue_list *list, void *data)
 	}
 
 	elem->data = data;
+	elem->tag = 0;
 	list->num_elements++;
 	
 	return elem;
 }
 
+/**
+** adds the element to the head of the list, so it is the next one returned
+** by queue_get_next_elem (LIFO)
+**/
+struct queue_elem *queue_push_elem(struct queue_list *list, void *data)
+{
+	struct queue_elem *elem = (struct queue_elem *)malloc(sizeof(struct queue_elem));
+
+	if (!elem) {
+		printf("Error allocating memory for queue element!\n");
+		return NULL;
+	}
+
+	elem->prev = NULL;
+	elem->next = list->head;
+	elem->data = data;
+	elem->tag = 0;
+
+	if (list->head)
+		list->head->prev = elem;
+	else 
+		list->tail = elem;
+
+	list->head = elem;
+	list->num_elements++;
+
+	return elem;
+}
+
 struct queue_elem *queue_get_next_elem(struct queue_list *list)
 {
 	struct queue_elem *elem = NULL;
@@ -110,4 +140,21 @@ void queue_free_elem(struct queue_elem *elem)
 	free(elem);
 
 	return;
+}
+
+/**
+** frees the list and the elements still in it (but not their data)
+**/
+void queue_free_list(struct queue_list *list)
+{
+	struct queue_elem *elem;
+
+	if (!list)
+		return;
+
+	while ((elem = queue_get_next_elem(list)) != NULL)
+		queue_free_elem(elem);
+
+	pthread_mutex_destroy(&list->lock);
+	free(list);
 }
\ No newline at end of file
@@ -23,6 +23,7 @@ struct queue_elem {
 	struct queue_elem *next;
 	struct queue_elem *prev;
 	void *data;
+	int tag; // what data is, up to the user. 0 by default
 };
 
 struct queue_list {
@@ -35,7 +36,9 @@ struct queue_list {
 struct queue_list *queue_new_list();
 struct queue_elem *queue_get_next_elem(struct queue_list *list);
 struct queue_elem *queue_add_elem(struct queue_list *list, void *data);
+struct queue_elem *queue_push_elem(struct queue_list *list, void *data);
 void queue_free_elem(struct queue_elem *elem);
+void queue_free_list(struct queue_list *list);
 
 
 #endif //QUEUE_H
\ No newline at end of file
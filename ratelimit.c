@@ -0,0 +1,76 @@
+/* 
+ * Copyright (C) 2025 Zoltán Rácz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  
+ */
+
+#include <time.h>
+#include <errno.h>
+
+#include "ratelimit.h"
+
+#define NSEC_PER_SEC 1000000000LL
+
+static long long get_time_ns();
+
+/**
+** up to a tenth of a second worth of operations can run back to back, 
+** so idle workers don`t lose their share but the rate stays smooth
+**/
+void ratelimit_init(struct ratelimit *rl, long ops_per_sec)
+{
+	rl->interval = NSEC_PER_SEC / ops_per_sec;
+
+	if (rl->interval < 1)
+		rl->interval = 1;
+
+	rl->burst = NSEC_PER_SEC / 10 > rl->interval ? NSEC_PER_SEC / 10 - rl->interval : 0;
+	rl->tat = get_time_ns();
+}
+
+/**
+** reserves the next slot, and sleeps until it is due
+**/
+void ratelimit_wait(struct ratelimit *rl)
+{
+	long long now = get_time_ns();
+	long long tat = __atomic_load_n(&rl->tat, __ATOMIC_RELAXED);
+	long long slot;
+
+	// an idle limiter doesn`t save up tokens, the slots start from now
+	do {
+		slot = tat > now ? tat : now;
+	} while (!__atomic_compare_exchange_n(&rl->tat, &tat, slot + rl->interval, 
+			1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+	// the slot may be up to burst ahead of the clock without waiting
+	if (slot - rl->burst > now) {
+		struct timespec ts;
+		long long due = slot - rl->burst;
+
+		ts.tv_sec = due / NSEC_PER_SEC;
+		ts.tv_nsec = due % NSEC_PER_SEC;
+
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+			;
+	}
+}
+
+static long long get_time_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
@@ -0,0 +1,34 @@
+/* 
+ * Copyright (C) 2025 Zoltán Rácz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  
+ */
+
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+/**
+** token bucket shared by all the workers, implemented as GCRA: instead of 
+** a token count only the time the next operation is due (tat) is stored, 
+** so taking a token is a single compare-and-swap, without any lock
+**/
+struct ratelimit {
+	long long tat; // theoretical arrival time of the next operation, in ns
+	long long interval; // ns between two operations
+	long long burst; // how far tat may run ahead of the clock without waiting, in ns
+};
+
+void ratelimit_init(struct ratelimit *rl, long ops_per_sec);
+void ratelimit_wait(struct ratelimit *rl);
+
+#endif //RATELIMIT_H
@@ -0,0 +1,1464 @@
+/* 
+ * Copyright (C) 2025 Zoltán Rácz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "bdu.h"
+#include "dir.h"
+#include "queue.h"
+#include "agg.h"
+#include "spill.h"
+#include "estimate.h"
+#include "numa.h"
+#include "fs.h"
+#include "inoset.h"
+#include "checkpoint.h"
+
+// the tags of the queue elements
+#define SCAN_TASK_DIR 0 // a dentry to scan
+#define SCAN_TASK_CHUNK 1 // a dir_chunk to lstat
+#define SCAN_TASK_DIR_HINTED 2 // a dentry to scan, already handed to the prefetcher
+
+// --threads=auto
+#define AUTO_THREADS_START 2 // workers scanning at the start
+#define AUTO_THREADS_INTERVAL_MS 200 // throughput is measured over this long at every level
+#define AUTO_THREADS_EFFICIENCY 0.5 // a step is kept if entries/s change at least half as much as the workers
+#define AUTO_THREADS_HOLD 5 // intervals spent at the chosen level before probing again
+
+// --checkpoint, how often the checkpoint thread looks at the interval and the interrupt flag
+#define CHECKPOINT_POLL_SEC 1
+
+// --prefetch without prefetch_threads: one helper per directory opened ahead, up to this many
+#define PREFETCH_THREADS_MAX 16
+
+/**
+** the state of the --threads=auto hill climbing. From the level that gave
+** the best throughput so far (base_level), it probes a step in direction.
+** A step up is kept if the entries/s grow at least half as much as the 
+** workers (they would grow the same with perfect scaling), a step down if 
+** they drop less than that. Otherwise it goes back, and tries the other
+** way after a pause
+**/
+struct thread_controller {
+	int level; // the workers allowed to scan now
+	int base_level;
+	double base_rate; // entries/s at base_level, 0 = not measured yet
+	int direction; // 1 or -1
+	int hold; // intervals left before probing again
+};
+
+struct bdu_scan {
+	struct bdu_scan_options opts;
+
+	struct dir_entry **roots;
+	int roots_len;
+
+	/**
+	** directories waiting to be scanned. Every root is a separate job with
+	** one list per NUMA node (just one without --numa), the list of root r
+	** on node n is queues[r * num_nodes + n]. Workers take from the jobs in 
+	** turns, and from their own node first. queue_lock protects all the lists,
+	** next_job, queued, active_workers and finished_workers
+	**/
+	pthread_mutex_t queue_lock;
+	struct queue_list **queues;
+	int num_nodes;
+	int next_job;
+	int queued;
+	pthread_cond_t queue_cond;
+	int active_workers;
+	int finished_workers;
+	pthread_cond_t done_cond; // signaled when a worker finishes, bdu_scan_run waits on it with an executor
+
+	pthread_t *threads;
+	struct thread_data *threads_data;
+
+	struct agg_table *breakdown;
+
+	// --memory-limit
+	size_t mem_used;
+	struct spill_file *spill;
+
+	// --deadline
+	struct timespec deadline_at;
+	int expired;
+
+	// --cpus and --numa, NULL/0 if the workers are not pinned
+	struct numa_topology *topo;
+	int *cpus;
+	int cpus_len;
+
+	struct fs_backend *throttle_fs; // --max-ops, wraps opts.dir.fs
+	struct fs_backend *prefetch_fs; // --prefetch, wraps opts.dir.fs (and throttle_fs)
+	struct ino_set *visited; // --dedupe-dirs and -L, opts.dir.visited
+
+	/**
+	** --threads=auto: only the workers with thread_id < worker_limit scan, 
+	** the rest wait on park_cond. The controller thread moves the limit 
+	** by the measured throughput. All of them are protected by queue_lock
+	**/
+	int worker_limit;
+	pthread_cond_t park_cond;
+	pthread_t controller;
+	pthread_cond_t ctl_cond; // wakes the controller up to stop
+	int ctl_stop;
+	int adjustments;
+
+	/**
+	** --checkpoint: the checkpoint thread pauses the workers between two 
+	** tasks, and saves the tree while none of them is active. paused and 
+	** stopped are protected by queue_lock
+	**/
+	pthread_t checkpointer;
+	pthread_cond_t pause_cond;
+	pthread_cond_t ckpt_cond; // wakes the checkpoint thread up to stop
+	int ckpt_stop;
+	int paused;
+	int stopped; // interrupted, the workers exit and leave the queue as it is
+
+	unsigned long run_ns; // the time spent in bdu_scan_run, for --stats
+	time_t started_at; // when bdu_scan_run started, for bdu_scan_reuse
+
+	// the errors of all the workers grouped, made by bdu_scan_get_errors
+	struct err_group *errors;
+	int errors_len;
+};
+
+static void scan_worker(void *arg);
+static void *scan_thread_fn(void *arg);
+static void subdir_scan_callback(struct dir_entry *d, struct thread_data *tdata);
+static void chunk_scan_callback(struct dir_chunk *chunk, struct thread_data *tdata);
+static void dir_complete_callback(struct dir_entry *d, void *data);
+static int merge_breakdowns(struct bdu_scan *scan);
+static void release_completed(struct bdu_scan *scan, struct dir_entry *d);
+static int deadline_passed(struct bdu_scan *scan);
+static void skip_dentry(struct bdu_scan *scan, struct dir_entry *d);
+static int init_placement(struct bdu_scan *scan);
+static struct queue_elem *get_next_elem(struct bdu_scan *scan, struct thread_data *tdata);
+static int set_io_priority(int io_class, int io_level);
+static void *controller_thread_fn(void *arg);
+static int controller_next_level(struct thread_controller *ctl, double rate, int max_level);
+static int controller_probe(struct thread_controller *ctl, int max_level);
+static unsigned long get_ns();
+static int add_job(struct bdu_scan *scan, struct dir_entry *d);
+static int get_job(struct bdu_scan *scan, struct dir_entry *d);
+static void *checkpoint_thread_fn(void *arg);
+static void prefetch_queued(struct bdu_scan *scan, struct queue_list *list);
+static int write_checkpoint(struct bdu_scan *scan);
+
+struct bdu_scan *bdu_scan_new(const struct bdu_scan_options *opts)
+{
+	struct bdu_scan *scan = (struct bdu_scan *)calloc(1, sizeof(struct bdu_scan));
+
+	if (!scan) {
+		printf("Error allocating memory for scan!\n");
+		return NULL;
+	}
+
+	scan->opts = *opts;
+
+	if (scan->opts.num_threads <= 0)
+		scan->opts.num_threads = 1;
+
+	// file events are delivered directly from dir_scan
+	if (scan->opts.callbacks.file) {
+		scan->opts.dir.file_fn = scan->opts.callbacks.file;
+		scan->opts.dir.file_fn_data = scan->opts.callbacks.user_data;
+	}
+
+	/**
+	** the rate limit is shared by all the workers, so it wraps the 
+	** backend instead of being checked in the workers
+	**/
+	if (scan->opts.max_ops > 0) {
+		scan->throttle_fs = fs_throttle_new(scan->opts.dir.fs ? scan->opts.dir.fs : &fs_posix_backend, scan->opts.max_ops);
+
+		if (!scan->throttle_fs) {
+			free(scan);
+			return NULL;
+		}
+
+		scan->opts.dir.fs = scan->throttle_fs;
+	}
+
+	/**
+	** the helpers open the directories at the front of the queue, so the
+	** workers don`t wait for opendir and the first readdir. Their opens
+	** count in --max-ops too
+	**/
+	if (scan->opts.prefetch_depth > 0) {
+		int capacity = scan->opts.prefetch_depth * scan->opts.num_threads;
+		int threads = scan->opts.prefetch_threads;
+
+		if (threads <= 0)
+			threads = capacity < PREFETCH_THREADS_MAX ? capacity : PREFETCH_THREADS_MAX;
+
+		scan->prefetch_fs = fs_prefetch_new(scan->opts.dir.fs ? scan->opts.dir.fs : &fs_posix_backend, threads, capacity);
+
+		if (!scan->prefetch_fs) {
+			fs_throttle_free(scan->throttle_fs);
+			free(scan);
+			return NULL;
+		}
+
+		scan->opts.dir.fs = scan->prefetch_fs;
+	}
+
+	// splitting large directories only helps if there are other workers to take the chunks
+	if (scan->opts.dir.chunk_size > 0 && scan->opts.num_threads > 1)
+		scan->opts.dir.chunk_fn = chunk_scan_callback;
+
+	// the per entry loop of the workers, picked for all the options above
+	scan->opts.dir.kernel = dir_select_kernel(&scan->opts.dir) + 1;
+
+	pthread_mutex_init(&scan->queue_lock, NULL);
+	pthread_cond_init(&scan->queue_cond, NULL);
+	pthread_cond_init(&scan->done_cond, NULL);
+	pthread_cond_init(&scan->park_cond, NULL);
+	pthread_cond_init(&scan->pause_cond, NULL);
+
+	// the controller waits with timeouts, which shouldn`t jump with the wall clock
+	pthread_condattr_t attr;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&scan->ctl_cond, &attr);
+	pthread_cond_init(&scan->ckpt_cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	// following symlinks can lead into loops, so it needs the visited set too
+	if (scan->opts.dedupe_dirs || scan->opts.dir.dereference) {
+		scan->visited = ino_set_new();
+
+		if (!scan->visited) {
+			bdu_scan_free(scan);
+			return NULL;
+		}
+
+		scan->opts.dir.visited = scan->visited;
+	}
+
+	if (init_placement(scan) != 0) {
+		bdu_scan_free(scan);
+		return NULL;
+	}
+
+	if (scan->opts.memory_limit) {
+		scan->spill = spill_new();
+
+		if (!scan->spill) {
+			bdu_scan_free(scan);
+			return NULL;
+		}
+
+		scan->opts.dir.mem_used = &scan->mem_used;
+	}
+
+	return scan;
+}
+
+int bdu_scan_add_root(struct bdu_scan *scan, const char *path)
+{
+	struct dir_entry *d = dir_create_dentry((char *)path);
+	int job;
+
+	if (!d) {
+		printf("Error allocating memory for root entry!\n");
+		return -1;
+	}
+
+	job = add_job(scan, d);
+
+	if (job < 0) {
+		dir_free_entry(d);
+		return -1;
+	}
+
+	// the roots are spread over the nodes, so every node starts with some work
+	pthread_mutex_lock(&scan->queue_lock);
+	queue_add_elem(scan->queues[job * scan->num_nodes + job % scan->num_nodes], d);
+	scan->queued++;
+	pthread_mutex_unlock(&scan->queue_lock);
+
+	return 0;
+}
+
+/**
+** adds the roots of a checkpoint (--resume), and queues the directories 
+** and chunks that were waiting in it. The roots completed already are
+** reported to dir_complete when bdu_scan_run starts
+**/
+int bdu_scan_resume(struct bdu_scan *scan, const char *checkpoint_path)
+{
+	struct checkpoint_state state;
+	int max_depth = scan->opts.dir.max_depth;
+	int added = 0;
+	int ret = 0;
+	int i;
+
+	if (checkpoint_read(checkpoint_path, &state) != 0)
+		return -1;
+
+	/**
+	** the age buckets are counted relative to the start of the first run, 
+	** and the children below the displayed depth are not in the checkpoint
+	**/
+	if (state.num_age_limits != scan->opts.dir.num_age_limits) {
+		printf("The checkpoint was made with a different --age-buckets!\n");
+		ret = -1;
+	}
+	else if (state.max_depth >= 0 && (max_depth < 0 || max_depth > state.max_depth)) {
+		printf("The checkpoint was made with --max-depth=%d, it can`t be resumed with a deeper one!\n", state.max_depth);
+		ret = -1;
+	}
+
+	scan->opts.dir.now = state.now;
+
+	while (ret == 0 && added < state.roots_len) {
+		if (add_job(scan, state.roots[added]) < 0)
+			ret = -1;
+		else 
+			added++;
+	}
+
+	if (ret != 0) {
+		// the ones added belong to the scan now
+		for (i = added; i < state.roots_len; i++)
+			dir_free_entry(state.roots[i]);
+
+		for (i = 0; i < state.chunks_len; i++)
+			dir_free_chunk(state.chunks[i]);
+
+		checkpoint_free_state(&state);
+		return -1;
+	}
+
+	pthread_mutex_lock(&scan->queue_lock);
+
+	for (i = 0; i < state.queued_len && ret == 0; i++) {
+		int job = get_job(scan, state.queued[i]);
+
+		if (!queue_add_elem(scan->queues[job * scan->num_nodes + job % scan->num_nodes], state.queued[i]))
+			ret = -1;
+		else 
+			scan->queued++;
+	}
+
+	for (i = 0; i < state.chunks_len; i++) {
+		int job = get_job(scan, state.chunks[i]->dentry);
+		struct queue_elem *elem = ret == 0 ? queue_push_elem(scan->queues[job * scan->num_nodes + job % scan->num_nodes], state.chunks[i]) : NULL;
+
+		if (!elem) {
+			dir_free_chunk(state.chunks[i]);
+			ret = -1;
+			continue;
+		}
+
+		elem->tag = SCAN_TASK_CHUNK;
+		scan->queued++;
+	}
+
+	pthread_mutex_unlock(&scan->queue_lock);
+
+	checkpoint_free_state(&state);
+
+	return ret;
+}
+
+/**
+** lets the next scan of the same roots skip the directories not modified
+** since prev (a finished scan) started: their files are counted with the 
+** totals they had in prev, only their subdirectories are looked at again.
+** The roots are matched in the order they were added. prev must not be 
+** freed before bdu_scan_run of scan returns
+**/
+int bdu_scan_reuse(struct bdu_scan *scan, struct bdu_scan *prev)
+{
+	// the children of prev have to be the real ones, all of them
+	if (!prev->started_at || prev->stopped || prev->spill || prev->opts.threshold || prev->opts.min_inodes || 
+			prev->opts.dir.sample_rate > 0)
+		return -1;
+
+	for (int i = 0; i < scan->roots_len && i < prev->roots_len; i++) {
+		if (strcmp(scan->roots[i]->path, prev->roots[i]->path) == 0)
+			scan->roots[i]->prev = prev->roots[i];
+	}
+
+	scan->opts.dir.reuse_before = prev->started_at;
+
+	return 0;
+}
+
+/**
+** scans all the roots added so far, and returns when everything is done.
+** If it returns -1, the scan may be left half set up: only bdu_scan_free
+** can be called on it then
+**/
+int bdu_scan_run(struct bdu_scan *scan)
+{
+	int num_threads = scan->opts.num_threads;
+	int threads_created = 0;
+	unsigned long started = get_ns();
+	int ret = 0;
+
+	scan->started_at = time(NULL);
+	scan->threads = calloc(num_threads, sizeof(pthread_t));
+	scan->threads_data = calloc(num_threads, sizeof(struct thread_data));
+
+	if (!scan->threads || !scan->threads_data) {
+		printf("Error allocating memory for worker threads!\n");
+		return -1;
+	}
+
+	scan->finished_workers = 0;
+	scan->worker_limit = num_threads;
+
+	if (scan->opts.auto_threads)
+		scan->worker_limit = num_threads < AUTO_THREADS_START ? num_threads : AUTO_THREADS_START;
+
+	if (scan->opts.deadline > 0) {
+		clock_gettime(CLOCK_MONOTONIC, &scan->deadline_at);
+		scan->deadline_at.tv_sec += scan->opts.deadline;
+	}
+
+	for (int i = 0; i < num_threads; i++) {
+		struct thread_data *tdata = &scan->threads_data[i];
+
+		tdata->thread_id = i;
+		tdata->scan = scan;
+		tdata->cpu = -1;
+		tdata->node = 0;
+
+		/**
+		** workers are assigned to the CPUs in order, filling up a node 
+		** before moving on to the next one (with --numa)
+		**/
+		if (scan->cpus_len) {
+			tdata->cpu = scan->cpus[i % scan->cpus_len];
+			tdata->node = numa_get_cpu_node(scan->topo, tdata->cpu) % scan->num_nodes;
+		}
+
+		/**
+		** every worker collects the --by-type and --by-owner totals 
+		** in its own table, they are merged only once, after the scan
+		**/
+		if (scan->opts.dir.by_type || scan->opts.dir.by_owner) {
+			tdata->breakdown = agg_new_table();
+			if (!tdata->breakdown)
+				return -1;
+		}
+
+		tdata->errors = errlog_new_ring();
+
+		if (!tdata->errors)
+			return -1;
+	}
+
+	// roots completed before the checkpoint they were resumed from
+	for (int i = 0; i < scan->roots_len; i++) {
+		if (scan->roots[i]->pending == 0)
+			dir_complete_callback(scan->roots[i], scan);
+	}
+
+	for (int i = 0; i < num_threads; i++) {
+		if (scan->opts.executor.submit) {
+			if (scan->opts.executor.submit(scan_worker, &scan->threads_data[i], scan->opts.executor.pool) != 0) {
+				/**
+				** the workers already submitted can finish the scan alone, 
+				** we only have to stop waiting for the missing ones
+				**/
+				printf("Error submitting scan worker to the thread pool!\n");
+
+				pthread_mutex_lock(&scan->queue_lock);
+				scan->finished_workers += num_threads - i;
+				pthread_mutex_unlock(&scan->queue_lock);
+
+				if (i == 0)
+					return -1;
+				break;
+			}
+		}
+		else {
+			int err = pthread_create(&scan->threads[i], NULL, scan_thread_fn, &scan->threads_data[i]);
+
+			// like above, the threads created can finish the scan, only they are joined
+			if (err != 0) {
+				printf("Error creating scan worker thread (%s)!\n", strerror(err));
+
+				if (i == 0)
+					return -1;
+				break;
+			}
+
+			threads_created++;
+		}
+	}
+
+	if (scan->opts.auto_threads) {
+		scan->ctl_stop = 0;
+
+		if (pthread_create(&scan->controller, NULL, controller_thread_fn, scan) != 0) {
+			// the workers already started can still finish the scan
+			printf("Error starting the --threads=auto controller!\n");
+
+			pthread_mutex_lock(&scan->queue_lock);
+			scan->worker_limit = num_threads;
+			pthread_cond_broadcast(&scan->park_cond);
+			pthread_mutex_unlock(&scan->queue_lock);
+
+			scan->opts.auto_threads = 0;
+		}
+	}
+
+	if (scan->opts.checkpoint_path) {
+		scan->ckpt_stop = 0;
+
+		if (pthread_create(&scan->checkpointer, NULL, checkpoint_thread_fn, scan) != 0) {
+			printf("Error starting the checkpoint thread!\n");
+			scan->opts.checkpoint_path = NULL;
+		}
+	}
+
+	if (scan->opts.executor.submit) {
+		pthread_mutex_lock(&scan->queue_lock);
+		while (scan->finished_workers < num_threads)
+			pthread_cond_wait(&scan->done_cond, &scan->queue_lock);
+		pthread_mutex_unlock(&scan->queue_lock);
+	}
+	else {
+		for (int i = 0; i < threads_created; i++)
+			pthread_join(scan->threads[i], NULL);
+	}
+
+	if (scan->opts.auto_threads) {
+		pthread_mutex_lock(&scan->queue_lock);
+		scan->ctl_stop = 1;
+		pthread_cond_signal(&scan->ctl_cond);
+		pthread_mutex_unlock(&scan->queue_lock);
+
+		pthread_join(scan->controller, NULL);
+	}
+
+	if (scan->opts.checkpoint_path) {
+		pthread_mutex_lock(&scan->queue_lock);
+		scan->ckpt_stop = 1;
+		pthread_cond_signal(&scan->ckpt_cond);
+		pthread_mutex_unlock(&scan->queue_lock);
+
+		pthread_join(scan->checkpointer, NULL);
+
+		if (scan->stopped)
+			return BDU_SCAN_INTERRUPTED;
+
+		// a complete scan has nothing left to resume
+		unlink(scan->opts.checkpoint_path);
+	}
+
+	scan->run_ns = get_ns() - started;
+
+	if (scan->opts.dir.by_type || scan->opts.dir.by_owner)
+		ret = merge_breakdowns(scan);
+
+	return ret;
+}
+
+struct dir_entry **bdu_scan_get_roots(struct bdu_scan *scan, int *roots_len)
+{
+	*roots_len = scan->roots_len;
+	return scan->roots;
+}
+
+struct agg_table *bdu_scan_get_breakdown(struct bdu_scan *scan)
+{
+	return scan->breakdown;
+}
+
+struct spill_file *bdu_scan_get_spill(struct bdu_scan *scan)
+{
+	return scan->spill;
+}
+
+int bdu_scan_get_active_workers(struct bdu_scan *scan)
+{
+	int num = 0;
+
+	pthread_mutex_lock(&scan->queue_lock);
+	num = scan->active_workers;
+	pthread_mutex_unlock(&scan->queue_lock);
+
+	return num;
+}
+
+/**
+** the number of directories skipped because the deadline ran out. 
+** If it is not 0, the totals of their parents are partial
+**/
+size_t bdu_scan_get_unscanned(struct bdu_scan *scan)
+{
+	size_t num = 0;
+
+	for (int i = 0; i < scan->roots_len; i++)
+		num += scan->roots[i]->totals.unscanned_dirs;
+
+	return num;
+}
+
+void bdu_scan_get_stats(struct bdu_scan *scan, struct bdu_scan_stats *stats)
+{
+	unsigned long busy_ns = 0;
+
+	memset(stats, 0, sizeof(struct bdu_scan_stats));
+
+	for (int i = 0; scan->threads_data && i < scan->opts.num_threads; i++) {
+		stats->entries += scan->threads_data[i].entries;
+		stats->reused += scan->threads_data[i].reused;
+		busy_ns += scan->threads_data[i].busy_ns;
+	}
+
+	stats->elapsed = scan->run_ns / 1e9;
+	stats->entry_us = stats->entries ? busy_ns / 1e3 / stats->entries : 0;
+	stats->workers = scan->worker_limit;
+	stats->max_workers = scan->opts.num_threads;
+	stats->adjustments = scan->adjustments;
+
+	if (scan->prefetch_fs)
+		stats->prefetched = fs_prefetch_get_hits(scan->prefetch_fs);
+}
+
+/**
+** the failed opendir, readdir and lstat calls of the scan grouped by 
+** operation, errno and directory. total is the number of all the errors,
+** the groups only contain the last ERRLOG_RING_SIZE of every worker
+**/
+struct err_group *bdu_scan_get_errors(struct bdu_scan *scan, int *groups_len, size_t *total)
+{
+	struct err_ring **rings;
+
+	*total = 0;
+	*groups_len = 0;
+
+	if (!scan->threads_data)
+		return NULL;
+
+	for (int i = 0; i < scan->opts.num_threads; i++)
+		*total += scan->threads_data[i].errors ? scan->threads_data[i].errors->total : 0;
+
+	if (!scan->errors && *total > 0) {
+		rings = malloc(scan->opts.num_threads * sizeof(struct err_ring *));
+
+		if (!rings) {
+			printf("Error allocating memory for error groups!\n");
+			return NULL;
+		}
+
+		for (int i = 0; i < scan->opts.num_threads; i++)
+			rings[i] = scan->threads_data[i].errors;
+
+		scan->errors = errlog_get_groups(rings, scan->opts.num_threads, &scan->errors_len);
+		free(rings);
+	}
+
+	*groups_len = scan->errors_len;
+
+	return scan->errors;
+}
+
+void bdu_scan_free(struct bdu_scan *scan)
+{
+	if (!scan)
+		return;
+
+	if (scan->roots_len)
+		dir_free_entries(scan->roots, scan->roots_len);
+
+	if (scan->threads_data) {
+		for (int i = 0; i < scan->opts.num_threads; i++) {
+			agg_free_table(scan->threads_data[i].breakdown);
+			errlog_free_ring(scan->threads_data[i].errors);
+		}
+	}
+
+	errlog_free_groups(scan->errors, scan->errors_len);
+
+	agg_free_table(scan->breakdown);
+
+	free(scan->threads);
+	free(scan->threads_data);
+
+	spill_free(scan->spill);
+
+	for (int i = 0; i < scan->roots_len * scan->num_nodes; i++) {
+		// chunks are only left in the queue if the scan was interrupted
+		for (struct queue_elem *elem = scan->queues[i]->head; elem; elem = elem->next) {
+			if (elem->tag == SCAN_TASK_CHUNK)
+				dir_free_chunk((struct dir_chunk *)elem->data);
+		}
+
+		queue_free_list(scan->queues[i]);
+	}
+
+	free(scan->queues);
+	free(scan->cpus);
+	fs_prefetch_free(scan->prefetch_fs);
+	fs_throttle_free(scan->throttle_fs);
+	ino_set_free(scan->visited);
+	numa_free_topology(scan->topo);
+
+	pthread_cond_destroy(&scan->queue_cond);
+	pthread_cond_destroy(&scan->done_cond);
+	pthread_cond_destroy(&scan->park_cond);
+	pthread_cond_destroy(&scan->ctl_cond);
+	pthread_cond_destroy(&scan->pause_cond);
+	pthread_cond_destroy(&scan->ckpt_cond);
+	pthread_mutex_destroy(&scan->queue_lock);
+
+	free(scan);
+}
+
+static void *scan_thread_fn(void *arg)
+{
+	scan_worker(arg);
+	return NULL;
+}
+
+/**
+** takes directories from the queue until it is empty and no other worker 
+** is scanning (which could still add new subdirectories to it)
+**/
+static void scan_worker(void *arg)
+{
+	struct thread_data *tdata = (struct thread_data *)arg;
+	struct bdu_scan *scan = tdata->scan;
+	struct queue_elem *elem = NULL;
+	struct dir_entry *dentry = NULL;
+
+	/**
+	** pinned here and not at thread creation, so it works for the 
+	** threads of an executor too. The memory policy is per thread as well
+	**/
+	if (tdata->cpu >= 0) {
+		numa_pin_thread(tdata->cpu);
+		numa_set_mempolicy(scan->opts.numa, scan->topo, scan->cpus, scan->cpus_len);
+	}
+
+	if (scan->opts.io_class != IO_CLASS_NONE)
+		set_io_priority(scan->opts.io_class, scan->opts.io_level);
+
+	while (1) {
+		pthread_mutex_lock(&scan->queue_lock);
+
+		/**
+		** parked workers (--threads=auto) wait on their own condition, 
+		** so the signals of new directories only wake the scanning ones.
+		** While a checkpoint is written none of them starts a new task,
+		** the tree must not change under it
+		**/
+		while (!scan->stopped) {
+			if (tdata->thread_id >= scan->worker_limit && (scan->queued > 0 || scan->active_workers > 0)) {
+				/**
+				** the signal of a queued directory may have woken this one 
+				** instead of a scanning worker, it is passed on before parking
+				**/
+				if (scan->queued > 0)
+					pthread_cond_signal(&scan->queue_cond);
+
+				pthread_cond_wait(&scan->park_cond, &scan->queue_lock);
+			}
+			else if (scan->paused)
+				pthread_cond_wait(&scan->pause_cond, &scan->queue_lock);
+			else if (scan->queued == 0 && scan->active_workers > 0)
+				pthread_cond_wait(&scan->queue_cond, &scan->queue_lock);
+			else 
+				break;
+		}
+
+		elem = scan->stopped ? NULL : get_next_elem(scan, tdata);
+
+		if (elem && scan->prefetch_fs)
+			prefetch_queued(scan, tdata->list);
+
+		if (!elem) {
+			// nothing left to scan, waking up the others so they can exit too
+			scan->finished_workers++;
+			pthread_cond_broadcast(&scan->queue_cond);
+			pthread_cond_signal(&scan->done_cond);
+			pthread_cond_broadcast(&scan->park_cond);
+			pthread_mutex_unlock(&scan->queue_lock);
+			return;
+		}
+
+		scan->active_workers++;
+		pthread_mutex_unlock(&scan->queue_lock);
+
+		unsigned long started = get_ns();
+
+		/**
+		** files of a large directory. The chunk holds a reference of the
+		** directory until they are added to its totals. After the deadline 
+		** the rest of the queue is drained without scanning, so the totals
+		** collected so far complete quickly
+		**/
+		if (elem->tag == SCAN_TASK_CHUNK) {
+			struct dir_chunk *chunk = (struct dir_chunk *)elem->data;
+
+			dentry = chunk->dentry;
+			dir_stat_chunk(chunk, &scan->opts.dir, tdata);
+			dir_free_chunk(chunk);
+		}
+		else {
+			dentry = (struct dir_entry *)elem->data;
+
+			if (deadline_passed(scan))
+				skip_dentry(scan, dentry);
+			else 
+				dir_scan(dentry, subdir_scan_callback, &scan->opts.dir, tdata);
+		}
+
+		__atomic_add_fetch(&tdata->busy_ns, get_ns() - started, __ATOMIC_RELAXED);
+
+		queue_free_elem(elem);
+
+		dir_release_dentry(dentry, dir_complete_callback, scan);
+
+		pthread_mutex_lock(&scan->queue_lock);
+		scan->active_workers--;
+
+		if (scan->active_workers == 0 && scan->queued == 0) {
+			pthread_cond_broadcast(&scan->queue_cond);
+			pthread_cond_broadcast(&scan->park_cond);
+		}
+
+		// the last one lets the checkpoint thread write
+		if (scan->active_workers == 0 && scan->paused)
+			pthread_cond_broadcast(&scan->pause_cond);
+
+		pthread_mutex_unlock(&scan->queue_lock);
+	}
+}
+
+/**
+** takes the next directory from the jobs (roots) in turns, so the workers
+** are shared fairly and small roots finish early. Within a job the worker`s
+** own node comes first, the others are only stolen from if that is empty. 
+** Called with queue_lock held
+**/
+static struct queue_elem *get_next_elem(struct bdu_scan *scan, struct thread_data *tdata)
+{
+	struct queue_elem *elem = NULL;
+
+	for (int j = 0; j < scan->roots_len && !elem; j++) {
+		int job = (scan->next_job + j) % scan->roots_len;
+
+		for (int i = 0; i < scan->num_nodes && !elem; i++)
+			elem = queue_get_next_elem(scan->queues[job * scan->num_nodes + (tdata->node + i) % scan->num_nodes]);
+
+		if (elem) {
+			scan->next_job = job + 1;
+			scan->queued--;
+
+			// subdirectories of this directory go to the same list
+			tdata->list = scan->queues[job * scan->num_nodes + tdata->node];
+		}
+	}
+
+	return elem;
+}
+
+/**
+** chunks go to the front of the list, so idle workers pick them up 
+** while the reader of the directory is still going
+**/
+static void chunk_scan_callback(struct dir_chunk *chunk, struct thread_data *tdata)
+{
+	struct bdu_scan *scan = tdata->scan;
+	struct queue_elem *elem;
+
+	pthread_mutex_lock(&scan->queue_lock);
+
+	elem = queue_push_elem(tdata->list, chunk);
+
+	if (elem) {
+		elem->tag = SCAN_TASK_CHUNK;
+		scan->queued++;
+		pthread_cond_signal(&scan->queue_cond);
+	}
+
+	pthread_mutex_unlock(&scan->queue_lock);
+
+	// the files are not lost if the chunk can`t be queued
+	if (!elem) {
+		struct dir_entry *dentry = chunk->dentry;
+
+		dir_stat_chunk(chunk, &scan->opts.dir, tdata);
+		dir_free_chunk(chunk);
+
+		// the reader still holds its own reference, so this can`t complete it
+		__atomic_sub_fetch(&dentry->pending, 1, __ATOMIC_RELAXED);
+	}
+}
+
+/**
+** subdirectories found by a worker are queued on its own node, 
+** where their dentries were allocated
+**/
+static void subdir_scan_callback(struct dir_entry *d, struct thread_data *tdata)
+{
+	struct bdu_scan *scan = tdata->scan;
+	struct queue_elem *elem;
+
+	pthread_mutex_lock(&scan->queue_lock);
+
+	/**
+	** with --memory-limit (and --threshold) the tree is scanned depth first,
+	** so subtrees complete (and can be spilled or folded) early, instead of
+	** all at the end
+	**/
+	if (scan->spill || scan->opts.threshold || scan->opts.min_inodes)
+		elem = queue_push_elem(tdata->list, d);
+	else 
+		elem = queue_add_elem(tdata->list, d);
+
+	if (elem) {
+		scan->queued++;
+		pthread_cond_signal(&scan->queue_cond);
+	}
+
+	pthread_mutex_unlock(&scan->queue_lock);
+
+	/**
+	** a directory that can`t be queued is not scanned, it is reported 
+	** and marked unscanned, and its own reference is dropped so its 
+	** parents can still complete. The reader still holds the parent
+	**/
+	if (!elem) {
+		errlog_add(tdata->errors, ERRLOG_OPENDIR, ENOMEM, d->path);
+		skip_dentry(scan, d);
+		dir_release_dentry(d, dir_complete_callback, scan);
+	}
+}
+
+static void dir_complete_callback(struct dir_entry *d, void *data)
+{
+	struct bdu_scan *scan = (struct bdu_scan *)data;
+
+	// the children are final now, so the sampled totals can be extrapolated
+	if (scan->opts.dir.sample_rate > 0)
+		estimate_complete_dentry(d);
+
+	/**
+	** the small children are final as well, and folded before anyone 
+	** sees them. Their subtrees are freed right away
+	**/
+	if (scan->opts.threshold || scan->opts.min_inodes) {
+		size_t freed = dir_fold_children(d, scan->opts.threshold, scan->opts.threshold_apparent, scan->opts.min_inodes);
+
+		if (scan->spill)
+			__atomic_sub_fetch(&scan->mem_used, freed, __ATOMIC_RELAXED);
+	}
+
+	if (scan->opts.callbacks.dir_complete)
+		scan->opts.callbacks.dir_complete(d, scan->opts.callbacks.user_data);
+
+	if (scan->spill)
+		release_completed(scan, d);
+}
+
+/**
+** with --memory-limit the children of completed directories don`t have to 
+** stay in memory. The ones below the displayed depth are dropped, the rest 
+** are moved to the spill file when the tree grows over the limit
+**/
+static void release_completed(struct bdu_scan *scan, struct dir_entry *d)
+{
+	size_t freed = 0;
+
+	if (!d->children)
+		return;
+
+	if (scan->opts.dir.max_depth >= 0 && d->depth >= scan->opts.dir.max_depth) {
+		freed = dir_get_children_mem_size(d);
+
+		dir_free_entries(d->children, d->children_len);
+		d->children = NULL;
+		d->children_len = 0;
+	}
+	else if (__atomic_load_n(&scan->mem_used, __ATOMIC_RELAXED) > scan->opts.memory_limit) {
+		if (spill_write_children(scan->spill, d, scan->opts.sort_flags, &freed) != 0)
+			return;
+	}
+
+	__atomic_sub_fetch(&scan->mem_used, freed, __ATOMIC_RELAXED);
+}
+
+static int deadline_passed(struct bdu_scan *scan)
+{
+	struct timespec now;
+
+	if (scan->opts.deadline <= 0)
+		return 0;
+
+	if (__atomic_load_n(&scan->expired, __ATOMIC_RELAXED))
+		return 1;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	if (now.tv_sec < scan->deadline_at.tv_sec || 
+			(now.tv_sec == scan->deadline_at.tv_sec && now.tv_nsec < scan->deadline_at.tv_nsec))
+		return 0;
+
+	__atomic_store_n(&scan->expired, 1, __ATOMIC_RELAXED);
+
+	return 1;
+}
+
+/**
+** counts the directory as unscanned in itself and all its parents, 
+** which marks their totals as partial
+**/
+static void skip_dentry(struct bdu_scan *scan, struct dir_entry *d)
+{
+	struct dir_totals totals;
+
+	memset(&totals, 0, sizeof(struct dir_totals));
+	totals.unscanned_dirs = 1;
+
+	dir_add_scanned_totals(d, &totals, &scan->opts.dir);
+}
+
+/**
+** sets the I/O scheduling class of the calling thread (ioprio_set has 
+** no glibc wrapper). Only schedulers like BFQ act on it
+**/
+static int set_io_priority(int io_class, int io_level)
+{
+	int ioprio = (io_class << 13) | (io_class == IO_CLASS_BEST_EFFORT ? io_level : 0);
+
+	// IOPRIO_WHO_PROCESS with 0 is the calling thread
+	if (syscall(SYS_ioprio_set, 1, 0, ioprio) != 0) {
+		printf("Error setting I/O priority (%s)\n", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+** --cpus pins the workers to the listed CPUs. --numa pins them too (to all 
+** the CPUs, node by node, if --cpus is not set) and gives every node its own queue
+**/
+static int init_placement(struct bdu_scan *scan)
+{
+	scan->num_nodes = 1;
+
+	if (!scan->opts.cpus_len && scan->opts.numa == NUMA_NONE)
+		return 0;
+
+	scan->topo = numa_get_topology();
+
+	if (!scan->topo)
+		return -1;
+
+	if (scan->opts.cpus_len) {
+		scan->cpus = malloc(scan->opts.cpus_len * sizeof(int));
+
+		if (!scan->cpus) {
+			printf("Error allocating memory for CPU list!\n");
+			return -1;
+		}
+
+		memcpy(scan->cpus, scan->opts.cpus, scan->opts.cpus_len * sizeof(int));
+		scan->cpus_len = scan->opts.cpus_len;
+	}
+	else {
+		scan->cpus_len = numa_get_node_cpus(scan->topo, &scan->cpus);
+
+		if (scan->cpus_len <= 0)
+			return -1;
+	}
+
+	if (scan->opts.numa != NUMA_NONE)
+		scan->num_nodes = scan->topo->num_nodes;
+
+	return 0;
+}
+
+/**
+** merges the per thread --by-type and --by-owner tables into scan->breakdown 
+** and into the tables of the displayed directories
+**/
+static int merge_breakdowns(struct bdu_scan *scan)
+{
+	struct agg_table *merged = agg_new_table();
+	int ret = 0;
+
+	scan->breakdown = agg_new_table();
+
+	if (!merged || !scan->breakdown) {
+		agg_free_table(merged);
+		return -1;
+	}
+
+	for (int i = 0; i < scan->opts.num_threads; i++) {
+		if (agg_merge(merged, scan->threads_data[i].breakdown) != 0)
+			ret = -1;
+
+		agg_free_table(scan->threads_data[i].breakdown);
+		scan->threads_data[i].breakdown = NULL;
+	}
+
+	if (ret == 0)
+		ret = agg_rollup(merged, scan->breakdown);
+
+	agg_free_table(merged);
+
+	return ret;
+}
+
+/**
+** --threads=auto: measures the entries/s of all the workers every 
+** AUTO_THREADS_INTERVAL_MS, and moves worker_limit with the hill climbing
+** of controller_next_level, until bdu_scan_run stops it
+**/
+static void *controller_thread_fn(void *arg)
+{
+	struct bdu_scan *scan = (struct bdu_scan *)arg;
+	struct thread_controller ctl = {0};
+	size_t last_entries = 0;
+	unsigned long last_ns = get_ns();
+	struct timespec ts;
+
+	pthread_mutex_lock(&scan->queue_lock);
+
+	ctl.level = scan->worker_limit;
+	ctl.direction = 1;
+
+	while (!scan->ctl_stop) {
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		ts.tv_nsec += AUTO_THREADS_INTERVAL_MS * 1000000L;
+		ts.tv_sec += ts.tv_nsec / 1000000000L;
+		ts.tv_nsec %= 1000000000L;
+
+		while (!scan->ctl_stop && pthread_cond_timedwait(&scan->ctl_cond, &scan->queue_lock, &ts) != ETIMEDOUT)
+			;
+
+		if (scan->ctl_stop)
+			break;
+
+		size_t entries = 0;
+		unsigned long now = get_ns();
+
+		for (int i = 0; i < scan->opts.num_threads; i++)
+			entries += __atomic_load_n(&scan->threads_data[i].entries, __ATOMIC_RELAXED);
+
+		double rate = (entries - last_entries) / ((now - last_ns) / 1e9);
+
+		last_entries = entries;
+		last_ns = now;
+
+		/**
+		** with an empty queue the workers wait for directories, not for
+		** the storage, so the interval says nothing about the level
+		**/
+		if (scan->queued == 0 || rate == 0)
+			continue;
+
+		int level = controller_next_level(&ctl, rate, scan->opts.num_threads);
+
+		if (level != scan->worker_limit) {
+			/**
+			** the ones above the new limit park after their current directory.
+			** The waiting ones are woken when it goes down, so those above it 
+			** park, and the signals they got reach the ones below it
+			**/
+			if (level > scan->worker_limit)
+				pthread_cond_broadcast(&scan->park_cond);
+			else
+				pthread_cond_broadcast(&scan->queue_cond);
+
+			scan->worker_limit = level;
+			scan->adjustments++;
+		}
+	}
+
+	pthread_mutex_unlock(&scan->queue_lock);
+
+	return NULL;
+}
+
+/**
+** returns the level for the next interval, given the entries/s 
+** measured at the current one
+**/
+static int controller_next_level(struct thread_controller *ctl, double rate, int max_level)
+{
+	// resting at the chosen level. After that it is measured again, the storage might have changed
+	if (ctl->hold > 0) {
+		if (--ctl->hold == 0)
+			ctl->base_rate = 0;
+		return ctl->level;
+	}
+
+	if (ctl->base_rate == 0) {
+		ctl->base_level = ctl->level;
+		ctl->base_rate = rate;
+		return controller_probe(ctl, max_level);
+	}
+
+	double change = rate / ctl->base_rate - 1;
+	double expected = (double)(ctl->level - ctl->base_level) / ctl->base_level * AUTO_THREADS_EFFICIENCY;
+
+	/**
+	** expected is negative for a step down, a smaller loss than that is 
+	** accepted. The best rate is kept then, so a series of small losses 
+	** can`t add up to a big one
+	**/
+	if (change > expected) {
+		ctl->base_level = ctl->level;
+		ctl->base_rate = rate > ctl->base_rate ? rate : ctl->base_rate;
+		return controller_probe(ctl, max_level);
+	}
+
+	// the step didn`t pay off, back to the last good level
+	ctl->level = ctl->base_level;
+	ctl->direction = -ctl->direction;
+	ctl->hold = AUTO_THREADS_HOLD;
+
+	return ctl->level;
+}
+
+/**
+** steps up by half of the current level, or down by a quarter (at least 1).
+** At the limits the direction turns, and it rests until the next probe
+**/
+static int controller_probe(struct thread_controller *ctl, int max_level)
+{
+	int step = ctl->direction > 0 ? ctl->level / 2 : ctl->level / 4;
+
+	if (step < 1)
+		step = 1;
+
+	int level = ctl->level + ctl->direction * step;
+
+	if (level > max_level)
+		level = max_level;
+	if (level < 1)
+		level = 1;
+
+	if (level == ctl->level) {
+		ctl->direction = -ctl->direction;
+		ctl->hold = AUTO_THREADS_HOLD;
+	}
+
+	ctl->level = level;
+
+	return level;
+}
+
+static unsigned long get_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/**
+** registers d as a new root with its own queue lists, returns its job index
+**/
+static int add_job(struct bdu_scan *scan, struct dir_entry *d)
+{
+	struct dir_entry **roots = realloc(scan->roots, (scan->roots_len+1) * sizeof(struct dir_entry *));
+	int job = scan->roots_len;
+
+	if (!roots) {
+		printf("Error allocating memory for root entries array!\n");
+		return -1;
+	}
+
+	scan->roots = roots;
+
+	struct queue_list **queues = realloc(scan->queues, (job+1) * scan->num_nodes * sizeof(struct queue_list *));
+
+	if (!queues) {
+		printf("Error allocating memory for the queues!\n");
+		return -1;
+	}
+
+	scan->queues = queues;
+
+	for (int i = 0; i < scan->num_nodes; i++) {
+		queues[job * scan->num_nodes + i] = queue_new_list();
+
+		if (!queues[job * scan->num_nodes + i]) {
+			for (int j = 0; j < i; j++)
+				queue_free_list(queues[job * scan->num_nodes + j]);
+			return -1;
+		}
+	}
+
+	scan->roots[scan->roots_len] = d;
+	scan->roots_len++;
+
+	scan->mem_used += dir_get_dentry_mem_size(d);
+
+	return job;
+}
+
+/**
+** the job (root) a dentry belongs to
+**/
+static int get_job(struct bdu_scan *scan, struct dir_entry *d)
+{
+	while (d->parent)
+		d = d->parent;
+
+	for (int i = 0; i < scan->roots_len; i++) {
+		if (scan->roots[i] == d)
+			return i;
+	}
+
+	return 0;
+}
+
+/**
+** --prefetch: hands the directories at the front of the list to the 
+** prefetcher, the workers take their next ones from there. prefetch_depth
+** of them for every worker, until the prefetcher is full. Called with 
+** queue_lock held
+**/
+static void prefetch_queued(struct bdu_scan *scan, struct queue_list *list)
+{
+	int window = scan->opts.prefetch_depth * scan->opts.num_threads;
+	struct queue_elem *elem = list->head;
+
+	for (int i = 0; elem && i < window; i++, elem = elem->next) {
+		if (elem->tag != SCAN_TASK_DIR)
+			continue;
+
+		if (fs_prefetch_hint(scan->prefetch_fs, ((struct dir_entry *)elem->data)->path) != 0)
+			break;
+
+		elem->tag = SCAN_TASK_DIR_HINTED;
+	}
+}
+
+/**
+** --checkpoint: writes a checkpoint every checkpoint_interval seconds, and
+** a last one when the interrupt flag is set. Then the workers are stopped,
+** and bdu_scan_run returns with what is left in the queue
+**/
+static void *checkpoint_thread_fn(void *arg)
+{
+	struct bdu_scan *scan = (struct bdu_scan *)arg;
+	unsigned long interval_ns = scan->opts.checkpoint_interval * 1000000000UL;
+	unsigned long next_ns = get_ns() + interval_ns;
+	struct timespec ts;
+
+	pthread_mutex_lock(&scan->queue_lock);
+
+	while (!scan->ckpt_stop) {
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		ts.tv_sec += CHECKPOINT_POLL_SEC;
+
+		while (!scan->ckpt_stop && pthread_cond_timedwait(&scan->ckpt_cond, &scan->queue_lock, &ts) != ETIMEDOUT)
+			;
+
+		if (scan->ckpt_stop)
+			break;
+
+		int interrupted = scan->opts.interrupt && *scan->opts.interrupt;
+
+		if (!interrupted && get_ns() < next_ns)
+			continue;
+
+		// the workers finish the task they are on, and wait for the write
+		scan->paused = 1;
+
+		while (scan->active_workers > 0)
+			pthread_cond_wait(&scan->pause_cond, &scan->queue_lock);
+
+		pthread_mutex_unlock(&scan->queue_lock);
+
+		write_checkpoint(scan);
+
+		pthread_mutex_lock(&scan->queue_lock);
+
+		next_ns = get_ns() + interval_ns;
+		scan->paused = 0;
+		scan->stopped = interrupted;
+
+		pthread_cond_broadcast(&scan->pause_cond);
+		pthread_cond_broadcast(&scan->queue_cond);
+		pthread_cond_broadcast(&scan->park_cond);
+
+		if (interrupted)
+			break;
+	}
+
+	pthread_mutex_unlock(&scan->queue_lock);
+
+	return NULL;
+}
+
+/**
+** saves the tree and the queue. Called while the workers are paused,
+** so nothing changes them
+**/
+static int write_checkpoint(struct bdu_scan *scan)
+{
+	struct checkpoint_state state = {
+		.roots = scan->roots,
+		.roots_len = scan->roots_len,
+		.max_depth = scan->opts.dir.max_depth,
+		.num_age_limits = scan->opts.dir.num_age_limits,
+		.now = scan->opts.dir.now
+	};
+	int ret;
+
+	state.queued = malloc((scan->queued + 1) * sizeof(struct dir_entry *));
+	state.chunks = malloc((scan->queued + 1) * sizeof(struct dir_chunk *));
+
+	if (!state.queued || !state.chunks) {
+		printf("Error allocating memory for checkpoint!\n");
+		free(state.queued);
+		free(state.chunks);
+		return -1;
+	}
+
+	for (int i = 0; i < scan->roots_len * scan->num_nodes; i++) {
+		for (struct queue_elem *elem = scan->queues[i]->head; elem; elem = elem->next) {
+			if (elem->tag == SCAN_TASK_CHUNK)
+				state.chunks[state.chunks_len++] = (struct dir_chunk *)elem->data;
+			else 
+				state.queued[state.queued_len++] = (struct dir_entry *)elem->data;
+		}
+	}
+
+	ret = checkpoint_write(scan->opts.checkpoint_path, &state);
+
+	free(state.queued);
+	free(state.chunks);
+
+	return ret;
+}
@@ -0,0 +1,657 @@
+/* 
+ * Copyright (C) 2025 Zoltán Rácz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  
+ */
+
+/**
+** A snapshot is a header followed by a record for every directory of the 
+** scanned trees, in depth first order, with the children of a directory 
+** sorted by name. That orders all the records of the file by path (see 
+** snapshot_cmp_path), so any number of snapshots can be merged by reading
+** them side by side, one record at a time. The depth of a record is its 
+** level below its root. The file ends with an end record, a truncated 
+** snapshot is not taken for a complete one.
+**
+** Like the checkpoints, the file is written next to the destination and 
+** renamed over it when complete.
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <linux/limits.h>
+
+#include "dir.h"
+#include "snapshot.h"
+
+struct snapshot_header {
+	char magic[8];
+	struct snapshot_info info;
+};
+
+struct snapshot_record {
+	struct dir_totals totals;
+	struct dir_estimate estimate;
+	time_t last_mtime;
+	int depth; // -1 in the end record
+	int path_len;
+};
+
+// an input of snapshot_merge, positioned on its next record
+struct snapshot_reader {
+	const char *name;
+	FILE *fp;
+	struct snapshot_record rec;
+	char path[PATH_MAX];
+	int done;
+};
+
+/**
+** a directory of the merged tree that can still get records below it. 
+** The inputs that had it are marked in inputs, the subtrees of the other 
+** ones below it are added to its record after it has been written (extra)
+**/
+struct merge_level {
+	char *path;
+	off_t offset;
+	struct snapshot_record rec;
+	int extra;
+	unsigned char *inputs;
+};
+
+static FILE *open_output(const char *path, char *tmp_path, size_t tmp_path_size, const struct snapshot_info *info);
+static int close_output(FILE *fp, const char *path, const char *tmp_path, int ret);
+static int write_dentry(FILE *fp, struct dir_entry *dentry, int depth);
+static int write_record(FILE *fp, const struct snapshot_record *rec, const char *path);
+static int read_header(FILE *fp, const char *path, struct snapshot_info *info);
+static int read_record(FILE *fp, struct snapshot_record *rec, char *path);
+static int advance_reader(struct snapshot_reader *reader);
+static int push_level(struct merge_level **levels, int *levels_len, int *levels_size, const char *path, int inputs_len);
+static int pop_level(FILE *fp, struct merge_level *levels, int *levels_len);
+static void add_record(struct snapshot_record *dst, const struct snapshot_record *src);
+static int append_dentry(struct dir_entry ***array, int *len, struct dir_entry *dentry);
+static int is_ancestor(const char *a, int a_len, const char *b);
+static int cmp_dentry(const void *a, const void *b);
+
+/**
+** writes the trees of the roots to path. The children of the dentries are
+** sorted by path in place. A root inside another root can`t be written, 
+** its records would not be in path order
+**/
+int snapshot_write(const char *path, struct dir_entry **roots, int roots_len, const struct snapshot_info *info)
+{
+	struct dir_entry **sorted = malloc((roots_len + 1) * sizeof(struct dir_entry *));
+	char tmp_path[PATH_MAX+4];
+	FILE *fp;
+	int ret = 0;
+
+	if (!sorted) {
+		printf("Error allocating memory for snapshot roots!\n");
+		return -1;
+	}
+
+	memcpy(sorted, roots, roots_len * sizeof(struct dir_entry *));
+	qsort(sorted, roots_len, sizeof(struct dir_entry *), cmp_dentry);
+
+	for (int i=1;i<roots_len;i++) {
+		if (is_ancestor(sorted[i-1]->path, sorted[i-1]->path_len, sorted[i]->path)) {
+			printf("Error writing snapshot file \"%s\", %s is inside %s!\n", path, sorted[i]->path, sorted[i-1]->path);
+			free(sorted);
+			return -1;
+		}
+	}
+
+	fp = open_output(path, tmp_path, sizeof(tmp_path), info);
+
+	if (!fp) {
+		free(sorted);
+		return -1;
+	}
+
+	for (int i=0;i<roots_len && ret == 0;i++)
+		ret = write_dentry(fp, sorted[i], 0);
+
+	free(sorted);
+
+	return close_output(fp, path, tmp_path, ret);
+}
+
+/**
+** merges the snapshots into one at path. The inputs are read side by side
+** in path order, and the records of the same path are summed up. Only the 
+** current record of every input and the directories above the current 
+** path are kept in memory, whatever the size of the trees.
+**
+** A root of one input can be inside a directory of another one (ex. /data
+** scanned on one host, /data/a on the other). Its subtree is added to the
+** merged directories above it too, except to the ones its own input had:
+** those include it already
+**/
+int snapshot_merge(const char *path, char **inputs, int inputs_len)
+{
+	struct snapshot_reader *readers = calloc(inputs_len, sizeof(struct snapshot_reader));
+	struct merge_level *levels = NULL;
+	int levels_len = 0;
+	int levels_size = 0;
+	struct snapshot_info info;
+	char tmp_path[PATH_MAX+4];
+	char min_path[PATH_MAX];
+	FILE *fp = NULL;
+	int ret = 0;
+
+	if (!readers) {
+		printf("Error allocating memory for snapshot readers!\n");
+		return -1;
+	}
+
+	memset(&info, 0, sizeof(info));
+
+	for (int i=0;i<inputs_len && ret == 0;i++) {
+		struct snapshot_info input_info;
+
+		readers[i].name = inputs[i];
+		readers[i].fp = fopen(inputs[i], "r");
+
+		if (!readers[i].fp) {
+			printf("Error opening snapshot file \"%s\" (%s)\n", inputs[i], strerror(errno));
+			ret = -1;
+			break;
+		}
+
+		if (read_header(readers[i].fp, inputs[i], &input_info) != 0) {
+			ret = -1;
+			break;
+		}
+
+		// summing the age buckets only makes sense if they have the same limits
+		if (i == 0)
+			info = input_info;
+		else if (input_info.num_age_limits != info.num_age_limits || 
+				memcmp(input_info.age_limits, info.age_limits, info.num_age_limits * sizeof(time_t)) != 0) {
+			printf("Error merging \"%s\", it was scanned with different --age-buckets than \"%s\"!\n", inputs[i], inputs[0]);
+			ret = -1;
+			break;
+		}
+
+		info.estimated |= input_info.estimated;
+		ret = advance_reader(&readers[i]);
+	}
+
+	if (ret == 0)
+		fp = open_output(path, tmp_path, sizeof(tmp_path), &info);
+
+	while (fp && ret == 0) {
+		struct merge_level *level;
+		const char *min = NULL;
+
+		for (int i=0;i<inputs_len;i++) {
+			if (!readers[i].done && (!min || snapshot_cmp_path(readers[i].path, min) < 0))
+				min = readers[i].path;
+		}
+
+		if (!min)
+			break;
+
+		// the reader of min moves on, the path is needed until all the inputs are past it
+		snprintf(min_path, sizeof(min_path), "%s", min);
+
+		// the directories not above this one have no more records to come
+		while (ret == 0 && levels_len && !is_ancestor(levels[levels_len-1].path, levels[levels_len-1].rec.path_len, min_path))
+			ret = pop_level(fp, levels, &levels_len);
+
+		if (ret != 0 || push_level(&levels, &levels_len, &levels_size, min_path, inputs_len) != 0) {
+			ret = -1;
+			break;
+		}
+
+		level = &levels[levels_len-1];
+
+		for (int i=0;i<inputs_len && ret == 0;i++) {
+			while (ret == 0 && !readers[i].done && strcmp(readers[i].path, min_path) == 0) {
+				add_record(&level->rec, &readers[i].rec);
+
+				for (int j=levels_len-2;j>=0 && !levels[j].inputs[i];j--) {
+					add_record(&levels[j].rec, &readers[i].rec);
+					levels[j].extra = 1;
+				}
+
+				level->inputs[i] = 1;
+				ret = advance_reader(&readers[i]);
+			}
+		}
+
+		level->offset = ftello(fp);
+
+		if (ret == 0 && (level->offset < 0 || write_record(fp, &level->rec, level->path) != 0)) {
+			printf("Error writing snapshot file \"%s\" (%s)\n", tmp_path, strerror(errno));
+			ret = -1;
+		}
+	}
+
+	while (levels_len) {
+		if (pop_level(fp, levels, &levels_len) != 0 && ret == 0) {
+			printf("Error writing snapshot file \"%s\" (%s)\n", tmp_path, strerror(errno));
+			ret = -1;
+		}
+	}
+
+	free(levels);
+
+	for (int i=0;i<inputs_len;i++) {
+		if (readers[i].fp)
+			fclose(readers[i].fp);
+	}
+
+	free(readers);
+
+	if (!fp)
+		return -1;
+
+	return close_output(fp, path, tmp_path, ret);
+}
+
+/**
+** reads the trees of a snapshot down to max_depth (-1 = all of it). The 
+** deeper records are skipped, their totals are in their parents already.
+** proc_mtime sets the last_mdate of the dentries (--time)
+**/
+int snapshot_load(const char *path, int max_depth, int proc_mtime, struct snapshot_info *info, struct dir_entry ***roots, int *roots_len)
+{
+	struct snapshot_record rec;
+	char rec_path[PATH_MAX];
+	struct dir_entry **levels = NULL; // the last dentry read on each level
+	int levels_len = 0;
+	FILE *fp = fopen(path, "r");
+	int ret;
+
+	*roots = NULL;
+	*roots_len = 0;
+
+	if (!fp) {
+		printf("Error opening snapshot file \"%s\" (%s)\n", path, strerror(errno));
+		return -1;
+	}
+
+	if (read_header(fp, path, info) != 0) {
+		fclose(fp);
+		return -1;
+	}
+
+	while ((ret = read_record(fp, &rec, rec_path)) > 0) {
+		struct dir_entry *parent;
+		struct dir_entry *dentry;
+
+		if (max_depth >= 0 && rec.depth > max_depth)
+			continue;
+
+		if (rec.depth > levels_len) {
+			ret = -1;
+			break;
+		}
+
+		parent = rec.depth > 0 ? levels[rec.depth-1] : NULL;
+		dentry = dir_create_dentry(rec_path);
+
+		if (!dentry) {
+			ret = -1;
+			break;
+		}
+
+		dentry->totals = rec.totals;
+		dentry->estimate = rec.estimate;
+		dentry->last_mtime = rec.last_mtime;
+		dentry->depth = rec.depth;
+		dentry->parent = parent;
+		dentry->pending = 0;
+
+		if (proc_mtime)
+			dentry->last_mdate = dir_get_dentry_mdate(rec.last_mtime);
+
+		if (append_dentry(parent ? &parent->children : roots, parent ? &parent->children_len : roots_len, dentry) != 0) {
+			dir_free_entry(dentry);
+			ret = -1;
+			break;
+		}
+
+		// the levels array grows like the children arrays, a level at a time
+		if (rec.depth == levels_len) {
+			int len = levels_len;
+
+			if (append_dentry(&levels, &len, dentry) != 0) {
+				ret = -1;
+				break;
+			}
+		}
+
+		levels[rec.depth] = dentry;
+		levels_len = rec.depth + 1;
+	}
+
+	free(levels);
+	fclose(fp);
+
+	if (ret < 0) {
+		printf("Error reading snapshot file \"%s\", it is truncated or corrupt!\n", path);
+
+		for (int i=0;i<*roots_len;i++)
+			dir_free_entry((*roots)[i]);
+
+		free(*roots);
+		*roots = NULL;
+		*roots_len = 0;
+
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+** orders the paths like the records of a snapshot: as strcmp, but with 
+** "/" before any other character, so a directory and everything below it
+** come right after each other
+**/
+int snapshot_cmp_path(const char *a, const char *b)
+{
+	const unsigned char *pa = (const unsigned char *)a;
+	const unsigned char *pb = (const unsigned char *)b;
+	int ca, cb;
+
+	while (*pa && *pa == *pb) {
+		pa++;
+		pb++;
+	}
+
+	ca = *pa == '/' ? 1 : *pa ? *pa + 1 : 0;
+	cb = *pb == '/' ? 1 : *pb ? *pb + 1 : 0;
+
+	return ca - cb;
+}
+
+static FILE *open_output(const char *path, char *tmp_path, size_t tmp_path_size, const struct snapshot_info *info)
+{
+	struct snapshot_header header;
+	FILE *fp;
+
+	snprintf(tmp_path, tmp_path_size, "%s.tmp", path);
+
+	fp = fopen(tmp_path, "w");
+
+	if (!fp) {
+		printf("Error creating snapshot file \"%s\" (%s)\n", tmp_path, strerror(errno));
+		return NULL;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+	header.info = *info;
+
+	if (fwrite(&header, sizeof(header), 1, fp) != 1) {
+		printf("Error writing snapshot file \"%s\" (%s)\n", tmp_path, strerror(errno));
+		fclose(fp);
+		unlink(tmp_path);
+		return NULL;
+	}
+
+	return fp;
+}
+
+/**
+** ends the file written by open_output and renames it to path, 
+** or removes it if ret is not 0
+**/
+static int close_output(FILE *fp, const char *path, const char *tmp_path, int ret)
+{
+	struct snapshot_record end;
+	int failed = ret != 0;
+
+	memset(&end, 0, sizeof(end));
+	end.depth = -1;
+
+	if (!failed && fwrite(&end, sizeof(end), 1, fp) != 1)
+		ret = -1;
+
+	// the rename must not be seen before the data is on the disk
+	if (ret != 0 || fflush(fp) != 0 || fsync(fileno(fp)) != 0)
+		ret = -1;
+
+	if (fclose(fp) != 0)
+		ret = -1;
+
+	if (ret == 0 && rename(tmp_path, path) != 0)
+		ret = -1;
+
+	if (ret != 0) {
+		if (!failed)
+			printf("Error writing snapshot file \"%s\" (%s)\n", path, strerror(errno));
+
+		unlink(tmp_path);
+	}
+
+	return ret;
+}
+
+static int write_dentry(FILE *fp, struct dir_entry *dentry, int depth)
+{
+	struct snapshot_record rec;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.totals = dentry->totals;
+	rec.estimate = dentry->estimate;
+	rec.last_mtime = dentry->last_mtime;
+	rec.depth = depth;
+	rec.path_len = dentry->path_len;
+
+	if (write_record(fp, &rec, dentry->path) != 0) {
+		printf("Error writing snapshot record of \"%s\" (%s)\n", dentry->path, strerror(errno));
+		return -1;
+	}
+
+	if (dentry->children_len > 1)
+		qsort(dentry->children, dentry->children_len, sizeof(struct dir_entry *), cmp_dentry);
+
+	for (int i=0;i<dentry->children_len;i++) {
+		if (write_dentry(fp, dentry->children[i], depth + 1) != 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int write_record(FILE *fp, const struct snapshot_record *rec, const char *path)
+{
+	if (fwrite(rec, sizeof(struct snapshot_record), 1, fp) != 1 || 
+			fwrite(path, 1, rec->path_len, fp) != (size_t)rec->path_len)
+		return -1;
+
+	return 0;
+}
+
+static int read_header(FILE *fp, const char *path, struct snapshot_info *info)
+{
+	struct snapshot_header header;
+
+	if (fread(&header, sizeof(header), 1, fp) != 1 || 
+			memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 || 
+			header.info.num_age_limits < 0 || header.info.num_age_limits >= DIR_AGE_BUCKETS_MAX) {
+		printf("Error reading snapshot file \"%s\", it is not a bdu snapshot!\n", path);
+		return -1;
+	}
+
+	*info = header.info;
+
+	return 0;
+}
+
+/**
+** reads the next record and its path. Returns 1, 0 on the end record 
+** and -1 if the file ends before it or the record is corrupt
+**/
+static int read_record(FILE *fp, struct snapshot_record *rec, char *path)
+{
+	if (fread(rec, sizeof(struct snapshot_record), 1, fp) != 1)
+		return -1;
+
+	if (rec->depth == -1)
+		return 0;
+
+	if (rec->depth < 0 || rec->path_len <= 0 || rec->path_len >= PATH_MAX || 
+			fread(path, 1, rec->path_len, fp) != (size_t)rec->path_len)
+		return -1;
+
+	path[rec->path_len] = '\0';
+
+	return 1;
+}
+
+/**
+** moves the reader to its next record. The records of every 
+** input have to come in path order, or they can`t be merged
+**/
+static int advance_reader(struct snapshot_reader *reader)
+{
+	char prev[PATH_MAX];
+	int ret;
+
+	snprintf(prev, sizeof(prev), "%s", reader->path);
+
+	ret = read_record(reader->fp, &reader->rec, reader->path);
+
+	if (ret < 0) {
+		printf("Error reading snapshot file \"%s\", it is truncated or corrupt!\n", reader->name);
+		return -1;
+	}
+
+	if (ret == 0) {
+		reader->done = 1;
+		return 0;
+	}
+
+	if (snapshot_cmp_path(reader->path, prev) < 0) {
+		printf("Error reading snapshot file \"%s\", %s is out of order!\n", reader->name, reader->path);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int push_level(struct merge_level **levels, int *levels_len, int *levels_size, const char *path, int inputs_len)
+{
+	struct merge_level *level;
+
+	if (*levels_len == *levels_size) {
+		int size = *levels_size ? *levels_size * 2 : 16;
+		struct merge_level *grown = realloc(*levels, size * sizeof(struct merge_level));
+
+		if (!grown) {
+			printf("Error allocating memory for merged directories!\n");
+			return -1;
+		}
+
+		*levels = grown;
+		*levels_size = size;
+	}
+
+	level = &(*levels)[*levels_len];
+	memset(level, 0, sizeof(struct merge_level));
+
+	level->path = strdup(path);
+	level->inputs = calloc(inputs_len, 1);
+
+	if (!level->path || !level->inputs) {
+		printf("Error allocating memory for merged directories!\n");
+		free(level->path);
+		free(level->inputs);
+		return -1;
+	}
+
+	level->rec.depth = *levels_len;
+	level->rec.path_len = strlen(path);
+	(*levels_len)++;
+
+	return 0;
+}
+
+/**
+** the last level is complete. Its record is written again 
+** if subtrees of other inputs were added to it since
+**/
+static int pop_level(FILE *fp, struct merge_level *levels, int *levels_len)
+{
+	struct merge_level *level = &levels[--(*levels_len)];
+	int ret = 0;
+
+	if (level->extra && (fseeko(fp, level->offset, SEEK_SET) != 0 || 
+			fwrite(&level->rec, sizeof(level->rec), 1, fp) != 1 || fseeko(fp, 0, SEEK_END) != 0))
+		ret = -1;
+
+	free(level->path);
+	free(level->inputs);
+
+	return ret;
+}
+
+static void add_record(struct snapshot_record *dst, const struct snapshot_record *src)
+{
+	dir_totals_add(&dst->totals, &src->totals);
+
+	dst->estimate.subdirs += src->estimate.subdirs;
+
+	for (int i=0;i<3;i++)
+		dst->estimate.var[i] += src->estimate.var[i];
+
+	if (src->last_mtime > dst->last_mtime)
+		dst->last_mtime = src->last_mtime;
+}
+
+/**
+** the arrays grow to the next power of 2 when their length reaches one
+**/
+static int append_dentry(struct dir_entry ***array, int *len, struct dir_entry *dentry)
+{
+	if ((*len & (*len - 1)) == 0) {
+		struct dir_entry **grown = realloc(*array, (*len ? *len * 2 : 1) * sizeof(struct dir_entry *));
+
+		if (!grown) {
+			printf("Error allocating memory for snapshot entries!\n");
+			return -1;
+		}
+
+		*array = grown;
+	}
+
+	(*array)[(*len)++] = dentry;
+
+	return 0;
+}
+
+// a is a directory above b (a_len is the length of a)
+static int is_ancestor(const char *a, int a_len, const char *b)
+{
+	if (strncmp(a, b, a_len) != 0 || b[a_len] == '\0')
+		return 0;
+
+	return b[a_len] == '/' || a[a_len-1] == '/';
+}
+
+static int cmp_dentry(const void *a, const void *b)
+{
+	const struct dir_entry *da = *(const struct dir_entry **)a;
+	const struct dir_entry *db = *(const struct dir_entry **)b;
+
+	return snapshot_cmp_path(da->path, db->path);
+}
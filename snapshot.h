@@ -0,0 +1,41 @@
+/* 
+ * Copyright (C) 2025 Zoltán Rácz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  
+ */
+
+#include <time.h>
+
+#include "dir.h"
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#define SNAPSHOT_MAGIC "BDUSNAP1"
+
+/**
+** what a snapshot was scanned with. The age buckets of snapshots can 
+** only be merged and shown if their limits are the same
+**/
+struct snapshot_info {
+	int num_age_limits;
+	time_t age_limits[DIR_AGE_BUCKETS_MAX-1];
+	int estimated; // --estimate, the dentries carry the variance of their totals
+};
+
+int snapshot_write(const char *path, struct dir_entry **roots, int roots_len, const struct snapshot_info *info);
+int snapshot_merge(const char *path, char **inputs, int inputs_len);
+int snapshot_load(const char *path, int max_depth, int proc_mtime, struct snapshot_info *info, struct dir_entry ***roots, int *roots_len);
+int snapshot_cmp_path(const char *a, const char *b);
+
+#endif //SNAPSHOT_H
@@ -0,0 +1,248 @@
+/* 
+ * Copyright (C) 2025 Zoltán Rácz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  
+ */
+
+/**
+** The children of a dentry are written as one group: the number of children, 
+** followed by one record for each child, in the final (sorted) order. A child 
+** which has children of its own is spilled before its parent, so its record
+** holds the offset of its group. The dentry keeps only children_len and
+** the offset of the group (spill_off), and loads it back while printing.
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "dir.h"
+#include "spill.h"
+
+struct spill_record {
+	struct dir_totals totals;
+	struct dir_estimate estimate;
+	time_t last_mtime;
+	long spill_off;
+	int children_len;
+	int depth;
+	int path_len;
+	int has_mdate;
+};
+
+// dir_get_dentry_mdate() returns 20 byte strings
+#define SPILL_MDATE_LEN 20
+
+struct spill_file *spill_new()
+{
+	struct spill_file *spill = (struct spill_file *)malloc(sizeof(struct spill_file));
+
+	if (!spill) {
+		printf("Error allocating memory for spill file!\n");
+		return NULL;
+	}
+
+	spill->fp = tmpfile();
+
+	if (!spill->fp) {
+		printf("Error creating spill file (%s)\n", strerror(errno));
+		free(spill);
+		return NULL;
+	}
+
+	pthread_mutex_init(&spill->lock, NULL);
+
+	return spill;
+}
+
+/**
+** moves the children of a completed dentry (and everything below them) to 
+** the spill file, sorted with sort_flags. The number of bytes released is 
+** added to freed
+**/
+int spill_write_children(struct spill_file *spill, struct dir_entry *dentry, int sort_flags, size_t *freed)
+{
+	struct spill_record rec;
+	long off;
+	int ret = 0;
+
+	if (!dentry->children || !dentry->children_len)
+		return 0;
+
+	// deepest groups first, their offsets go in the records of this group
+	for (int i=0;i<dentry->children_len;i++) {
+		if (spill_write_children(spill, dentry->children[i], sort_flags, freed) != 0)
+			return -1;
+	}
+
+	dir_sort_entries(dentry->children, dentry->children_len, 0, 0, sort_flags);
+
+	pthread_mutex_lock(&spill->lock);
+
+	fseek(spill->fp, 0, SEEK_END);
+	off = ftell(spill->fp);
+
+	if (fwrite(&dentry->children_len, sizeof(int), 1, spill->fp) != 1)
+		ret = -1;
+
+	for (int i=0;i<dentry->children_len && ret == 0;i++) {
+		struct dir_entry *child = dentry->children[i];
+
+		memset(&rec, 0, sizeof(rec));
+		rec.totals = child->totals;
+		rec.estimate = child->estimate;
+		rec.last_mtime = child->last_mtime;
+		rec.spill_off = child->spill_off;
+		rec.children_len = child->children_len;
+		rec.depth = child->depth;
+		rec.path_len = child->path_len;
+		rec.has_mdate = child->last_mdate != NULL;
+
+		if (fwrite(&rec, sizeof(rec), 1, spill->fp) != 1 ||
+			fwrite(child->path, 1, child->path_len, spill->fp) != (size_t)child->path_len ||
+			(rec.has_mdate && fwrite(child->last_mdate, 1, SPILL_MDATE_LEN, spill->fp) != SPILL_MDATE_LEN))
+			ret = -1;
+	}
+
+	pthread_mutex_unlock(&spill->lock);
+
+	if (ret != 0) {
+		printf("Error writing spill file (%s)\n", strerror(errno));
+		return -1;
+	}
+
+	*freed += dir_get_children_mem_size(dentry);
+
+	dir_free_entries(dentry->children, dentry->children_len);
+	dentry->children = NULL;
+	dentry->spill_off = off;
+
+	return 0;
+}
+
+/**
+** reads the children of a spilled dentry back into memory. Their own 
+** children stay in the file until they are loaded too
+**/
+int spill_load_children(struct spill_file *spill, struct dir_entry *dentry)
+{
+	struct spill_record rec;
+	int fd = fileno(spill->fp);
+	off_t off = dentry->spill_off;
+	int children_len = 0;
+	char *path = NULL;
+
+	if (dentry->children || dentry->spill_off < 0)
+		return 0;
+
+	// the workers may still be writing other groups (streamed output)
+	pthread_mutex_lock(&spill->lock);
+	fflush(spill->fp);
+	pthread_mutex_unlock(&spill->lock);
+
+	if (pread(fd, &children_len, sizeof(int), off) != sizeof(int))
+		goto err;
+
+	off += sizeof(int);
+
+	dentry->children = calloc(children_len, sizeof(struct dir_entry *));
+
+	if (!dentry->children) {
+		printf("Error allocating memory for spilled entries!\n");
+		return -1;
+	}
+
+	for (int i=0;i<children_len;i++) {
+		if (pread(fd, &rec, sizeof(rec), off) != sizeof(rec))
+			goto err;
+
+		off += sizeof(rec);
+
+		path = malloc(rec.path_len + 1);
+
+		if (!path || pread(fd, path, rec.path_len, off) != rec.path_len)
+			goto err;
+
+		path[rec.path_len] = '\0';
+		off += rec.path_len;
+
+		struct dir_entry *child = dir_create_dentry(path);
+
+		free(path);
+		path = NULL;
+
+		if (!child)
+			goto err;
+
+		child->totals = rec.totals;
+		child->estimate = rec.estimate;
+		child->last_mtime = rec.last_mtime;
+		child->spill_off = rec.spill_off;
+		child->children_len = rec.children_len;
+		child->depth = rec.depth;
+		child->parent = dentry;
+		child->pending = 0;
+
+		dentry->children[i] = child;
+
+		if (rec.has_mdate) {
+			child->last_mdate = malloc(SPILL_MDATE_LEN);
+
+			if (!child->last_mdate || pread(fd, child->last_mdate, SPILL_MDATE_LEN, off) != SPILL_MDATE_LEN)
+				goto err;
+
+			off += SPILL_MDATE_LEN;
+		}
+	}
+
+	return 0;
+
+err:
+	printf("Error reading spill file!\n");
+	free(path);
+
+	if (dentry->children) {
+		for (int i=0;i<children_len;i++)
+			dir_free_entry(dentry->children[i]);
+
+		free(dentry->children);
+		dentry->children = NULL;
+	}
+
+	return -1;
+}
+
+/**
+** drops the loaded children again, they can be loaded any time from the file
+**/
+void spill_unload_children(struct dir_entry *dentry)
+{
+	if (dentry->spill_off < 0 || !dentry->children)
+		return;
+
+	dir_free_entries(dentry->children, dentry->children_len);
+	dentry->children = NULL;
+}
+
+void spill_free(struct spill_file *spill)
+{
+	if (!spill)
+		return;
+
+	fclose(spill->fp);
+	pthread_mutex_destroy(&spill->lock);
+	free(spill);
+}
@@ -0,0 +1,40 @@
+/* 
+ * Copyright (C) 2025 Zoltán Rácz
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.  
+ */
+
+#include <stdio.h>
+#include <pthread.h>
+
+#include "dir.h"
+
+#ifndef SPILL_H
+#define SPILL_H
+
+/**
+** temporary file the completed subtrees are moved to when the scan 
+** goes over --memory-limit. It is deleted automatically when closed
+**/
+struct spill_file {
+	FILE *fp;
+	pthread_mutex_t lock;
+};
+
+struct spill_file *spill_new();
+int spill_write_children(struct spill_file *spill, struct dir_entry *dentry, int sort_flags, size_t *freed);
+int spill_load_children(struct spill_file *spill, struct dir_entry *dentry);
+void spill_unload_children(struct dir_entry *dentry);
+void spill_free(struct spill_file *spill);
+
+#endif //SPILL_H
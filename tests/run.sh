@@ -0,0 +1,107 @@
+#!/bin/sh
+#
+# Copyright (C) 2025 Zoltán Rácz
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, version 2 of the License.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#
+# scans small trees made in a temporary directory and compares the
+# csv records (path and apparent size) with the expected ones.
+# Run with "make test"
+
+BDU="$(cd "$(dirname "$0")/.." && pwd)/bdu"
+TMP=$(mktemp -d)
+FAILED=0
+
+trap 'rm -rf "$TMP"' EXIT
+
+# path,apparent size of every record, the errors go to stderr
+records() {
+	"$BDU" --output-format=csv --threads=2 "$@" 2>"$TMP/stderr" | tail -n +2 | cut -d, -f4,6 | sort
+}
+
+check() {
+	name=$1
+	expected=$2
+	actual=$3
+
+	if [ "$actual" != "$expected" ] || grep -q "Error" "$TMP/stderr"; then
+		echo "FAIL: $name"
+		echo "expected:"
+		echo "$expected"
+		echo "got:"
+		echo "$actual"
+		cat "$TMP/stderr"
+		FAILED=1
+	else
+		echo "ok: $name"
+	fi
+}
+
+mkdir -p "$TMP/tree/a" "$TMP/tree/c"
+head -c 5000 /dev/zero > "$TMP/tree/a/f"
+head -c 9000 /dev/zero > "$TMP/tree/c/g"
+
+# relative roots, the prefix of the entries is the path as given
+check "relative root" '"tree",14000
+"tree/a",5000
+"tree/c",9000' "$(cd "$TMP" && records tree)"
+
+check "bare ." '".",14000
+"./a",5000
+"./c",9000' "$(cd "$TMP/tree" && records)"
+
+check "absolute root" "\"$TMP/tree\",14000
+\"$TMP/tree/a\",5000
+\"$TMP/tree/c\",9000" "$(records "$TMP/tree")"
+
+# --checkpoint / --resume: a scan interrupted with SIGINT (slowed down 
+# with --max-ops so it is still running) and resumed gives the same 
+# records as an uninterrupted one
+for i in 1 2 3 4 5; do
+	for j in 1 2 3 4 5; do
+		mkdir -p "$TMP/big/d$i/e$j"
+		head -c $((i * 1000 + j)) /dev/zero > "$TMP/big/d$i/e$j/f"
+		head -c $j /dev/zero > "$TMP/big/d$i/g$j"
+	done
+done
+
+expected=$(records "$TMP/big")
+
+"$BDU" --output-format=csv --checkpoint="$TMP/ckpt" --max-ops=40/s "$TMP/big" >/dev/null 2>&1 &
+pid=$!
+sleep 1
+kill -INT $pid
+wait $pid
+status=$?
+
+if [ $status -ne 130 ] || [ ! -f "$TMP/ckpt" ]; then
+	echo "FAIL: interrupted scan (exit status $status, no checkpoint or the scan finished before SIGINT)"
+	FAILED=1
+else
+	check "checkpoint and resume" "$expected" "$(records --resume="$TMP/ckpt")"
+fi
+
+# --merge: a snapshot of tree/a, taken after a subdirectory was added to 
+# it, is merged into a snapshot of tree. Its totals are added to tree/a 
+# and to tree above it, and the new subdirectory shows up
+"$BDU" --snapshot-out="$TMP/tree.snap" "$TMP/tree" >/dev/null 2>&1
+mkdir "$TMP/tree/a/new"
+head -c 1000 /dev/zero > "$TMP/tree/a/new/h"
+"$BDU" --snapshot-out="$TMP/a.snap" "$TMP/tree/a" >/dev/null 2>&1
+
+check "merge nested snapshots" "\"$TMP/tree\",20000
+\"$TMP/tree/a\",11000
+\"$TMP/tree/a/new\",1000
+\"$TMP/tree/c\",9000" "$(records --merge "$TMP/tree.snap" "$TMP/a.snap")"
+
+exit $FAILED
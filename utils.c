@@ -47,4 +47,34 @@ long int human_size_to_bytes(const char *input)
 	}
 
 	return bytes;
+}
+
+/**
+** converts durations like 30s, 15m, 12h, 7d, 2w or 1y to seconds.
+** Numbers without unit are seconds. Returns -1 if the input is invalid
+**/
+long int human_duration_to_seconds(const char *input)
+{
+	const char units[] = { 's', 'm', 'h', 'd', 'w', 'y' };
+	const long int unit_seconds[] = { 1, 60, 3600, 86400, 7*86400, 365*86400 };
+	int units_len = sizeof(units);
+
+	long int value;
+	char unit = 0;
+	char extra = 0;
+
+	if (sscanf(input, "%ld%c%c", &value, &unit, &extra) < 1 || extra != 0 || value < 0)
+		return -1;
+
+	if (unit == 0)
+		return value;
+
+	unit = tolower(unit);
+
+	for (int i=0;i<units_len;i++) {
+		if (units[i] == unit) 
+			return value * unit_seconds[i];
+	}
+
+	return -1;
 }
\ No newline at end of file
@@ -18,5 +18,6 @@
 #define UTILS_H
 
 long int human_size_to_bytes(const char *input);
+long int human_duration_to_seconds(const char *input);
 
 #endif // UTILS_H
\ No newline at end of file